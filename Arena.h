@@ -0,0 +1,137 @@
+#ifndef _A5597977_7172_4077_9147_E7EC09925696_
+#define  _A5597977_7172_4077_9147_E7EC09925696_
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Bump allocator for memory of one unit of work (the lines of a file being
+// assembled, scratch of a worker) that is given back all at once by Reset.
+// Reset keeps the blocks: once a thread has seen its largest input it does
+// not call the heap any more, and threads never contend on malloc.
+//
+// Not thread safe; one arena per worker thread.
+class Arena
+{
+public:
+	static const size_t DefaultBlockSize = 64 * 1024;
+
+	explicit Arena(size_t blockSize = DefaultBlockSize)
+		: blockSize(blockSize)
+	{
+	}
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	inline void* Allocate(size_t size, size_t alignment);
+
+	// only the latest allocation is taken back at once, the rest waits for Reset
+	inline void Deallocate(void* p, size_t size);
+
+	// everything allocated so far is invalid afterwards
+	void Reset()
+	{
+		current = 0;
+		offset = 0;
+	}
+
+	// bytes held from the heap, used or not
+	size_t Capacity() const
+	{
+		size_t total = 0;
+		for (const Block& block : blocks)
+			total += block.size;
+		return total;
+	}
+
+private:
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	static size_t AlignUp(const char* base, size_t offset, size_t alignment)
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(base + offset);
+		return offset + ((alignment - address % alignment) % alignment);
+	}
+
+	std::vector<Block> blocks;
+	size_t current = 0; // block being filled
+	size_t offset = 0;  // first free byte in it
+	size_t blockSize;
+};
+
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	assert(alignment && !(alignment & (alignment - 1)));
+	// the current block, then the ones a Reset left behind, then a new one
+	for (; current < blocks.size(); ++current, offset = 0)
+	{
+		Block& block = blocks[current];
+		const size_t start = AlignUp(block.data.get(), offset, alignment);
+		if (start <= block.size && block.size - start >= size)
+		{
+			offset = start + size;
+			return block.data.get() + start;
+		}
+	}
+
+	const size_t needed = size + alignment - 1;
+	const size_t bytes = needed > blockSize ? needed : blockSize;
+	Block block = { std::unique_ptr<char[]>(new char[bytes]), bytes };
+	blocks.push_back(std::move(block));
+	current = blocks.size() - 1;
+	const size_t start = AlignUp(blocks[current].data.get(), 0, alignment);
+	offset = start + size;
+	return blocks[current].data.get() + start;
+}
+
+void Arena::Deallocate(void* p, size_t size)
+{
+	if (current >= blocks.size())
+		return;
+	char* data = blocks[current].data.get();
+	if (static_cast<char*>(p) + size == data + offset)
+		offset = static_cast<char*>(p) - data;
+}
+
+// standard allocator on an Arena, for containers that live no longer than the
+// arena's next Reset
+template<typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(Arena& arena) : arena(&arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(arena->Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T* p, size_t count)
+	{
+		arena->Deallocate(p, count * sizeof(T));
+	}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+	template<typename U>
+	friend class ArenaAllocator;
+
+	Arena* arena;
+};
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef _47F1E684_7AC1_4DEE_B1DB_9E12E0DA04F6_
+#define  _47F1E684_7AC1_4DEE_B1DB_9E12E0DA04F6_
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// Overlapped input and output for one sequential stream (--pipeline): a
+// reader thread fills chunk N+1 while the caller decodes chunk N, and a
+// writer thread hands block N-1 to the output while the caller formats block
+// N. Between the stages are bounded queues of Depth buffers each, so memory
+// stays at Depth chunks per direction and a slow stage holds up the others
+// instead of letting the queue grow.
+//
+// For a single stream read front to back a blocking read on its own thread
+// overlaps as well as io_uring or IOCP would; it needs neither liburing nor
+// separate code per platform.
+
+// fixed capacity FIFO shared by a producer and a consumer thread
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(capacity) { assert(capacity); }
+
+	// waits for room; false once the queue is closed
+	inline bool Push(const T& item);
+	// waits for an item; false once the queue is closed and empty
+	inline bool Pop(T& item);
+	// wakes both sides, later Pushes fail
+	inline void Close();
+
+private:
+	const size_t capacity;
+	std::deque<T> items;
+	bool closed = false;
+	std::mutex lock;
+	std::condition_variable changed;
+};
+
+
+template<typename T>
+bool BoundedQueue<T>::Push(const T& item)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this] { return closed || items.size() < capacity; });
+	if (closed)
+		return false;
+	items.push_back(item);
+	changed.notify_all();
+	return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::Pop(T& item)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this] { return closed || !items.empty(); });
+	if (items.empty())
+		return false;
+	item = items.front();
+	items.pop_front();
+	changed.notify_all();
+	return true;
+}
+
+template<typename T>
+void BoundedQueue<T>::Close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	closed = true;
+	changed.notify_all();
+}
+
+// Reads a file or stdin ahead of the caller, in chunks of a fixed size of
+// which only the last one is short. The chunk Next returns stays valid until
+// the following call, the others are in the reader's hands. The destructor
+// cancels a read that waits on a pipe or terminal, so a caller that stops
+// early does not wait for the producer; a chunk is only handed out once it
+// is full or the input ended, though.
+class AsyncReader
+{
+public:
+	static const size_t DefaultDepth = 3; // one decoded, two read ahead
+
+	inline explicit AsyncReader(size_t chunkSize, size_t depth = DefaultDepth);
+	AsyncReader(const AsyncReader&) = delete;
+	AsyncReader& operator=(const AsyncReader&) = delete;
+	// cancels a read in progress
+	inline ~AsyncReader();
+
+	// "-" is stdin; starts reading
+	inline bool Open(const char* fileName);
+
+	// the next chunk in order, false at the end of the input or after an error
+	inline bool Next(const char*& begin, const char*& end);
+
+	// a read failed, the input ended early; may still turn true until Next
+	// has returned false
+	bool Failed() const { return failed; }
+
+private:
+	struct Chunk
+	{
+		size_t index;
+		size_t size;
+	};
+
+	inline void Run();
+	inline size_t Read(char* data, size_t size);
+
+	const size_t chunkSize;
+	std::vector<std::vector<char>> buffers;
+	BoundedQueue<size_t> spare;
+	BoundedQueue<Chunk> full;
+	size_t current;
+	bool holding = false;
+	std::atomic<bool> failed{ false }; // written by the reader thread
+	std::atomic<bool> stopping{ false };
+	std::thread reader;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	bool owned = false;
+	std::atomic<bool> finished{ false };
+#else
+	int fd = -1;
+	int wake[2] = { -1, -1 }; // a byte in it ends the reader's wait for input
+#endif
+};
+
+
+AsyncReader::AsyncReader(size_t chunkSize, size_t depth)
+	: chunkSize(chunkSize), buffers(depth, std::vector<char>(chunkSize)), spare(depth), full(depth)
+{
+	assert(chunkSize && depth >= 2);
+	for (size_t i = 0; i < depth; ++i)
+		spare.Push(i);
+}
+
+AsyncReader::~AsyncReader()
+{
+	stopping = true;
+	spare.Close();
+	if (reader.joinable())
+	{
+#ifdef _WIN32
+		// again until it is out: a cancel before the thread is in ReadFile
+		// is lost
+		while (!finished)
+		{
+			::CancelSynchronousIo(reader.native_handle());
+			std::this_thread::yield();
+		}
+#else
+		const char stop = 0;
+		while (::write(wake[1], &stop, 1) < 0 && errno == EINTR)
+			;
+#endif
+		reader.join();
+	}
+#ifdef _WIN32
+	if (owned)
+		::CloseHandle(file);
+#else
+	if (fd > 0)
+		::close(fd);
+	for (const int end : wake)
+	{
+		if (end >= 0)
+			::close(end);
+	}
+#endif
+}
+
+bool AsyncReader::Open(const char* fileName)
+{
+	assert(fileName && !reader.joinable());
+	const bool fromStdin = !std::strcmp(fileName, "-");
+#ifdef _WIN32
+	file = fromStdin ? ::GetStdHandle(STD_INPUT_HANDLE)
+		: ::CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	owned = !fromStdin && file != INVALID_HANDLE_VALUE;
+	if (file == INVALID_HANDLE_VALUE || !file)
+		return false;
+#else
+	fd = fromStdin ? 0 : ::open(fileName, O_RDONLY);
+	if (fd < 0 || ::pipe(wake) != 0)
+		return false;
+#if defined(POSIX_FADV_SEQUENTIAL)
+	::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+	reader = std::thread([this] { Run(); });
+	return true;
+}
+
+bool AsyncReader::Next(const char*& begin, const char*& end)
+{
+	if (holding)
+		spare.Push(current);
+	Chunk chunk;
+	holding = full.Pop(chunk);
+	if (!holding)
+		return false;
+	current = chunk.index;
+	begin = buffers[current].data();
+	end = begin + chunk.size;
+	return true;
+}
+
+void AsyncReader::Run()
+{
+	size_t index;
+	while (spare.Pop(index))
+	{
+		const size_t size = Read(buffers[index].data(), chunkSize);
+		if (size && !full.Push({ index, size }))
+			break;
+		if (size < chunkSize)
+			break;
+	}
+	full.Close();
+#ifdef _WIN32
+	finished = true;
+#endif
+}
+
+// a whole chunk unless the input ends first, as std::istream::read
+size_t AsyncReader::Read(char* data, size_t size)
+{
+	size_t done = 0;
+	while (done < size)
+	{
+#ifdef _WIN32
+		DWORD count = 0;
+		const DWORD wanted = static_cast<DWORD>(std::min<size_t>(size - done, 1u << 30));
+		if (stopping)
+			break;
+		if (!::ReadFile(file, data + done, wanted, &count, nullptr))
+		{
+			// the end of a pipe is an error to ReadFile, a cancel ends reading
+			const DWORD error = ::GetLastError();
+			failed = error != ERROR_BROKEN_PIPE && error != ERROR_OPERATION_ABORTED;
+			break;
+		}
+#else
+		// waits for input or the destructor, whichever comes first
+		pollfd ready[2] = { { fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+		if (::poll(ready, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			failed = true;
+			break;
+		}
+		if (ready[1].revents)
+			break;
+		const ssize_t count = ::read(fd, data + done, size - done);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+		{
+			failed = true;
+			break;
+		}
+#endif
+		if (!count)
+			break;
+		done += count;
+	}
+	return done;
+}
+
+// Output stream buffer that passes full blocks to a writer thread, which
+// writes them to target in order. pubsync() and the destructor wait until
+// everything is written; target must not be used by others meanwhile. Once
+// target took less than it was given the writer stops and so does the
+// stream: the ostream on top goes bad and later output is dropped.
+class AsyncWriter : public std::streambuf
+{
+public:
+	static const size_t DefaultDepth = 3;
+
+	inline AsyncWriter(std::streambuf* target, size_t blockSize, size_t depth = DefaultDepth);
+	AsyncWriter(const AsyncWriter&) = delete;
+	AsyncWriter& operator=(const AsyncWriter&) = delete;
+	inline ~AsyncWriter();
+
+	// target took less than it was given
+	bool Failed() const { return failed; }
+
+protected:
+	inline int_type overflow(int_type c) override;
+	inline int sync() override;
+
+private:
+	struct Block
+	{
+		size_t index;
+		size_t size;
+	};
+
+	inline bool Submit();
+	inline void Run();
+
+	std::streambuf* target;
+	std::vector<std::vector<char>> buffers;
+	BoundedQueue<size_t> spare;
+	BoundedQueue<Block> full;
+	size_t current = 0;
+	uint64_t submitted = 0;
+	uint64_t written = 0;
+	std::atomic<bool> failed{ false }; // set under lock, for done
+	std::mutex lock;
+	std::condition_variable done;
+	std::thread writer;
+};
+
+
+AsyncWriter::AsyncWriter(std::streambuf* target, size_t blockSize, size_t depth)
+	: target(target), buffers(depth, std::vector<char>(blockSize)), spare(depth), full(depth)
+{
+	assert(target && blockSize && depth >= 2);
+	for (size_t i = 1; i < depth; ++i)
+		spare.Push(i);
+	setp(buffers[0].data(), buffers[0].data() + blockSize);
+	writer = std::thread([this] { Run(); });
+}
+
+AsyncWriter::~AsyncWriter()
+{
+	sync();
+	full.Close();
+	writer.join();
+}
+
+AsyncWriter::int_type AsyncWriter::overflow(int_type c)
+{
+	if (!Submit())
+		return traits_type::eof();
+	if (traits_type::eq_int_type(c, traits_type::eof()))
+		return traits_type::not_eof(c);
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+	return c;
+}
+
+int AsyncWriter::sync()
+{
+	if (pptr() != pbase() && !Submit())
+		return -1;
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [this] { return failed || written == submitted; });
+	return failed || target->pubsync() != 0 ? -1 : 0;
+}
+
+// the put area to the writer, a free buffer in its place; false once the
+// writer stopped, there is no put area then and every write overflows
+bool AsyncWriter::Submit()
+{
+	const bool handed = !failed && full.Push({ current, static_cast<size_t>(pptr() - pbase()) });
+	submitted += handed ? 1 : 0;
+	if (!handed || !spare.Pop(current))
+	{
+		failed = true;
+		setp(nullptr, nullptr);
+		return false;
+	}
+	setp(buffers[current].data(), buffers[current].data() + buffers[current].size());
+	return true;
+}
+
+void AsyncWriter::Run()
+{
+	Block block;
+	while (full.Pop(block))
+	{
+		const std::streamsize size = static_cast<std::streamsize>(block.size);
+		const bool complete = target->sputn(buffers[block.index].data(), size) == size;
+		spare.Push(block.index);
+		std::lock_guard<std::mutex> guard(lock);
+		++written;
+		done.notify_all();
+		if (!complete)
+		{
+			failed = true;
+			break;
+		}
+	}
+	// a Submit waiting for room or for a buffer gives up
+	full.Close();
+	spare.Close();
+}
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef _19F0C7A4_6E3B_4D25_B8D1_5A2E7C94F036_
+#define  _19F0C7A4_6E3B_4D25_B8D1_5A2E7C94F036_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Arena.h"
+#include "DecodeError.h"
+#include "DetectionCache.h"
+#include "DirectoryWalker.h"
+#include "HexWriter.h"
+#include "LineSplitter.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include "Normalizer.h"
+#include "Pipeline.h"
+#include "StreamingDecoder.h"
+#include "TextStatistics.h"
+#include "WorkStealingPool.h"
+
+// Detection and transcoding of many files at once. Inputs are files,
+// directories (walked recursively) and @list files with one path per line.
+// Every file gives one tab separated line:
+//   path  encoding  confidence  bytes  lines  units  status
+// in input order, or in completion order when ordered is false. The status is
+// "ok", "invalid at <offset> (<kind>)" when the policy stops at malformed
+// input, or "<count> replaced|skipped, first at <offset> (<kind>)". The
+// encoding of an empty or missing file, which nothing was detected in, is
+// "-".
+// With statistics the line is a JSON object instead, with path, encoding,
+// confidence, bytes and status and the members of TextStatistics.
+struct BatchOptions
+{
+	std::vector<std::string> inputs;
+	size_t threads = 0; // 0: one per hardware thread
+	bool ordered = true;
+	ErrorPolicy policy = ErrorPolicy::Stop;
+	DetectionCache* cache = nullptr; // unchanged files skip detection when set
+	TextEncoding ansi = TextEncoding::Ansi; // the code page of Ansi, see SingleByteEncodings
+	NormalForm form = NormalForm::None;     // of the text that lines and units are counted in
+	bool fold = false;
+	bool statistics = false;
+};
+
+class BatchRunner
+{
+public:
+	explicit BatchRunner(const BatchOptions& options)
+		: options(options)
+	{
+	}
+
+	// 0 if every file decoded, 1 if some did not
+	inline int Run(std::ostream& out);
+
+	struct FileResult
+	{
+		DetectionResult detected;
+		uint64_t bytes;
+		uint64_t lines;
+		uint64_t units;
+		const char* error; // nullptr if decoded
+		uint64_t errorCount;
+		DecodeError firstError;
+	};
+
+	// what a worker thread keeps from file to file; after the first few files
+	// decoding one does not touch the heap: the decoder buffers are reused and
+	// lines split by a block boundary are assembled in the arena, which is
+	// Reset per file
+	struct Worker
+	{
+		Worker() : decoder(TextEncoding::UTF8), splitter(ArenaAllocator<wchar_t>(arena)) {}
+
+		MappedFile input;
+		StreamingDecoder<wchar_t> decoder;
+		TextNormalizer<wchar_t> normalizer;
+		Arena arena;
+		LineSplitter<wchar_t, ArenaAllocator<wchar_t>> splitter;
+		TextStatistics<wchar_t> statistics;
+	};
+
+	// one file on the state of one worker, what Run does for every file
+	inline FileResult Process(const std::string& path, Worker& worker) const;
+
+private:
+	inline void Collect();
+	inline std::string Format(const std::string& path, const FileResult& result, const TextStatistics<wchar_t>& statistics) const;
+	inline std::string Status(const FileResult& result) const;
+
+	const BatchOptions& options;
+	std::vector<std::string> files;
+};
+
+
+// a missing input stays in the list and is reported as not found
+void BatchRunner::Collect()
+{
+	auto add = [this](const std::string& path) { files.push_back(path); };
+	for (const auto& input : options.inputs)
+	{
+		const bool found = input.size() > 1 && input[0] == '@'
+			? DirectoryWalker::ReadList(input.substr(1), add)
+			: DirectoryWalker::Walk(input, add);
+		if (!found)
+			files.push_back(input);
+	}
+}
+
+int BatchRunner::Run(std::ostream& out)
+{
+	Collect();
+
+	WorkStealingPool pool(options.threads);
+	std::vector<Worker> workers(pool.Size());
+	HexWriter writer(out);
+	std::mutex outputLock;
+	std::vector<std::string> pending(options.ordered ? files.size() : 0);
+	std::vector<char> ready(pending.size());
+	size_t next = 0;
+	size_t failed = 0;
+
+	pool.ForEach(files.size(), [&](size_t index, size_t self)
+	{
+		const FileResult result = Process(files[index], workers[self]);
+		std::string line = Format(files[index], result, workers[self].statistics);
+
+		std::lock_guard<std::mutex> guard(outputLock);
+		const metrics::ScopedStage stage(metrics::Stage::Output);
+		failed += result.error ? 1 : 0;
+		if (!options.ordered)
+		{
+			writer.Bytes(line.data(), line.data() + line.size());
+			return;
+		}
+		// print as soon as all earlier files are done
+		pending[index] = std::move(line);
+		ready[index] = 1;
+		for (; next < ready.size() && ready[next]; ++next)
+		{
+			writer.Bytes(pending[next].data(), pending[next].data() + pending[next].size());
+			std::string().swap(pending[next]);
+		}
+	});
+	writer.Flush();
+
+	return failed ? 1 : 0;
+}
+
+BatchRunner::FileResult BatchRunner::Process(const std::string& path, Worker& worker) const
+{
+	FileResult result = { { TextEncoding::Ansi, 0, 0 }, 0, 0, 0, nullptr, 0, { 0, DecodeErrorKind::InvalidByte } };
+	MappedFile& input = worker.input;
+	TextStatistics<wchar_t>& statistics = worker.statistics;
+	statistics.Reset();
+	const bool opened = [&input, &path]
+	{
+		const metrics::ScopedStage stage(metrics::Stage::Read);
+		return input.Open(path.c_str());
+	}();
+	if (!opened)
+	{
+		result.error = "not found";
+		return result;
+	}
+	result.bytes = input.Size();
+	if (!input.Size())
+	{
+		input.Close();
+		return result;
+	}
+
+	{
+		const metrics::ScopedStage stage(metrics::Stage::Detect);
+		result.detected = options.cache ? options.cache->Detect(path, input) : DetectEncoding(input.begin(), input.end());
+		if (result.detected.encoding == TextEncoding::Ansi)
+			result.detected.encoding = options.ansi;
+	}
+	metrics::Detected(result.detected);
+	const metrics::ScopedStage stage(metrics::Stage::Decode);
+	StreamingDecoder<wchar_t>& decoder = worker.decoder;
+	decoder.Reset(result.detected.encoding);
+	decoder.SetErrorPolicy(options.policy);
+	TextNormalizer<wchar_t>& normalizer = worker.normalizer;
+	normalizer.Reset(options.form, options.fold);
+	auto onLine = [&](const wchar_t* begin, const wchar_t* end)
+	{
+		++result.lines;
+		if (options.statistics)
+			statistics.Line(begin, end);
+	};
+	auto split = [&](const wchar_t* begin, const wchar_t* end)
+	{
+		if (options.statistics)
+		{
+			const metrics::ScopedStage stage(metrics::Stage::Statistics);
+			statistics.Count(begin, end);
+		}
+		const metrics::ScopedStage stage(metrics::Stage::Split);
+		result.units += end - begin;
+		worker.splitter.Push(begin, end, onLine);
+	};
+	auto push = [&](const wchar_t* begin, const wchar_t* end)
+	{
+		if (!normalizer.Enabled())
+			return split(begin, end);
+		const metrics::ScopedStage stage(metrics::Stage::Normalize);
+		normalizer.Push(begin, end, split);
+	};
+
+	// counted text starts behind the BOM, as in the single file mode
+	size_t skipped = 0;
+	for (bool retried = false;; retried = true)
+	{
+		skipped = options.statistics ? result.detected.bomLength : 0;
+		decoder.Feed(input.begin() + skipped, input.end(), push);
+		decoder.Finish(push);
+		normalizer.Finish(split);
+		statistics.Finish();
+		worker.splitter.Finish(onLine);
+
+		// same fallback as the single file mode
+		if (result.lines || retried || !decoder.Failed())
+			break;
+		result.detected = { options.ansi, 0, 0 };
+		result.units = 0;
+		decoder.Reset(options.ansi);
+		normalizer.Reset(options.form, options.fold);
+		statistics.Reset();
+	}
+	if (decoder.Failed())
+		result.error = "invalid";
+	result.errorCount = decoder.ErrorCount();
+	if (result.errorCount)
+	{
+		result.firstError = decoder.Errors().front();
+		result.firstError.offset += skipped;
+	}
+	metrics::Add(metrics::Counter::Files, 1);
+	metrics::Add(metrics::Counter::BytesIn, decoder.Consumed());
+	metrics::Add(metrics::Counter::UnitsOut, result.units);
+	metrics::Add(metrics::Counter::Lines, result.lines);
+	metrics::Add(metrics::Counter::Malformed, result.errorCount);
+	input.Close();
+	worker.splitter.Release();
+	worker.arena.Reset();
+	return result;
+}
+
+std::string BatchRunner::Format(const std::string& path, const FileResult& result, const TextStatistics<wchar_t>& statistics) const
+{
+	const char* encoding = !result.bytes ? "-" : EncodingName(result.detected.encoding);
+	if (options.statistics)
+	{
+		std::string line = "{\"path\": ";
+		TextStatistics<wchar_t>::AppendJsonString(line, path.c_str());
+		line += ", \"encoding\": \"" + std::string(encoding) + '"';
+		line += ", \"confidence\": " + std::to_string(result.detected.confidence);
+		line += ", \"bytes\": " + std::to_string(result.bytes);
+		line += ", \"status\": ";
+		TextStatistics<wchar_t>::AppendJsonString(line, Status(result).c_str());
+		line += ", ";
+		statistics.AppendJson(line);
+		line += "}\n";
+		return line;
+	}
+
+	std::string line = path;
+	line += '\t';
+	line += encoding;
+	line += '\t' + std::to_string(result.detected.confidence);
+	line += '\t' + std::to_string(result.bytes);
+	line += '\t' + std::to_string(result.lines);
+	line += '\t' + std::to_string(result.units);
+	line += '\t' + Status(result) + '\n';
+	return line;
+}
+
+std::string BatchRunner::Status(const FileResult& result) const
+{
+	const std::string where = std::to_string(result.firstError.offset) + " (" + DecodeErrorName(result.firstError.kind) + ")";
+	if (result.error)
+		return result.bytes ? result.error + (" at " + where) : result.error;
+	if (result.errorCount)
+		return std::to_string(result.errorCount) + (options.policy == ErrorPolicy::Skip ? " skipped" : " replaced") + ", first at " + where;
+	return "ok";
+}
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef _2134BE8D_C829_4EF9_908C_F50344167634_
+#define  _2134BE8D_C829_4EF9_908C_F50344167634_
+
+#include <assert.h>
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "CodePages.h"
+#include "Decoder.h"
+#include "Dispatch.h"
+#include "TextEncoding.h"
+#include "Transcode.h"
+
+// Conversion from the input encoding straight into the encoding the output is
+// wanted in, for consumers of the text itself rather than the dump. There is
+// no UTF-16 string in between:
+//  same encoding          - validated and copied as it is
+//  UTF-16, UTF-32 and     - direct kernels into UTF-8 (the UTF-32 ones are
+//  single byte to UTF-8     vector kernels of Dispatch.h)
+//  to UTF-16 / UTF-32     - the UTF-16 kernels of Decoder<From> into a block of
+//                           BlockUnits on the stack, stored in the byte order
+//                           of To while it is in L1
+//
+// Converter<From, To> is a codec for StreamingDecoder and ParallelDecoder
+// with char output units, the bytes of To; Encoding() is the input side, what
+// malformed sequences are classified by.
+const TextEncoding TargetEncodings[] = { TextEncoding::UTF8, TextEncoding::UTF16LE, TextEncoding::UTF16BE, TextEncoding::UTF32LE, TextEncoding::UTF32BE };
+
+// an EncodingName of TargetEncodings in any case, with or without the dash
+inline bool ParseTargetEncoding(const char* name, TextEncoding& encoding)
+{
+	auto same = [](const char* a, const char* b)
+	{
+		for (;; ++a, ++b)
+		{
+			if (*a == '-')
+				++a;
+			if (*b == '-')
+				++b;
+			if (std::tolower(static_cast<unsigned char>(*a)) != std::tolower(static_cast<unsigned char>(*b)))
+				return false;
+			if (!*a)
+				return true;
+		}
+	};
+	for (const TextEncoding candidate : TargetEncodings)
+	{
+		if (same(name, EncodingName(candidate)))
+		{
+			encoding = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace convert
+{
+
+const size_t BlockUnits = 512;
+
+inline bool IsBigEndian(TextEncoding encoding)
+{
+	return encoding == TextEncoding::UTF16BE || encoding == TextEncoding::UTF32BE;
+}
+
+// first byte that is not part of a well formed prefix of encoding, or end
+inline const char* Validate(TextEncoding encoding, const char* begin, const char* end)
+{
+	switch (encoding)
+	{
+	case TextEncoding::UTF8: return simd::ValidateUtf8(begin, end);
+	case TextEncoding::UTF16LE: return simd::ValidateUtf16LE(begin, end);
+	case TextEncoding::UTF16BE: return simd::ValidateUtf16BE(begin, end);
+	case TextEncoding::UTF32LE: return simd::scalar::ValidateUtf32<false>(begin, end);
+	case TextEncoding::UTF32BE: return simd::scalar::ValidateUtf32<true>(begin, end);
+	default: return end;
+	}
+}
+
+// [p, end) starts with a character that might still be completed by more input
+inline bool IsTruncated(TextEncoding encoding, const char* p, const char* end)
+{
+	const size_t size = end - p;
+	switch (encoding)
+	{
+	case TextEncoding::UTF8:
+		return simd::scalar::IsTruncatedUtf8(p, end);
+	case TextEncoding::UTF16LE:
+	case TextEncoding::UTF16BE:
+	{
+		if (size < 2)
+			return true;
+		const unsigned lead = static_cast<unsigned char>(p[IsBigEndian(encoding) ? 0 : 1]);
+		return size < 4 && (lead & 0xFC) == 0xD8;
+	}
+	case TextEncoding::UTF32LE:
+	case TextEncoding::UTF32BE:
+		return size < 4;
+	default:
+		return false;
+	}
+}
+
+// input and output in the same encoding: the valid part is copied. Only what
+// fits is validated, the rest waits for the next call.
+inline TranscodeResult Passthrough(TextEncoding encoding, const char* begin, const char* end, char* out, char* outEnd)
+{
+	const char* window = static_cast<size_t>(end - begin) > static_cast<size_t>(outEnd - out) ? begin + (outEnd - out) : end;
+	const char* valid = Validate(encoding, begin, window);
+	const size_t size = valid - begin;
+	std::memcpy(out, begin, size);
+
+	TranscodeStatus status = TranscodeStatus::Ok;
+	if (valid == window && window != end)
+		status = TranscodeStatus::OutputFull;
+	else if (valid != end)
+	{
+		// a character cut by the window is decided by the next call
+		if (IsTruncated(encoding, valid, window))
+			status = window == end ? TranscodeStatus::Incomplete : TranscodeStatus::OutputFull;
+		else
+			status = TranscodeStatus::Invalid;
+	}
+	return{ size, size, status };
+}
+
+// the bytes of a single byte code page as UTF-8: up to 3 bytes, the count in
+// the fourth
+template<TextEncoding From>
+inline const char (*Utf8Table())[4]
+{
+	static const struct Table
+	{
+		Table()
+		{
+			const char16_t* high = HighHalfTable(From);
+			for (unsigned c = 0; c < 256; ++c)
+			{
+				char* o = entries[c];
+				simd::scalar::EncodeUtf8(c < 0x80 ? c : high[c - 0x80], o, entries[c] + 3);
+				entries[c][3] = static_cast<char>(o - entries[c]);
+			}
+		}
+		char entries[256][4];
+	} table;
+	return table.entries;
+}
+
+// a single byte code page to UTF-8 through Utf8Table, without a branch per
+// byte: four bytes are stored while there is room for them, the count says
+// how many stay
+template<TextEncoding From>
+inline TranscodeResult SingleByteToUtf8(const char* begin, const char* end, char* out, char* outEnd)
+{
+	const char (*table)[4] = Utf8Table<From>();
+	const char* p = begin;
+	char* o = out;
+	while (p != end)
+	{
+		const char* stop = p + std::min<size_t>(end - p, (outEnd - o) / 4);
+		if (p == stop)
+		{
+			const char* entry = table[static_cast<unsigned char>(*p)];
+			if (outEnd - o < entry[3])
+				return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), TranscodeStatus::OutputFull };
+			std::memcpy(o, entry, entry[3]);
+			o += entry[3];
+			++p;
+			continue;
+		}
+		for (; p != stop; ++p)
+		{
+			const char* entry = table[static_cast<unsigned char>(*p)];
+			std::memcpy(o, entry, 4);
+			o += entry[3];
+		}
+	}
+	return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), TranscodeStatus::Ok };
+}
+
+// most bytes To takes for one UTF-16 unit
+inline size_t MaxBytesPerUnit(TextEncoding to)
+{
+	return to == TextEncoding::UTF8 ? 3 : to == TextEncoding::UTF32LE || to == TextEncoding::UTF32BE ? 4 : 2;
+}
+
+// UTF-16 units as the bytes of to; pairs are never split across calls
+inline char* Store(TextEncoding to, const char16_t* begin, const char16_t* end, char* out)
+{
+	const bool big = IsBigEndian(to);
+	for (const char16_t* u = begin; u != end; ++u)
+	{
+		uint32_t cp = *u;
+		if (to == TextEncoding::UTF16LE || to == TextEncoding::UTF16BE)
+		{
+			out[big ? 0 : 1] = static_cast<char>(cp >> 8);
+			out[big ? 1 : 0] = static_cast<char>(cp);
+			out += 2;
+			continue;
+		}
+		if ((cp & 0xFC00) == 0xD800)
+		{
+			assert(u + 1 != end);
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (*++u - 0xDC00);
+		}
+		if (to == TextEncoding::UTF8)
+		{
+			simd::scalar::EncodeUtf8(cp, out, out + 4);
+			continue;
+		}
+		for (int i = 0; i < 4; ++i)
+			out[big ? 3 - i : i] = static_cast<char>(cp >> (8 * i));
+		out += 4;
+	}
+	return out;
+}
+
+// the UTF-16 kernels of From into a block on the stack, then Store
+template<TextEncoding From>
+inline TranscodeResult ThroughBlock(TextEncoding to, const char* begin, const char* end, char* out, char* outEnd)
+{
+	char16_t units[BlockUnits];
+	TranscodeResult total = { 0, 0, TranscodeStatus::Ok };
+	for (;;)
+	{
+		const size_t room = static_cast<size_t>(outEnd - out) - total.produced;
+		const size_t count = std::min(room / MaxBytesPerUnit(to), BlockUnits);
+		if (!count)
+		{
+			total.status = begin + total.consumed == end ? TranscodeStatus::Ok : TranscodeStatus::OutputFull;
+			return total;
+		}
+		const TranscodeResult step = Decoder<From>::Decode(begin + total.consumed, end, units, units + count);
+		total.consumed += step.consumed;
+		total.produced = Store(to, units, units + step.produced, out + total.produced) - out;
+		total.status = step.status;
+		if (step.status != TranscodeStatus::OutputFull || count < BlockUnits)
+			return total;
+	}
+}
+
+} // namespace convert
+
+template<TextEncoding From, TextEncoding To>
+struct Converter
+{
+	Converter() = default;
+
+	static TextEncoding Encoding() { return From; }
+	static TextEncoding Target() { return To; }
+
+	static inline TranscodeResult Decode(const char* begin, const char* end, char* out, char* outEnd);
+
+	// U+FFFD in To, for ErrorPolicy::Replace
+	static size_t Replacement(char* units)
+	{
+		char16_t replacement = 0xFFFD;
+		return convert::Store(To, &replacement, &replacement + 1, units) - units;
+	}
+};
+
+
+template<TextEncoding From, TextEncoding To>
+TranscodeResult Converter<From, To>::Decode(const char* begin, const char* end, char* out, char* outEnd)
+{
+	assert(begin <= end && out <= outEnd);
+	if (From == To)
+		return convert::Passthrough(From, begin, end, out, outEnd);
+	if (To == TextEncoding::UTF8)
+	{
+		switch (From)
+		{
+		case TextEncoding::UTF16LE: return Utf16LEToUtf8(begin, end, out, outEnd);
+		case TextEncoding::UTF16BE: return Utf16BEToUtf8(begin, end, out, outEnd);
+		case TextEncoding::UTF32LE: return Utf32LEToUtf8(begin, end, out, outEnd);
+		case TextEncoding::UTF32BE: return Utf32BEToUtf8(begin, end, out, outEnd);
+		case TextEncoding::Ansi:
+		case TextEncoding::Windows1250:
+		case TextEncoding::Windows1251:
+		case TextEncoding::Windows1252: return convert::SingleByteToUtf8<From>(begin, end, out, outEnd);
+		default: break;
+		}
+	}
+	return convert::ThroughBlock<From>(To, begin, end, out, outEnd);
+}
+
+// calls f(Converter<From, To>()) for the pair found at run time, as WithDecoder;
+// a target that is not one of TargetEncodings is UTF-8
+template<TextEncoding From, typename F>
+inline auto WithConverterTo(TextEncoding to, F&& f) -> decltype(f(Converter<From, TextEncoding::UTF8>()))
+{
+	switch (to)
+	{
+	case TextEncoding::UTF16LE:
+		return f(Converter<From, TextEncoding::UTF16LE>());
+	case TextEncoding::UTF16BE:
+		return f(Converter<From, TextEncoding::UTF16BE>());
+	case TextEncoding::UTF32LE:
+		return f(Converter<From, TextEncoding::UTF32LE>());
+	case TextEncoding::UTF32BE:
+		return f(Converter<From, TextEncoding::UTF32BE>());
+	default:
+		return f(Converter<From, TextEncoding::UTF8>());
+	}
+}
+
+template<typename F>
+inline auto WithConverter(TextEncoding from, TextEncoding to, F&& f) -> decltype(f(Converter<TextEncoding::Ansi, TextEncoding::UTF8>()))
+{
+	switch (from)
+	{
+	case TextEncoding::UTF8:
+		return WithConverterTo<TextEncoding::UTF8>(to, f);
+	case TextEncoding::UTF16LE:
+		return WithConverterTo<TextEncoding::UTF16LE>(to, f);
+	case TextEncoding::UTF16BE:
+		return WithConverterTo<TextEncoding::UTF16BE>(to, f);
+	case TextEncoding::UTF32LE:
+		return WithConverterTo<TextEncoding::UTF32LE>(to, f);
+	case TextEncoding::UTF32BE:
+		return WithConverterTo<TextEncoding::UTF32BE>(to, f);
+	case TextEncoding::Windows1250:
+		return WithConverterTo<TextEncoding::Windows1250>(to, f);
+	case TextEncoding::Windows1251:
+		return WithConverterTo<TextEncoding::Windows1251>(to, f);
+	case TextEncoding::Windows1252:
+		return WithConverterTo<TextEncoding::Windows1252>(to, f);
+	default:
+		return WithConverterTo<TextEncoding::Ansi>(to, f);
+	}
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef _D1CC590D_2C85_4BD1_AFAE_FBD6803F8C32_
+#define  _D1CC590D_2C85_4BD1_AFAE_FBD6803F8C32_
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_FEATURES_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Instruction set levels of the kernels in SimdKernels.h, Transcode.h and
+// HexKernels.h, and what the running CPU supports of them.
+enum class SimdLevel
+{
+	Scalar,
+	Sse42,  // SSE4.2 with SSSE3 and POPCNT
+	Avx2,
+	Avx512, // AVX-512F and BW
+	Neon
+};
+
+inline const char* SimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::Sse42: return "sse42";
+	case SimdLevel::Avx2: return "avx2";
+	case SimdLevel::Avx512: return "avx512";
+	case SimdLevel::Neon: return "neon";
+	default: return "scalar";
+	}
+}
+
+// the names of SimdLevelName; false for anything else
+inline bool ParseSimdLevel(const char* name, SimdLevel& level)
+{
+	const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::Sse42, SimdLevel::Avx2, SimdLevel::Avx512, SimdLevel::Neon };
+	for (const SimdLevel candidate : levels)
+	{
+		if (std::strcmp(name, SimdLevelName(candidate)) == 0)
+		{
+			level = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+#if CPU_FEATURES_X86
+
+namespace cpu_features
+{
+
+inline void CpuId(uint32_t leaf, uint32_t (&regs)[4])
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int r[4];
+	__cpuidex(r, static_cast<int>(leaf), 0);
+	for (int i = 0; i < 4; ++i)
+		regs[i] = static_cast<uint32_t>(r[i]);
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// register state the OS saves on a context switch
+inline uint64_t EnabledXState()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	return _xgetbv(0);
+#else
+	uint32_t low, high;
+	__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+}
+
+} // namespace cpu_features
+
+// best level of this CPU and OS; the vector registers are only usable when
+// the OS has enabled their state in XCR0
+inline SimdLevel DetectSimdLevel()
+{
+	uint32_t regs[4];
+	cpu_features::CpuId(0, regs);
+	const uint32_t maxLeaf = regs[0];
+	cpu_features::CpuId(1, regs);
+	const uint32_t ecx1 = regs[2];
+
+	const bool ssse3 = (ecx1 >> 9) & 1;
+	const bool sse41 = (ecx1 >> 19) & 1;
+	const bool sse42 = (ecx1 >> 20) & 1;
+	const bool popcnt = (ecx1 >> 23) & 1;
+	const bool osxsave = (ecx1 >> 27) & 1;
+	const bool avx = (ecx1 >> 28) & 1;
+	if (!(ssse3 && sse41 && sse42 && popcnt))
+		return SimdLevel::Scalar;
+	if (!osxsave || !avx || maxLeaf < 7)
+		return SimdLevel::Sse42;
+
+	const uint64_t xstate = cpu_features::EnabledXState();
+	cpu_features::CpuId(7, regs);
+	const uint32_t ebx7 = regs[1];
+	const bool avx2 = (ebx7 >> 5) & 1;
+	const bool bmi = ((ebx7 >> 3) & 1) && ((ebx7 >> 8) & 1);
+	const bool avx512 = ((ebx7 >> 16) & 1) && ((ebx7 >> 30) & 1);
+	if (!avx2 || !bmi || (xstate & 0x06) != 0x06) // XMM, YMM
+		return SimdLevel::Sse42;
+	if (!avx512 || (xstate & 0xE6) != 0xE6)        // and opmask, ZMM
+		return SimdLevel::Avx2;
+	return SimdLevel::Avx512;
+}
+
+#elif defined(__aarch64__) || defined(_M_ARM64)
+
+// Advanced SIMD is part of every ARMv8-A core
+inline SimdLevel DetectSimdLevel() { return SimdLevel::Neon; }
+
+#else
+
+inline SimdLevel DetectSimdLevel() { return SimdLevel::Scalar; }
+
+#endif
+
+// the levels below the detected one on the same architecture work too
+inline bool IsSupported(SimdLevel level)
+{
+	const SimdLevel best = DetectSimdLevel();
+	if (level == SimdLevel::Scalar)
+		return true;
+	if (level == SimdLevel::Neon || best == SimdLevel::Neon)
+		return level == best;
+	return static_cast<int>(level) <= static_cast<int>(best);
+}
+
+#endif
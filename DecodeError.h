@@ -0,0 +1,160 @@
+#ifndef _AB49B08E_5CD2_49A2_96DE_F8B7300036E5_
+#define  _AB49B08E_5CD2_49A2_96DE_F8B7300036E5_
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "TextEncoding.h"
+
+// What a decoder does at a malformed sequence:
+//  Stop    - the text ends in front of it (what the decoders always did)
+//  Replace - one U+FFFD per maximal subpart, as the Unicode standard
+//            recommends, and decoding goes on
+//  Skip    - the bytes are dropped and decoding goes on
+enum class ErrorPolicy
+{
+	Stop,
+	Replace,
+	Skip
+};
+
+inline const char* ErrorPolicyName(ErrorPolicy policy)
+{
+	switch (policy)
+	{
+	case ErrorPolicy::Replace: return "replace";
+	case ErrorPolicy::Skip: return "skip";
+	default: return "stop";
+	}
+}
+
+// the names of ErrorPolicyName; false for anything else
+inline bool ParseErrorPolicy(const char* name, ErrorPolicy& policy)
+{
+	const ErrorPolicy policies[] = { ErrorPolicy::Stop, ErrorPolicy::Replace, ErrorPolicy::Skip };
+	for (const ErrorPolicy candidate : policies)
+	{
+		if (std::strcmp(name, ErrorPolicyName(candidate)) == 0)
+		{
+			policy = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+enum class DecodeErrorKind
+{
+	InvalidByte,            // UTF-8 lead byte F5..FF, never part of a character
+	UnexpectedContinuation, // UTF-8 continuation byte without a lead in front
+	MissingContinuation,    // UTF-8 sequence cut short by a byte that does not continue it
+	Overlong,               // UTF-8 form longer than the code point needs
+	Surrogate,              // D800..DFFF encoded as UTF-8 or UTF-32
+	OutOfRange,             // above U+10FFFF
+	UnpairedSurrogate,      // UTF-16 high surrogate without a low one, or a low one alone
+	Truncated               // the input ends inside a character
+};
+
+inline const char* DecodeErrorName(DecodeErrorKind kind)
+{
+	switch (kind)
+	{
+	case DecodeErrorKind::InvalidByte: return "invalid byte";
+	case DecodeErrorKind::UnexpectedContinuation: return "unexpected continuation byte";
+	case DecodeErrorKind::MissingContinuation: return "missing continuation byte";
+	case DecodeErrorKind::Overlong: return "overlong form";
+	case DecodeErrorKind::Surrogate: return "surrogate code point";
+	case DecodeErrorKind::OutOfRange: return "code point above U+10FFFF";
+	case DecodeErrorKind::UnpairedSurrogate: return "unpaired surrogate";
+	default: return "truncated character";
+	}
+}
+
+// offset - of the first bad byte from the start of the input
+struct DecodeError
+{
+	uint64_t offset;
+	DecodeErrorKind kind;
+};
+
+// the malformed sequence at the start of some input: what is wrong with it and
+// how many bytes one replacement character stands for
+struct MalformedSequence
+{
+	DecodeErrorKind kind;
+	size_t length;
+};
+
+// [begin, end) starts with a sequence the decoder of encoding did not accept
+inline MalformedSequence ClassifyMalformed(TextEncoding encoding, const char* begin, const char* end)
+{
+	assert(begin < end);
+	const auto s = reinterpret_cast<const unsigned char*>(begin);
+	const size_t size = end - begin;
+	auto continues = [](unsigned char c) { return (c & 0xC0) == 0x80; };
+
+	switch (encoding)
+	{
+	case TextEncoding::UTF8:
+	{
+		const unsigned char lead = s[0];
+		if (continues(lead))
+			return { DecodeErrorKind::UnexpectedContinuation, 1 };
+		if (lead == 0xC0 || lead == 0xC1)
+			return { DecodeErrorKind::Overlong, 1 };
+		if (lead < 0x80 || lead > 0xF4)
+			return { DecodeErrorKind::InvalidByte, 1 };
+		if (size < 2)
+			return { DecodeErrorKind::Truncated, 1 };
+
+		// a second byte that continues, but not this lead, tells what the
+		// sequence would have been
+		const unsigned char second = s[1];
+		if (lead == 0xE0 && continues(second) && second < 0xA0)
+			return { DecodeErrorKind::Overlong, 1 };
+		if (lead == 0xED && continues(second) && second > 0x9F)
+			return { DecodeErrorKind::Surrogate, 1 };
+		if (lead == 0xF0 && continues(second) && second < 0x90)
+			return { DecodeErrorKind::Overlong, 1 };
+		if (lead == 0xF4 && continues(second) && second > 0x8F)
+			return { DecodeErrorKind::OutOfRange, 1 };
+
+		// the maximal subpart: the lead and the bytes that continue it
+		const size_t length = lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+		for (size_t i = 1; i < length; ++i)
+		{
+			if (i == size)
+				return { DecodeErrorKind::Truncated, i };
+			if (!continues(s[i]))
+				return { DecodeErrorKind::MissingContinuation, i };
+		}
+		return { DecodeErrorKind::InvalidByte, 1 };
+	}
+	case TextEncoding::UTF16LE:
+	case TextEncoding::UTF16BE:
+	{
+		if (size < 2)
+			return { DecodeErrorKind::Truncated, size };
+		const bool le = encoding == TextEncoding::UTF16LE;
+		const unsigned unit = le ? s[0] | (s[1] << 8) : (s[0] << 8) | s[1];
+		if ((unit & 0xFC00) == 0xD800 && size < 4)
+			return { DecodeErrorKind::Truncated, size };
+		return { DecodeErrorKind::UnpairedSurrogate, 2 };
+	}
+	case TextEncoding::UTF32LE:
+	case TextEncoding::UTF32BE:
+	{
+		if (size < 4)
+			return { DecodeErrorKind::Truncated, size };
+		const uint32_t cp = encoding == TextEncoding::UTF32LE
+			? (uint32_t(s[3]) << 24) | (s[2] << 16) | (s[1] << 8) | s[0]
+			: (uint32_t(s[0]) << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
+		return { cp > 0x10FFFF ? DecodeErrorKind::OutOfRange : DecodeErrorKind::Surrogate, 4 };
+	}
+	default:
+		return { DecodeErrorKind::InvalidByte, 1 };
+	}
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef _4F6A1D83_2C5E_4B97_A3E0_8B7D92C16E5F_
+#define  _4F6A1D83_2C5E_4B97_A3E0_8B7D92C16E5F_
+
+#include <assert.h>
+#include "CodePages.h"
+#include "TextEncoding.h"
+#include "Dispatch.h"
+
+// Decoders for StreamingDecoder and ParallelDecoder. Decoder<E> binds the
+// kernel of one encoding at compile time: code templated on it is compiled once
+// per encoding with the kernel call inlined, the byte order of UTF-16 / UTF-32
+// is part of E; only the instruction set is still picked at run time, through
+// Dispatch.h. DynamicDecoder picks the kernel at run time for code that has
+// to switch encodings on the same object.
+//
+// Both have Decode(begin, end, out, outEnd) with the Transcode.h contract,
+// Encoding() and Replacement(units), the units of U+FFFD for
+// ErrorPolicy::Replace (Converter.h has codecs with other output).
+template<TextEncoding E>
+struct Decoder
+{
+	Decoder() = default;
+	explicit Decoder(TextEncoding encoding) { assert(encoding == E); (void)encoding; }
+
+	static TextEncoding Encoding() { return E; }
+
+	template<typename CharT>
+	static size_t Replacement(CharT* units)
+	{
+		units[0] = 0xFFFD;
+		return 1;
+	}
+
+	// the single byte code pages, the Unicode forms are specialized below
+	template<typename CharT>
+	static TranscodeResult Decode(const char* begin, const char* end, CharT* out, CharT* outEnd)
+	{
+		return SingleByteToUtf16(HighHalfTable(E), begin, end, out, outEnd);
+	}
+};
+
+template<> template<typename CharT>
+inline TranscodeResult Decoder<TextEncoding::UTF8>::Decode(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	return Utf8ToUtf16(begin, end, out, outEnd);
+}
+
+template<> template<typename CharT>
+inline TranscodeResult Decoder<TextEncoding::UTF16LE>::Decode(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	return Utf16LEToUtf16(begin, end, out, outEnd);
+}
+
+template<> template<typename CharT>
+inline TranscodeResult Decoder<TextEncoding::UTF16BE>::Decode(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	return Utf16BEToUtf16(begin, end, out, outEnd);
+}
+
+template<> template<typename CharT>
+inline TranscodeResult Decoder<TextEncoding::UTF32LE>::Decode(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	return Utf32LEToUtf16(begin, end, out, outEnd);
+}
+
+template<> template<typename CharT>
+inline TranscodeResult Decoder<TextEncoding::UTF32BE>::Decode(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	return Utf32BEToUtf16(begin, end, out, outEnd);
+}
+
+// calls f(Decoder<E>()) for the encoding found at run time and returns its
+// result; the one switch over the encoding for a whole file
+template<typename F>
+inline auto WithDecoder(TextEncoding encoding, F&& f) -> decltype(f(Decoder<TextEncoding::Ansi>()))
+{
+	switch (encoding)
+	{
+	case TextEncoding::UTF8:
+		return f(Decoder<TextEncoding::UTF8>());
+	case TextEncoding::UTF16LE:
+		return f(Decoder<TextEncoding::UTF16LE>());
+	case TextEncoding::UTF16BE:
+		return f(Decoder<TextEncoding::UTF16BE>());
+	case TextEncoding::UTF32LE:
+		return f(Decoder<TextEncoding::UTF32LE>());
+	case TextEncoding::UTF32BE:
+		return f(Decoder<TextEncoding::UTF32BE>());
+	case TextEncoding::Windows1250:
+		return f(Decoder<TextEncoding::Windows1250>());
+	case TextEncoding::Windows1251:
+		return f(Decoder<TextEncoding::Windows1251>());
+	case TextEncoding::Windows1252:
+		return f(Decoder<TextEncoding::Windows1252>());
+	default:
+		return f(Decoder<TextEncoding::Ansi>());
+	}
+}
+
+template<typename CharT>
+class DynamicDecoder
+{
+public:
+	typedef TranscodeResult (*Kernel)(const char* begin, const char* end, CharT* out, CharT* outEnd);
+
+	// implicit: a TextEncoding is all it takes
+	DynamicDecoder(TextEncoding encoding)
+		: encoding(encoding), kernel(WithDecoder(encoding, [](auto decoder) -> Kernel { return &decltype(decoder)::template Decode<CharT>; }))
+	{
+	}
+
+	TextEncoding Encoding() const { return encoding; }
+
+	static size_t Replacement(CharT* units)
+	{
+		units[0] = 0xFFFD;
+		return 1;
+	}
+
+	TranscodeResult Decode(const char* begin, const char* end, CharT* out, CharT* outEnd) const
+	{
+		return kernel(begin, end, out, outEnd);
+	}
+
+private:
+	TextEncoding encoding;
+	Kernel kernel;
+};
+
+#endif
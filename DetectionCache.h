@@ -0,0 +1,390 @@
+#ifndef _33B939F0_D57E_440B_95AD_320B2ECE7E1D_
+#define  _33B939F0_D57E_440B_95AD_320B2ECE7E1D_
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "DetectorBackend.h"
+#include "MappedFile.h"
+#include "Pipeline.h"
+#include "TextEncoding.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Persistent memo of DetectEncoding for inputs that are scanned again and
+// again (a shared directory walked every few minutes). The file is a
+// memory-mapped hash table of fixed size; an entry is found by the path and
+// only used while the size, the modification time and a fingerprint of the
+// first SniffSize bytes are what they were when the file was detected.
+//
+// A hit costs a look at the first page of the input, which the decoder reads
+// anyway, instead of the detector. The table is shared by the threads of a
+// process under a mutex; processes writing the same cache at once do not wait
+// for each other, the slot checksum turns a torn entry into a miss. When the
+// Probes slots from its home are taken, a new entry replaces the one at home;
+// a table that had to do that, or is more than half full, is doubled by the
+// next Open.
+//
+// Entries belong to the detector backend in the header: a cache written with
+// another one starts out empty.
+class DetectionCache
+{
+public:
+	static const uint32_t DefaultSlots = 1 << 16; // 3 MB to start with
+	static const uint32_t Probes = 8;
+
+	// what an entry is looked up by
+	struct Key
+	{
+		uint64_t path;
+		uint64_t size;
+		int64_t modified;
+		uint64_t prefix;
+	};
+
+	DetectionCache() = default;
+	DetectionCache(const DetectionCache&) = delete;
+	DetectionCache& operator=(const DetectionCache&) = delete;
+	~DetectionCache() { Close(); }
+
+	// creates the file if needed; an existing cache keeps its entries. A file
+	// that is neither empty nor starts with the magic is left alone, Open
+	// fails and Foreign tells why
+	inline bool Open(const char* fileName, uint32_t slots = DefaultSlots);
+	static inline bool Foreign(const char* fileName);
+	inline void Close();
+	bool IsOpen() const { return header != nullptr; }
+
+	static inline uint64_t Fingerprint(const char* begin, const char* end);
+	static inline Key KeyOf(const std::string& path, const MappedFile& file);
+
+	inline bool Find(const Key& key, DetectionResult& detected);
+	inline void Store(const Key& key, const DetectionResult& detected);
+
+	// DetectEncoding through the cache
+	inline DetectionResult Detect(const std::string& path, const MappedFile& file);
+
+	uint64_t Hits() const { return hits.load(std::memory_order_relaxed); }
+	uint64_t Misses() const { return misses.load(std::memory_order_relaxed); }
+
+private:
+	static const uint32_t Version = 2; // 2: windows-125x
+	static const char* Magic() { return "UTDCACHE"; } // the 8 bytes in front
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t slots;   // a power of two
+		uint64_t backend;
+		uint32_t entries; // slots in use, as far as this process knows
+		uint32_t evicted; // entries replaced by another path
+		char reserved[32];
+	};
+
+	// check == 0: empty
+	struct Slot
+	{
+		Key key;
+		int32_t encoding;
+		int32_t confidence;
+		uint32_t bomLength;
+		uint32_t check;
+	};
+
+	static inline uint32_t Checksum(const Slot& slot);
+	static size_t FileSize(uint32_t slots) { return sizeof(Header) + sizeof(Slot) * static_cast<size_t>(slots); }
+	inline bool Map(size_t bytes);
+	inline void Unmap();
+	inline void Clear(uint32_t slots, uint64_t backend);
+	inline bool Grow();
+	inline void Insert(const Slot& entry);
+
+	Header* header = nullptr;
+	Slot* table = nullptr;
+	size_t mappedSize = 0;
+	std::mutex lock;
+	std::atomic<uint64_t> hits{ 0 };
+	std::atomic<uint64_t> misses{ 0 };
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+
+bool DetectionCache::Open(const char* fileName, uint32_t slots)
+{
+	assert(fileName);
+	assert(slots && !(slots & (slots - 1)));
+	Close();
+
+	// an existing file tells its own size
+	Header existing = {};
+#ifdef _WIN32
+	file = ::CreateFileA(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD count = 0;
+	if (!::ReadFile(file, &existing, sizeof(existing), &count, nullptr))
+	{
+		Close();
+		return false;
+	}
+#else
+	fd = ::open(fileName, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+	const ssize_t count = ::pread(fd, &existing, sizeof(existing), 0);
+	if (count < 0)
+	{
+		Close();
+		return false;
+	}
+#endif
+	// only a new file or a cache is ever written, not what --cache= named
+	// by mistake
+	const size_t read = static_cast<size_t>(count);
+	if (read && (read < sizeof(existing.magic) || std::memcmp(existing.magic, Magic(), sizeof(existing.magic))))
+	{
+		Close();
+		return false;
+	}
+	const bool found = read == sizeof(existing);
+	const uint64_t backend = Fingerprint(SelectedDetectorBackend(), SelectedDetectorBackend() + std::strlen(SelectedDetectorBackend()));
+	const bool reuse = found && !std::memcmp(existing.magic, Magic(), sizeof(existing.magic)) && existing.version == Version
+		&& existing.backend == backend && existing.slots && !(existing.slots & (existing.slots - 1));
+	if (!Map(FileSize(reuse ? existing.slots : slots)))
+	{
+		Close();
+		return false;
+	}
+	// new, of an older layout or of another backend: start over
+	if (!reuse)
+		Clear(slots, backend);
+	else if ((header->evicted || header->entries > header->slots / 2) && !Grow())
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+// an existing file with content that does not start with the magic
+bool DetectionCache::Foreign(const char* fileName)
+{
+	std::ifstream in(fileName, std::ios::binary);
+	char magic[8] = {};
+	if (!in.read(magic, sizeof(magic)) && !in.gcount())
+		return false;
+	return in.gcount() != sizeof(magic) || std::memcmp(magic, Magic(), sizeof(magic)) != 0;
+}
+
+void DetectionCache::Clear(uint32_t slots, uint64_t backend)
+{
+	std::memset(static_cast<void*>(header), 0, FileSize(slots));
+	std::memcpy(header->magic, Magic(), sizeof(header->magic));
+	header->version = Version;
+	header->slots = slots;
+	header->backend = backend;
+}
+
+// twice the slots, with the entries that are still intact
+bool DetectionCache::Grow()
+{
+	std::vector<Slot> live;
+	for (uint32_t i = 0; i < header->slots; ++i)
+	{
+		if (table[i].check && table[i].check == Checksum(table[i]))
+			live.push_back(table[i]);
+	}
+	const uint32_t slots = header->slots * 2;
+	const uint64_t backend = header->backend;
+	Unmap();
+	if (!Map(FileSize(slots)))
+		return false;
+	Clear(slots, backend);
+	for (const Slot& entry : live)
+		Insert(entry);
+	return true;
+}
+
+bool DetectionCache::Map(size_t bytes)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	size.QuadPart = static_cast<LONGLONG>(bytes);
+	if (!::SetFilePointerEx(file, size, nullptr, FILE_BEGIN) || !::SetEndOfFile(file))
+		return false;
+	mapping = ::CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+	void* view = mapping ? ::MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes) : nullptr;
+	if (!view)
+		return false;
+#else
+	struct stat info;
+	if (::fstat(fd, &info) != 0)
+		return false;
+	if (static_cast<size_t>(info.st_size) != bytes && ::ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+		return false;
+	void* view = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (view == MAP_FAILED)
+		return false;
+#endif
+	header = static_cast<Header*>(view);
+	table = reinterpret_cast<Slot*>(static_cast<char*>(view) + sizeof(Header));
+	mappedSize = bytes;
+	return true;
+}
+
+void DetectionCache::Unmap()
+{
+#ifdef _WIN32
+	if (header)
+		::UnmapViewOfFile(header);
+	if (mapping)
+		::CloseHandle(mapping);
+	mapping = nullptr;
+#else
+	if (header)
+		::munmap(header, mappedSize);
+#endif
+	header = nullptr;
+	table = nullptr;
+	mappedSize = 0;
+}
+
+void DetectionCache::Close()
+{
+	Unmap();
+#ifdef _WIN32
+	if (file != INVALID_HANDLE_VALUE)
+		::CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+}
+
+// 64 bit FNV-1a over words of 8 bytes, with a shift to fold the high bits in
+// and the final mix of MurmurHash3
+uint64_t DetectionCache::Fingerprint(const char* begin, const char* end)
+{
+	const uint64_t Prime = 0x100000001B3ull;
+	uint64_t hash = 0xCBF29CE484222325ull ^ static_cast<uint64_t>(end - begin);
+	for (; end - begin >= 8; begin += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, begin, 8);
+		hash = (hash ^ word) * Prime;
+		hash ^= hash >> 29;
+	}
+	for (; begin != end; ++begin)
+		hash = (hash ^ static_cast<unsigned char>(*begin)) * Prime;
+	// the table is indexed by the low bits, which FNV mixes the least
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+DetectionCache::Key DetectionCache::KeyOf(const std::string& path, const MappedFile& file)
+{
+	const char* prefixEnd = file.begin() + std::min(SniffSize, file.Size());
+	return{ Fingerprint(path.data(), path.data() + path.size()), file.Size(), file.ModifiedTime(), Fingerprint(file.begin(), prefixEnd) };
+}
+
+uint32_t DetectionCache::Checksum(const Slot& slot)
+{
+	const uint32_t check = static_cast<uint32_t>(Fingerprint(reinterpret_cast<const char*>(&slot), reinterpret_cast<const char*>(&slot.check)));
+	return check ? check : 1;
+}
+
+bool DetectionCache::Find(const Key& key, DetectionResult& detected)
+{
+	assert(IsOpen());
+	const uint32_t mask = header->slots - 1;
+	std::lock_guard<std::mutex> guard(lock);
+	for (uint32_t i = 0; i < Probes; ++i)
+	{
+		const Slot& slot = table[(key.path + i) & mask];
+		if (!slot.check)
+			break;
+		if (slot.key.path != key.path)
+			continue;
+		// the path, but another version of the file: a miss, Store replaces it
+		if (slot.check != Checksum(slot) || slot.key.size != key.size || slot.key.modified != key.modified || slot.key.prefix != key.prefix)
+			break;
+		detected = { static_cast<TextEncoding>(slot.encoding), slot.confidence, slot.bomLength };
+		hits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+	misses.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void DetectionCache::Store(const Key& key, const DetectionResult& detected)
+{
+	assert(IsOpen());
+	Slot entry = {};
+	entry.key = key;
+	entry.encoding = static_cast<int32_t>(detected.encoding);
+	entry.confidence = detected.confidence;
+	entry.bomLength = static_cast<uint32_t>(detected.bomLength);
+	entry.check = Checksum(entry);
+
+	std::lock_guard<std::mutex> guard(lock);
+	Insert(entry);
+}
+
+// the slot of the path, else the first free one, else the home slot
+void DetectionCache::Insert(const Slot& entry)
+{
+	const uint32_t mask = header->slots - 1;
+	Slot* target = &table[entry.key.path & mask];
+	for (uint32_t i = 0; i < Probes; ++i)
+	{
+		Slot& slot = table[(entry.key.path + i) & mask];
+		if (!slot.check || slot.key.path == entry.key.path)
+		{
+			target = &slot;
+			break;
+		}
+	}
+	if (!target->check)
+		++header->entries;
+	else if (target->key.path != entry.key.path)
+		++header->evicted;
+	*target = entry;
+}
+
+DetectionResult DetectionCache::Detect(const std::string& path, const MappedFile& file)
+{
+	const Key key = KeyOf(path, file);
+	DetectionResult detected;
+	if (Find(key, detected))
+		return detected;
+	detected = DetectEncoding(file.begin(), file.end());
+	Store(key, detected);
+	return detected;
+}
+
+#endif
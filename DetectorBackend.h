@@ -0,0 +1,263 @@
+#ifndef _758363F4_A82B_4E07_94C9_B1D1A5B21E7A_
+#define  _758363F4_A82B_4E07_94C9_B1D1A5B21E7A_
+
+#include <assert.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include "EncodingCandidate.h"
+#include "TextEncoding.h"
+
+#ifdef _WIN32
+#include "DetectorContext.h"
+#endif
+#if DETECTOR_ICU
+#include <cstdint>
+#include <unicode/ucsdet.h>
+#endif
+
+// Second opinion on the input FastEncodeDetector is not sure about. Which one
+// is used is a choice of the build and the command line:
+//  native - none, the guess of FastEncodeDetector stands (the default off Windows)
+//  mlang  - IMultiLanguage2::DetectInputCodepage, Windows only (the default there)
+//  icu    - ICU charset detection, when built with DETECTOR_ICU
+//
+// Every thread gets its own instance of the selected backend on first use, so
+// the backends need no locking and may keep state (a COM apartment, an ICU
+// detector) from one file to the next.
+class DetectorBackend
+{
+public:
+	// most candidates a backend reports, what MLang is asked for
+	static const size_t MaxCandidates = 10;
+
+	virtual ~DetectorBackend() {}
+
+	virtual const char* Name() const = 0;
+
+	// updates detected where the backend knows better, leaves it alone otherwise
+	virtual void Refine(const char* begin, const char* end, DetectionResult& detected) = 0;
+
+	// every reading the backend considers, best first and one per encoding,
+	// at most capacity of them; 0 when it has no opinion
+	virtual size_t Candidates(const char*, const char*, EncodingCandidate*, size_t) { return 0; }
+};
+
+class NativeBackend : public DetectorBackend
+{
+public:
+	const char* Name() const override { return "native"; }
+	void Refine(const char*, const char*, DetectionResult&) override {}
+};
+
+#ifdef _WIN32
+// one COM apartment and IMultiLanguage2 per thread, see DetectorContext
+class MLangBackend : public DetectorBackend
+{
+public:
+	const char* Name() const override { return "mlang"; }
+
+	void Refine(const char* begin, const char* end, DetectionResult& detected) override
+	{
+		DetectorContext& context = DetectorContext::ForCurrentThread();
+		if (context.IsAvailable())
+			detected.encoding = context.Detect(begin, end);
+	}
+
+	size_t Candidates(const char* begin, const char* end, EncodingCandidate* candidates, size_t capacity) override
+	{
+		DetectorContext& context = DetectorContext::ForCurrentThread();
+		return context.IsAvailable() ? context.Detector().Candidates(begin, end, candidates, capacity) : 0;
+	}
+};
+#endif
+
+#if DETECTOR_ICU
+// ICU reports charset names; what is neither a Unicode form nor a code page of
+// CodePages.h is decoded as ANSI, as with MLang
+class IcuBackend : public DetectorBackend
+{
+public:
+	IcuBackend()
+	{
+		UErrorCode status = U_ZERO_ERROR;
+		detector = ucsdet_open(&status);
+		if (U_FAILURE(status))
+			detector = nullptr;
+	}
+	IcuBackend(const IcuBackend&) = delete;
+	IcuBackend& operator=(const IcuBackend&) = delete;
+	~IcuBackend() { if (detector) ucsdet_close(detector); }
+
+	const char* Name() const override { return "icu"; }
+
+	inline void Refine(const char* begin, const char* end, DetectionResult& detected) override;
+	inline size_t Candidates(const char* begin, const char* end, EncodingCandidate* candidates, size_t capacity) override;
+
+private:
+	static inline TextEncoding EncodingOf(const char* charset);
+
+	UCharsetDetector* detector;
+};
+
+
+void IcuBackend::Refine(const char* begin, const char* end, DetectionResult& detected)
+{
+	assert(begin <= end);
+	if (!detector)
+		return;
+	UErrorCode status = U_ZERO_ERROR;
+	ucsdet_setText(detector, begin, static_cast<int32_t>(end - begin), &status);
+	const UCharsetMatch* match = ucsdet_detect(detector, &status);
+	if (U_FAILURE(status) || !match)
+		return;
+	const char* charset = ucsdet_getName(match, &status);
+	const int32_t confidence = ucsdet_getConfidence(match, &status);
+	if (U_FAILURE(status))
+		return;
+	detected.encoding = EncodingOf(charset);
+	detected.confidence = confidence;
+}
+
+// the matches of ucsdet_detectAll; the charsets ICU has but this tree does
+// not decode all come out as ANSI, with the confidence of the best of them
+size_t IcuBackend::Candidates(const char* begin, const char* end, EncodingCandidate* candidates, size_t capacity)
+{
+	assert(begin <= end);
+	if (!detector)
+		return 0;
+	UErrorCode status = U_ZERO_ERROR;
+	ucsdet_setText(detector, begin, static_cast<int32_t>(end - begin), &status);
+	int32_t found = 0;
+	const UCharsetMatch** matches = ucsdet_detectAll(detector, &found, &status);
+	if (U_FAILURE(status) || !matches)
+		return 0;
+	size_t count = 0;
+	for (int32_t i = 0; i < found; ++i)
+	{
+		UErrorCode matchStatus = U_ZERO_ERROR;
+		const char* charset = ucsdet_getName(matches[i], &matchStatus);
+		const int32_t confidence = ucsdet_getConfidence(matches[i], &matchStatus);
+		if (U_SUCCESS(matchStatus))
+			MergeCandidate(candidates, count, capacity, { EncodingOf(charset), confidence, 100 });
+	}
+	RankCandidates(candidates, count);
+	return count;
+}
+
+TextEncoding IcuBackend::EncodingOf(const char* charset)
+{
+	static const struct { const char* name; TextEncoding encoding; } known[] =
+	{
+		{ "UTF-8", TextEncoding::UTF8 },
+		{ "UTF-16LE", TextEncoding::UTF16LE },
+		{ "UTF-16BE", TextEncoding::UTF16BE },
+		{ "UTF-32LE", TextEncoding::UTF32LE },
+		{ "UTF-32BE", TextEncoding::UTF32BE },
+		{ "windows-1250", TextEncoding::Windows1250 },
+		{ "windows-1251", TextEncoding::Windows1251 },
+		{ "windows-1252", TextEncoding::Windows1252 },
+	};
+	for (const auto& form : known)
+	{
+		if (!std::strcmp(charset, form.name))
+			return form.encoding;
+	}
+	return TextEncoding::Ansi;
+}
+#endif
+
+namespace detector_backend
+{
+
+// the backends of this build, the first one is the default
+inline const char* const* Names(size_t& count)
+{
+	static const char* const names[] =
+	{
+#ifdef _WIN32
+		"mlang",
+#endif
+		"native",
+#if DETECTOR_ICU
+		"icu",
+#endif
+	};
+	count = sizeof(names) / sizeof(names[0]);
+	return names;
+}
+
+// the entry of Names, nullptr for a backend this build does not have
+inline const char* Find(const char* name)
+{
+	size_t count;
+	const char* const* names = Names(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!std::strcmp(name, names[i]))
+			return names[i];
+	}
+	return nullptr;
+}
+
+// UNICODE_TEST_DETECTOR overrides the default, like UNICODE_TEST_SIMD
+inline const char* StartupName()
+{
+	size_t count;
+	const char* name = std::getenv("UNICODE_TEST_DETECTOR");
+	const char* found = name ? Find(name) : nullptr;
+	return found ? found : Names(count)[0];
+}
+
+inline std::atomic<const char*>& Selected()
+{
+	static std::atomic<const char*> name(StartupName());
+	return name;
+}
+
+} // namespace detector_backend
+
+// nullptr for a name this build does not have
+inline std::unique_ptr<DetectorBackend> CreateDetectorBackend(const char* name)
+{
+	std::unique_ptr<DetectorBackend> backend;
+	if (!std::strcmp(name, "native"))
+		backend.reset(new NativeBackend);
+#ifdef _WIN32
+	else if (!std::strcmp(name, "mlang"))
+		backend.reset(new MLangBackend);
+#endif
+#if DETECTOR_ICU
+	else if (!std::strcmp(name, "icu"))
+		backend.reset(new IcuBackend);
+#endif
+	return backend;
+}
+
+inline const char* SelectedDetectorBackend()
+{
+	return detector_backend::Selected().load(std::memory_order_relaxed);
+}
+
+// false, and no change, for a backend this build does not have; call it
+// before any thread detects, threads keep the backend they started with
+inline bool SelectDetectorBackend(const char* name)
+{
+	const char* found = detector_backend::Find(name);
+	if (!found)
+		return false;
+	detector_backend::Selected().store(found, std::memory_order_relaxed);
+	return true;
+}
+
+// the calling thread's instance of the selected backend
+inline DetectorBackend& ThreadDetectorBackend()
+{
+	thread_local std::unique_ptr<DetectorBackend> backend(CreateDetectorBackend(SelectedDetectorBackend()));
+	assert(backend);
+	return *backend;
+}
+
+#endif
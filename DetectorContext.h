@@ -0,0 +1,63 @@
+#ifndef _5584A4FB_48D0_439B_B92D_F23166C2B429_
+#define  _5584A4FB_48D0_439B_B92D_F23166C2B429_
+
+#ifdef _WIN32
+
+#include <memory>
+#include <objbase.h>
+#include "EncodingDetect.h"
+
+// Long-lived per thread detection state: one COM apartment and one
+// IMultiLanguage2 instance, created on first use and released at thread exit.
+// Worker threads call ForCurrentThread() for every file and never pay for
+// CoInitialize / CoCreateInstance again.
+class DetectorContext
+{
+	struct Apartment
+	{
+		HRESULT hr;
+		Apartment() : hr(::CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED)) {}
+		~Apartment() { if (SUCCEEDED(hr)) ::CoUninitialize(); }
+		// somebody initialized the thread as MTA already, COM is usable anyway
+		bool IsUsable() const { return SUCCEEDED(hr) || hr == RPC_E_CHANGED_MODE; }
+	};
+
+	Apartment apartment; // declared first: must outlive the detector
+	std::unique_ptr<EncodeDetector> detector;
+
+	DetectorContext()
+	{
+		if (apartment.IsUsable())
+			detector.reset(new EncodeDetector);
+	}
+
+	DetectorContext(const DetectorContext&) = delete;
+	DetectorContext& operator=(const DetectorContext&) = delete;
+
+public:
+	static DetectorContext& ForCurrentThread()
+	{
+		thread_local DetectorContext context;
+		return context;
+	}
+
+	bool IsAvailable() const
+	{
+		return detector && detector->p;
+	}
+
+	EncodeDetector& Detector()
+	{
+		assert(detector);
+		return *detector;
+	}
+
+	TextEncoding Detect(const char* begin, const char* end)
+	{
+		return detector ? detector->Detect(begin, end) : TextEncoding::Ansi;
+	}
+};
+
+#endif // _WIN32
+
+#endif
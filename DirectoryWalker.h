@@ -0,0 +1,195 @@
+#ifndef _A61C3E08_5D27_4F9B_8B42_7E0D19C6F5A3_
+#define  _A61C3E08_5D27_4F9B_8B42_7E0D19C6F5A3_
+
+#include <assert.h>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// Regular files below a directory, without <filesystem> (the tree is C++14).
+// Symbolic links to directories are not followed, so a link cycle cannot make
+// the walk endless; links to files are reported like the files themselves.
+class DirectoryWalker
+{
+public:
+	// onFile(const std::string& path) for root itself if it is a file, or for
+	// every file below it; false if root does not exist
+	template<typename OnFile>
+	static inline bool Walk(const std::string& root, OnFile&& onFile);
+
+	// one path per line, as written by find or dir /b /s
+	template<typename OnFile>
+	static inline bool ReadList(const std::string& listName, OnFile&& onFile);
+
+private:
+	enum class Kind { Missing, File, Directory, Other };
+
+	static inline Kind KindOf(const std::string& path);
+
+	static std::string Join(const std::string& directory, const char* name)
+	{
+#ifdef _WIN32
+		const char separator = '\\';
+#else
+		const char separator = '/';
+#endif
+		if (!directory.empty() && (directory.back() == '/' || directory.back() == separator))
+			return directory + name;
+		return directory + separator + name;
+	}
+};
+
+
+#ifdef _WIN32
+
+DirectoryWalker::Kind DirectoryWalker::KindOf(const std::string& path)
+{
+	const DWORD attributes = ::GetFileAttributesA(path.c_str());
+	if (attributes == INVALID_FILE_ATTRIBUTES)
+		return Kind::Missing;
+	return attributes & FILE_ATTRIBUTE_DIRECTORY ? Kind::Directory : Kind::File;
+}
+
+template<typename OnFile>
+bool DirectoryWalker::Walk(const std::string& root, OnFile&& onFile)
+{
+	const Kind kind = KindOf(root);
+	if (kind != Kind::Directory)
+	{
+		if (kind == Kind::File)
+			onFile(root);
+		return kind != Kind::Missing;
+	}
+
+	std::vector<std::string> directories(1, root);
+	while (!directories.empty())
+	{
+		const std::string directory = std::move(directories.back());
+		directories.pop_back();
+
+		WIN32_FIND_DATAA entry;
+		const HANDLE find = ::FindFirstFileExA(Join(directory, "*").c_str(), FindExInfoBasic, &entry,
+			FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+		if (find == INVALID_HANDLE_VALUE)
+			continue;
+		do
+		{
+			const char* name = entry.cFileName;
+			if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+				continue;
+			if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				// junctions and directory symlinks
+				if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+					directories.push_back(Join(directory, name));
+			}
+			else
+				onFile(Join(directory, name));
+		} while (::FindNextFileA(find, &entry));
+		::FindClose(find);
+	}
+	return true;
+}
+
+#else
+
+DirectoryWalker::Kind DirectoryWalker::KindOf(const std::string& path)
+{
+	struct stat info;
+	if (::stat(path.c_str(), &info) != 0)
+		return Kind::Missing;
+	if (S_ISREG(info.st_mode))
+		return Kind::File;
+	return S_ISDIR(info.st_mode) ? Kind::Directory : Kind::Other;
+}
+
+template<typename OnFile>
+bool DirectoryWalker::Walk(const std::string& root, OnFile&& onFile)
+{
+	const Kind kind = KindOf(root);
+	if (kind != Kind::Directory)
+	{
+		if (kind == Kind::File)
+			onFile(root);
+		return kind != Kind::Missing;
+	}
+
+	std::vector<std::string> directories(1, root);
+	while (!directories.empty())
+	{
+		const std::string directory = std::move(directories.back());
+		directories.pop_back();
+
+		DIR* dir = ::opendir(directory.c_str());
+		if (!dir)
+			continue;
+		while (const dirent* entry = ::readdir(dir))
+		{
+			const char* name = entry->d_name;
+			if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+				continue;
+
+			std::string path = Join(directory, name);
+			switch (entry->d_type)
+			{
+			case DT_REG:
+				onFile(path);
+				break;
+			case DT_DIR:
+				directories.push_back(std::move(path));
+				break;
+			case DT_LNK:
+				if (KindOf(path) == Kind::File)
+					onFile(path);
+				break;
+			case DT_UNKNOWN:
+			{
+				// file systems without d_type, lstat keeps links unfollowed
+				struct stat info;
+				if (::lstat(path.c_str(), &info) != 0)
+					break;
+				if (S_ISREG(info.st_mode))
+					onFile(path);
+				else if (S_ISDIR(info.st_mode))
+					directories.push_back(std::move(path));
+				else if (S_ISLNK(info.st_mode) && KindOf(path) == Kind::File)
+					onFile(path);
+				break;
+			}
+			default:
+				break;
+			}
+		}
+		::closedir(dir);
+	}
+	return true;
+}
+
+#endif
+
+template<typename OnFile>
+bool DirectoryWalker::ReadList(const std::string& listName, OnFile&& onFile)
+{
+	std::ifstream list(listName, std::ios::binary);
+	if (!list)
+		return false;
+	std::string line;
+	while (std::getline(list, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			onFile(line);
+	}
+	return true;
+}
+
+#endif
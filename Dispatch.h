@@ -0,0 +1,279 @@
+#ifndef _8050AA57_B1D5_4CD5_9C4F_CDFC54E4BD99_
+#define  _8050AA57_B1D5_4CD5_9C4F_CDFC54E4BD99_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include "CpuFeatures.h"
+#include "HexKernels.h"
+#include "SimdKernels.h"
+#include "Transcode.h"
+
+// One binary for every CPU of an architecture: all kernel levels are compiled
+// in, and the functions below call them through a table of function pointers
+// that is bound once, on first use, to the best level the CPU supports. The
+// environment variable UNICODE_TEST_SIMD (a SimdLevelName) or SelectSimdLevel
+// force a lower level, for benchmarks and for comparing the results.
+//
+// The hot loops stay inside the kernels; the indirect call is per block of
+// input, not per character.
+namespace simd
+{
+
+// the kernels of one code unit type; wchar_t goes through the type of its size
+template<typename Unit>
+struct UnitKernels
+{
+	const Unit* (*findLineBreakOrBom)(const Unit* begin, const Unit* end);
+	const Unit* (*skipBelow)(const Unit* begin, const Unit* end, uint32_t limit);
+	Unit* (*foldAscii)(const Unit* begin, const Unit* end, Unit* out);
+	void (*countUnitClasses)(const Unit* begin, const Unit* end, uint64_t (&counts)[UnitClassCount]);
+	TranscodeResult (*utf8ToUtf16)(const char* begin, const char* end, Unit* out, Unit* outEnd);
+	TranscodeResult (*utf32LEToUtf16)(const char* begin, const char* end, Unit* out, Unit* outEnd);
+	TranscodeResult (*utf32BEToUtf16)(const char* begin, const char* end, Unit* out, Unit* outEnd);
+	TranscodeResult (*utf16LEToUtf16)(const char* begin, const char* end, Unit* out, Unit* outEnd);
+	TranscodeResult (*utf16BEToUtf16)(const char* begin, const char* end, Unit* out, Unit* outEnd);
+	TranscodeResult (*singleByteToUtf16)(const char16_t* high, const char* begin, const char* end, Unit* out, Unit* outEnd);
+	char* (*hexUnits)(const Unit* begin, const Unit* end, char* out);
+};
+
+struct KernelTable
+{
+	SimdLevel level;
+	const char* (*skipAscii)(const char* begin, const char* end);
+	void (*countZeroBytes)(const char* begin, const char* end, size_t (&counts)[4]);
+	const char* (*validateUtf8)(const char* begin, const char* end);
+	const char* (*validateUtf16LE)(const char* begin, const char* end);
+	const char* (*validateUtf16BE)(const char* begin, const char* end);
+	TranscodeResult (*utf32LEToUtf8)(const char* begin, const char* end, char* out, char* outEnd);
+	TranscodeResult (*utf32BEToUtf8)(const char* begin, const char* end, char* out, char* outEnd);
+	TranscodeResult (*utf16LEToUtf8)(const char* begin, const char* end, char* out, char* outEnd);
+	TranscodeResult (*utf16BEToUtf8)(const char* begin, const char* end, char* out, char* outEnd);
+	UnitKernels<char16_t> units16;
+	UnitKernels<char32_t> units32;
+
+	const UnitKernels<char16_t>& For(const char16_t*) const { return units16; }
+	const UnitKernels<char32_t>& For(const char32_t*) const { return units32; }
+};
+
+#define SIMD_UNIT_KERNELS(ns, Unit) \
+	{ ns::FindLineBreakOrBom, ns::SkipBelow, ns::FoldAscii, ns::CountUnitClasses, ns::Utf8ToUtf16<Unit>, ns::Utf32ToUtf16<false, Unit>, ns::Utf32ToUtf16<true, Unit>, \
+		ns::Utf16ToUtf16<false, Unit>, ns::Utf16ToUtf16<true, Unit>, ns::SingleByteToUtf16<Unit>, ns::HexUnits }
+
+#define SIMD_KERNEL_TABLE(level, ns) \
+	{ level, ns::SkipAscii, ns::CountZeroBytes, ns::ValidateUtf8, ns::ValidateUtf16<false>, ns::ValidateUtf16<true>, \
+		ns::Utf32ToUtf8<false>, ns::Utf32ToUtf8<true>, ns::Utf16ToUtf8<false>, ns::Utf16ToUtf8<true>, \
+		SIMD_UNIT_KERNELS(ns, char16_t), SIMD_UNIT_KERNELS(ns, char32_t) }
+
+// the table of a level, or of the best level below it that this build has
+inline const KernelTable& TableFor(SimdLevel level)
+{
+	static const KernelTable scalarTable = SIMD_KERNEL_TABLE(SimdLevel::Scalar, scalar);
+	switch (level)
+	{
+#if SIMD_KERNELS_AVX512
+	case SimdLevel::Avx512:
+	{
+		static const KernelTable table = SIMD_KERNEL_TABLE(SimdLevel::Avx512, avx512);
+		return table;
+	}
+#endif
+#if SIMD_KERNELS_AVX2
+#if !SIMD_KERNELS_AVX512
+	case SimdLevel::Avx512:
+#endif
+	case SimdLevel::Avx2:
+	{
+		static const KernelTable table = SIMD_KERNEL_TABLE(SimdLevel::Avx2, avx2);
+		return table;
+	}
+#endif
+#if SIMD_KERNELS_SSE42
+	case SimdLevel::Sse42:
+	{
+		static const KernelTable table = SIMD_KERNEL_TABLE(SimdLevel::Sse42, sse42);
+		return table;
+	}
+#endif
+#if SIMD_KERNELS_NEON
+	case SimdLevel::Neon:
+	{
+		static const KernelTable table = SIMD_KERNEL_TABLE(SimdLevel::Neon, neon);
+		return table;
+	}
+#endif
+	default:
+		return scalarTable;
+	}
+}
+
+#undef SIMD_KERNEL_TABLE
+#undef SIMD_UNIT_KERNELS
+
+inline const KernelTable& StartupTable()
+{
+	SimdLevel level = DetectSimdLevel();
+	SimdLevel forced;
+	const char* name = std::getenv("UNICODE_TEST_SIMD");
+	if (name && ParseSimdLevel(name, forced) && IsSupported(forced))
+		level = forced;
+	return TableFor(level);
+}
+
+inline std::atomic<const KernelTable*>& ActiveTable()
+{
+	static std::atomic<const KernelTable*> table(&StartupTable());
+	return table;
+}
+
+inline const KernelTable& Kernels()
+{
+	return *ActiveTable().load(std::memory_order_relaxed);
+}
+
+// level of the kernels in use; below the requested one when this build lacks it
+inline SimdLevel ActiveSimdLevel()
+{
+	return Kernels().level;
+}
+
+// false, and no change, if the CPU cannot run the level; call it before any
+// thread decodes, the kernels in flight are not waited for
+inline bool SelectSimdLevel(SimdLevel level)
+{
+	if (!IsSupported(level))
+		return false;
+	ActiveTable().store(&TableFor(level), std::memory_order_relaxed);
+	return true;
+}
+
+inline const char* SkipAscii(const char* begin, const char* end)
+{
+	return Kernels().skipAscii(begin, end);
+}
+
+inline void CountZeroBytes(const char* begin, const char* end, size_t (&counts)[4])
+{
+	Kernels().countZeroBytes(begin, end, counts);
+}
+
+inline const char* ValidateUtf8(const char* begin, const char* end)
+{
+	return Kernels().validateUtf8(begin, end);
+}
+
+inline const char* ValidateUtf16LE(const char* begin, const char* end)
+{
+	return Kernels().validateUtf16LE(begin, end);
+}
+
+inline const char* ValidateUtf16BE(const char* begin, const char* end)
+{
+	return Kernels().validateUtf16BE(begin, end);
+}
+
+template<typename CharT>
+inline const CharT* FindLineBreakOrBom(const CharT* begin, const CharT* end)
+{
+	const auto units = AsUnits(begin);
+	return begin + (Kernels().For(units).findLineBreakOrBom(units, units + (end - begin)) - units);
+}
+
+template<typename CharT>
+inline const CharT* SkipBelow(const CharT* begin, const CharT* end, uint32_t limit)
+{
+	const auto units = AsUnits(begin);
+	return begin + (Kernels().For(units).skipBelow(units, units + (end - begin), limit) - units);
+}
+
+template<typename CharT>
+inline CharT* FoldAscii(const CharT* begin, const CharT* end, CharT* out)
+{
+	const auto units = AsUnits(begin);
+	const auto target = AsUnits(out);
+	return out + (Kernels().For(units).foldAscii(units, units + (end - begin), target) - target);
+}
+
+template<typename CharT>
+inline void CountUnitClasses(const CharT* begin, const CharT* end, uint64_t (&counts)[UnitClassCount])
+{
+	const auto units = AsUnits(begin);
+	Kernels().For(units).countUnitClasses(units, units + (end - begin), counts);
+}
+
+// writes at most MaxHexUnitSize bytes per unit and up to HexSlack bytes past
+// the returned end
+template<typename CharT>
+inline char* HexUnits(const CharT* begin, const CharT* end, char* out)
+{
+	const auto units = AsUnits(begin);
+	return Kernels().For(units).hexUnits(units, units + (end - begin), out);
+}
+
+} // namespace simd
+
+template<typename CharT>
+inline TranscodeResult Utf8ToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	const auto units = simd::AsUnits(out);
+	return simd::Kernels().For(units).utf8ToUtf16(begin, end, units, simd::AsUnits(outEnd));
+}
+
+template<typename CharT>
+inline TranscodeResult Utf32LEToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	const auto units = simd::AsUnits(out);
+	return simd::Kernels().For(units).utf32LEToUtf16(begin, end, units, simd::AsUnits(outEnd));
+}
+
+template<typename CharT>
+inline TranscodeResult Utf32BEToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	const auto units = simd::AsUnits(out);
+	return simd::Kernels().For(units).utf32BEToUtf16(begin, end, units, simd::AsUnits(outEnd));
+}
+
+// surrogates must be paired, a high surrogate at the end of input is Incomplete
+template<typename CharT>
+inline TranscodeResult Utf16LEToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	const auto units = simd::AsUnits(out);
+	return simd::Kernels().For(units).utf16LEToUtf16(begin, end, units, simd::AsUnits(outEnd));
+}
+
+template<typename CharT>
+inline TranscodeResult Utf16BEToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	const auto units = simd::AsUnits(out);
+	return simd::Kernels().For(units).utf16BEToUtf16(begin, end, units, simd::AsUnits(outEnd));
+}
+
+// single byte input, high the UTF-16 units of bytes 0x80..0xFF (HighHalfTable)
+template<typename CharT>
+inline TranscodeResult SingleByteToUtf16(const char16_t* high, const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	const auto units = simd::AsUnits(out);
+	return simd::Kernels().For(units).singleByteToUtf16(high, begin, end, units, simd::AsUnits(outEnd));
+}
+
+inline TranscodeResult Utf32LEToUtf8(const char* begin, const char* end, char* out, char* outEnd)
+{
+	return simd::Kernels().utf32LEToUtf8(begin, end, out, outEnd);
+}
+
+inline TranscodeResult Utf32BEToUtf8(const char* begin, const char* end, char* out, char* outEnd)
+{
+	return simd::Kernels().utf32BEToUtf8(begin, end, out, outEnd);
+}
+
+inline TranscodeResult Utf16LEToUtf8(const char* begin, const char* end, char* out, char* outEnd)
+{
+	return simd::Kernels().utf16LEToUtf8(begin, end, out, outEnd);
+}
+
+inline TranscodeResult Utf16BEToUtf8(const char* begin, const char* end, char* out, char* outEnd)
+{
+	return simd::Kernels().utf16BEToUtf8(begin, end, out, outEnd);
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _F6AF81A4_AD10_44AE_BB98_D8D7515C5417_
+#define  _F6AF81A4_AD10_44AE_BB98_D8D7515C5417_
+
+#include <algorithm>
+#include <cstddef>
+#include "TextEncoding.h"
+
+// One reading of the input that a detector considers, in the ranked lists of
+// DetectorBackend::Candidates and RankEncodings:
+//  confidence - as in DetectionResult
+//  coverage   - percent of the input the reading explains, 100 when the
+//               detector does not say (MLang's nDocPercent)
+struct EncodingCandidate
+{
+	TextEncoding encoding;
+	int confidence;
+	int coverage;
+};
+
+// candidate into the list of count, or the better of the two where the
+// encoding is listed already
+inline void MergeCandidate(EncodingCandidate* candidates, size_t& count, size_t capacity, const EncodingCandidate& candidate)
+{
+	EncodingCandidate* end = candidates + count;
+	EncodingCandidate* listed = std::find_if(candidates, end, [&candidate](const EncodingCandidate& c) { return c.encoding == candidate.encoding; });
+	if (listed == end && count < capacity)
+		candidates[count++] = candidate;
+	else if (listed != end && (candidate.confidence > listed->confidence
+		|| (candidate.confidence == listed->confidence && candidate.coverage > listed->coverage)))
+		*listed = candidate;
+}
+
+// best first: confidence, then coverage, then the order they came in
+inline void RankCandidates(EncodingCandidate* candidates, size_t count)
+{
+	std::stable_sort(candidates, candidates + count, [](const EncodingCandidate& a, const EncodingCandidate& b)
+	{
+		return a.confidence != b.confidence ? a.confidence > b.confidence : a.coverage > b.coverage;
+	});
+}
+
+#endif
@@ -1,14 +1,19 @@
 #ifndef _2609BFC9_2CCB_490F_9B56_0A4D3DA0132B_
 #define  _2609BFC9_2CCB_490F_9B56_0A4D3DA0132B_
 
+// MLang is COM, Windows only; DetectorBackend.h has the portable choices
+#ifdef _WIN32
+
 #include <assert.h>
+#include <algorithm>
+#include <codecvt>
+#include <locale>
+#include <utility>
 #include <atlcomcli.h>
 #include <MLang.h>
-
-#define CP_UTF16_LE 1200
-#define CP_UTF16_BE 1201
-#define CP_UTF32_LE 12000
-#define CP_UTF32_BE 12001
+#include "Dispatch.h"
+#include "EncodingCandidate.h"
+#include "TextEncoding.h"
 
 // utility wrapper to adapt locale-bound facets for wstring/wbuffer convert
 template<class Facet>
@@ -19,85 +24,122 @@ struct deletable_facet : Facet
 	~deletable_facet() {}
 };
 
-enum class TextEncoding : int
-{
-	Ansi = CP_ACP, UTF8 = CP_UTF8, UTF16LE = CP_UTF16_LE, UTF16BE = CP_UTF16_BE, UTF32LE = CP_UTF32_LE, UTF32BE = CP_UTF32_BE
-};
-
 class EncodeDetector
 	: public CComPtr<IMultiLanguage2>
 {
-	static const int MaxCodePages = 10;
 public:
+	static const int MaxCodePages = 10;
+
 	EncodeDetector()
 	{
 		CComQIPtr<IMultiLanguage> pML;
+		// on failure p stays null and Detect falls back to the UTF-8 probe,
+		// a long-lived detector must not take its thread down
 		if (pML.CoCreateInstance(CLSID_CMultiLanguage) == S_OK)
-		{
-			if (pML.QueryInterface(&p) != S_OK)
-			{
-				throw;
-			}
-		}
+			pML.QueryInterface(&p);
 	};
 
-	// this function is specific to our CS needs. It'll only tell one of 3 answers:
-	//  eUTF16 -    if the file actually has the UTF-16 BOM (or DetectInputCodepage tells us
-	//              it is; though I've never see it returned even when it was...)
-	//  eUTF8 -     if DetectInputCodepage tells us that at least one of the encodings is
-	//              UTF-8 (it seems to never have 100% confidence even on files *with the
-	//              BOM and even if they were saved by Word, for example).
-	//  eAnsi -     if it isn't one of the above two (this is simply so we know how to treat
-	//              the data; i.e. use CP_ACP for conversion to wide). Even though this is a
-	//              huge assumption on my part, in our CS case, we really don't need to
-	//              expect data to be in any form besides these three.
+	// The best of the Candidates, so one of the encodings this tree decodes:
+	// UTF-8, UTF-16LE/BE, UTF-32LE/BE or windows-1250/1251/1252. Without a
+	// candidate (MLang missing or failing, or naming only code pages this
+	// tree does not decode) UTF-8 if the bytes convert as UTF-8, else ANSI,
+	// which is decoded with CP_ACP or the --ansi= code page.
 	inline TextEncoding Detect(const char* begin, const char* end);
+
+	// All code pages DetectInputCodepage reports, best first, with nConfidence
+	// (clamped to 0..100) and nDocPercent; the ones this tree does not decode
+	// are left out. 7-bit text without zero bytes is UTF-8 without a
+	// call into COM, the vector prescan costs less than the call alone.
+	inline size_t Candidates(const char* begin, const char* end, EncodingCandidate* candidates, size_t capacity);
+
+private:
+	// false for a code page this tree does not decode
+	static inline bool EncodingOf(UINT codePage, TextEncoding& encoding);
 };
 
 
-TextEncoding EncodeDetector::Detect(const char* begin, const char* end)
+bool EncodeDetector::EncodingOf(UINT codePage, TextEncoding& encoding)
+{
+	switch (codePage)
+	{
+	case 20127: // ASCII
+	case CP_UTF8:
+		encoding = TextEncoding::UTF8;
+		return true;
+	case CP_UTF16_LE:
+	case CP_UTF16_BE:
+	case CP_UTF32_LE:
+	case CP_UTF32_BE:
+	case 1250:
+	case 1251:
+	case 1252:
+		encoding = static_cast<TextEncoding>(codePage);
+		return true;
+	default:
+		encoding = TextEncoding::Ansi;
+		return false;
+	}
+}
+
+size_t EncodeDetector::Candidates(const char* begin, const char* end, EncodingCandidate* candidates, size_t capacity)
 {
-	//using value_type = typename std::decay< decltype(*begin) >::type;
-	//static_assert(std::is_same<char, value_type>::value, "Detect only from bytes");
 	assert(begin && end);
 	assert(begin <= end);
+	if (!capacity)
+		return 0;
+
+	size_t zeros[4] = {};
+	simd::CountZeroBytes(begin, end, zeros);
+	if (!(zeros[0] + zeros[1] + zeros[2] + zeros[3]) && simd::SkipAscii(begin, end) == end)
+	{
+		candidates[0] = { TextEncoding::UTF8, 100, 100 };
+		return 1;
+	}
 
 	DetectEncodingInfo codePages[MaxCodePages] = {};
 	auto scores = MaxCodePages;
-	auto length = end - begin;
+	auto length = static_cast<INT>(end - begin);
+	if (!p || FAILED(p->DetectInputCodepage(MLDETECTCP_NONE, 0, const_cast<char*>(begin), &length, codePages, &scores)))
+		return 0;
 
-	if (SUCCEEDED(p->DetectInputCodepage(MLDETECTCP_NONE, 0, const_cast<char*>(begin), &length, codePages, &scores)))
+	size_t count = 0;
+	for (auto i = 0; i < scores; ++i)
 	{
-		for (auto i = 0; i < scores; ++i)
-		{
-			switch (codePages[i].nCodePage)
-			{
-			case 20127: // ASCII
-			case CP_UTF8:
-				return TextEncoding::UTF8;
-			case CP_UTF16_LE:
-				return TextEncoding::UTF16LE;
-			case CP_UTF16_BE:
-				return TextEncoding::UTF16BE;
-			case CP_UTF32_LE:
-				return TextEncoding::UTF32LE;
-			case CP_UTF32_BE:
-				return TextEncoding::UTF32BE;
-			}
-		}
-	} else
+		// no decoder for it (932, 936, KOI8-R, ...); as ANSI with MLang's
+		// confidence it would outrank the real candidates
+		TextEncoding encoding;
+		if (!EncodingOf(codePages[i].nCodePage, encoding))
+			continue;
+		const int confidence = std::min(std::max(static_cast<int>(codePages[i].nConfidence), 0), 100);
+		MergeCandidate(candidates, count, capacity, { encoding, confidence, static_cast<int>(codePages[i].nDocPercent) });
+	}
+	RankCandidates(candidates, count);
+	return count;
+}
+
+
+TextEncoding EncodeDetector::Detect(const char* begin, const char* end)
+{
+	//using value_type = typename std::decay< decltype(*begin) >::type;
+	//static_assert(std::is_same<char, value_type>::value, "Detect only from bytes");
+	assert(begin && end);
+	assert(begin <= end);
+
+	// Candidates has no ANSI entry, the best one is decoded here
+	EncodingCandidate candidates[MaxCodePages];
+	if (Candidates(begin, end, candidates, MaxCodePages))
+		return candidates[0].encoding;
+	try
+	{
+		std::wstring_convert<deletable_facet<std::codecvt_utf8_utf16<char16_t>>, char16_t> converter;
+		return converter.from_bytes(begin, end).empty() ? TextEncoding::Ansi : TextEncoding::UTF8;
+	}
+	catch (std::exception&)
 	{
-		try
-		{
-			std::wstring_convert<deletable_facet<std::codecvt_utf8_utf16<char16_t>>, char16_t> converter;
-			return converter.from_bytes(begin, end).empty() ? TextEncoding::Ansi : TextEncoding::UTF8;
-		}
-		catch (std::exception&)
-		{
-			return TextEncoding::Ansi;
-		}
+		return TextEncoding::Ansi;
 	}
-	return TextEncoding::Ansi;
 }
 
-#endif;
\ No newline at end of file
+#endif // _WIN32
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef _F7EB9B1D_B06B_4181_9721_D7E79DCE2739_
+#define  _F7EB9B1D_B06B_4181_9721_D7E79DCE2739_
+
+#include <assert.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "TextEncoding.h"
+#include "Dispatch.h"
+
+// Portable replacement for the MLang round trip. Looks only at the bytes:
+//  - byte order marks
+//  - distribution of zero bytes (UTF-16 / UTF-32 text without BOM)
+//  - strict UTF-8 validity (invalid UTF-8 without zeros is treated as ANSI)
+class FastEncodeDetector
+{
+public:
+	// below this value the caller should ask a heavier detector (MLang)
+	static const int ConfidentThreshold = 50;
+
+	inline DetectionResult Detect(const char* begin, const char* end) const;
+
+	// a byte order mark sets result, its length is the bomLength
+	static inline bool DetectBom(const char* begin, size_t size, DetectionResult& result);
+
+private:
+	friend class ProgressiveDetector;
+
+	static inline bool DetectWide(const size_t (&zeros)[4], size_t size, DetectionResult& result);
+};
+
+
+// One branch on the lead byte, which only four values of can start a BOM,
+// then the bytes of the BOMs it can start; the UTF-32LE BOM starts with the
+// UTF-16LE one
+bool FastEncodeDetector::DetectBom(const char* begin, size_t size, DetectionResult& result)
+{
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(begin);
+	if (size < 2)
+		return false;
+	switch (bytes[0])
+	{
+	case 0xEF:
+		if (size < 3 || bytes[1] != 0xBB || bytes[2] != 0xBF)
+			return false;
+		result = { TextEncoding::UTF8, 100, 3 };
+		return true;
+	case 0xFF:
+		if (bytes[1] != 0xFE)
+			return false;
+		if (size >= 4 && !bytes[2] && !bytes[3])
+			result = { TextEncoding::UTF32LE, 100, 4 };
+		else
+			result = { TextEncoding::UTF16LE, 100, 2 };
+		return true;
+	case 0xFE:
+		if (bytes[1] != 0xFF)
+			return false;
+		result = { TextEncoding::UTF16BE, 100, 2 };
+		return true;
+	case 0x00:
+		if (size < 4 || bytes[1] || bytes[2] != 0xFE || bytes[3] != 0xFF)
+			return false;
+		result = { TextEncoding::UTF32BE, 100, 4 };
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Latin based text stored as UTF-16/32 has a zero in (almost) every high byte,
+// while the low bytes are rarely zero. zeros[i] counts zeros at offset i mod 4.
+bool FastEncodeDetector::DetectWide(const size_t (&zeros)[4], size_t size, DetectionResult& result)
+{
+	// how many bytes of the sample are at offset i mod 4
+	size_t slots[4];
+	for (size_t i = 0; i < 4; ++i)
+		slots[i] = (size + 3 - i) / 4;
+	auto mostly = [&](size_t i) { return zeros[i] * 10 >= slots[i] * 9; };
+	auto rarely = [&](size_t i) { return zeros[i] * 10 <= slots[i]; };
+
+	if (size >= 8)
+	{
+		// U+0000..U+FFFF: the two most significant bytes are zero
+		if (mostly(2) && mostly(3) && rarely(0))
+		{
+			result = { TextEncoding::UTF32LE, static_cast<int>(std::min<size_t>(95, 50 + 50 * (zeros[2] + zeros[3]) / (slots[2] + slots[3]))), 0 };
+			return true;
+		}
+		if (mostly(0) && mostly(1) && rarely(3))
+		{
+			result = { TextEncoding::UTF32BE, static_cast<int>(std::min<size_t>(95, 50 + 50 * (zeros[0] + zeros[1]) / (slots[0] + slots[1]))), 0 };
+			return true;
+		}
+	}
+
+	const size_t pairs = size / 2;
+	if (pairs < 2)
+		return false;
+
+	const size_t even = zeros[0] + zeros[2];
+	const size_t odd = zeros[1] + zeros[3];
+	if (odd >= pairs * 3 / 10 && even * 4 <= odd)
+	{
+		result = { TextEncoding::UTF16LE, static_cast<int>(50 + 45 * odd / pairs), 0 };
+		return true;
+	}
+	if (even >= pairs * 3 / 10 && odd * 4 <= even)
+	{
+		result = { TextEncoding::UTF16BE, static_cast<int>(50 + 45 * even / pairs), 0 };
+		return true;
+	}
+	return false;
+}
+
+DetectionResult FastEncodeDetector::Detect(const char* begin, const char* end) const
+{
+	assert(begin && end);
+	assert(begin <= end);
+
+	const size_t size = end - begin;
+	DetectionResult result = { TextEncoding::UTF8, 0, 0 };
+	if (!size || DetectBom(begin, size, result))
+		return result;
+
+	size_t zeros[4] = {};
+	simd::CountZeroBytes(begin, end, zeros);
+	if (zeros[0] + zeros[1] + zeros[2] + zeros[3])
+	{
+		if (DetectWide(zeros, size, result))
+			return result;
+		// zeros without a pattern: binary data or something exotic
+		return { TextEncoding::Ansi, 20, 0 };
+	}
+
+	const char* nonAscii = simd::SkipAscii(begin, end);
+	if (nonAscii == end)
+		return { TextEncoding::UTF8, 60, 0 }; // 7-bit ASCII decodes the same as UTF-8
+
+	// a window may end in the middle of a character, that is not an error
+	const char* invalid = simd::ValidateUtf8(nonAscii, end);
+	if (invalid == end || simd::IsTruncatedUtf8(invalid, end))
+		return { TextEncoding::UTF8, 95, 0 };
+
+	return { TextEncoding::Ansi, 60, 0 };
+}
+
+// FastEncodeDetector on a window that grows while the answer is open, so a
+// long ASCII header no longer hides the text behind it. The window starts at
+// InitialWindow bytes and doubles up to MaxWindow; every step scans only the
+// bytes it adds. Text that is 7-bit so far, or has zeros without a pattern
+// yet, is open; a BOM, a zero pattern, a complete non-ASCII UTF-8 sequence or
+// invalid UTF-8 settle it.
+class ProgressiveDetector
+{
+public:
+	static const size_t InitialWindow = 256;
+	static const size_t MaxWindow = 64 * 1024;
+
+	inline DetectionResult Detect(const char* begin, const char* end);
+
+	// bytes the last Detect looked at
+	size_t Examined() const { return examined; }
+	// the check the last Detect ended with
+	Prefilter Settled() const { return settled; }
+
+private:
+	inline DetectionResult Settle(Prefilter prefilter, const DetectionResult& result);
+
+	size_t examined = 0;
+	Prefilter settled = Prefilter::Ascii;
+};
+
+
+DetectionResult ProgressiveDetector::Settle(Prefilter prefilter, const DetectionResult& result)
+{
+	settled = prefilter;
+	return result;
+}
+
+
+DetectionResult ProgressiveDetector::Detect(const char* begin, const char* end)
+{
+	assert(begin && end);
+	assert(begin <= end);
+
+	const size_t size = end - begin;
+	DetectionResult result = { TextEncoding::UTF8, 0, 0 };
+	examined = std::min<size_t>(size, 4);
+	if (!size)
+		return Settle(Prefilter::Ambiguous, result);
+	if (FastEncodeDetector::DetectBom(begin, size, result))
+		return Settle(Prefilter::Bom, result);
+
+	// the window grows in multiples of 4, the zero counts keep their phase
+	examined = 0;
+	size_t zeros[4] = {};
+	bool anyZero = false;
+	const char* ascii = begin; // [begin, ascii) is 7-bit
+	const size_t limit = std::min(size, static_cast<size_t>(MaxWindow));
+	for (size_t window = std::min(limit, static_cast<size_t>(InitialWindow));; window = std::min(limit, 2 * window))
+	{
+		const char* scanned = begin + examined;
+		const char* windowEnd = begin + window;
+		const bool last = window == limit;
+		examined = window;
+
+		simd::CountZeroBytes(scanned, windowEnd, zeros);
+		anyZero = anyZero || zeros[0] + zeros[1] + zeros[2] + zeros[3];
+		if (anyZero)
+		{
+			if (FastEncodeDetector::DetectWide(zeros, window, result))
+				return Settle(Prefilter::Wide, result);
+			if (last)
+				return Settle(Prefilter::Ambiguous, { TextEncoding::Ansi, 20, 0 });
+			continue;
+		}
+
+		// UTF-8 is checked from the first non-ASCII byte, again from the
+		// incomplete sequence a window ended in
+		ascii = simd::SkipAscii(ascii, windowEnd);
+		if (ascii != windowEnd)
+		{
+			const char* invalid = simd::ValidateUtf8(ascii, windowEnd);
+			if (invalid == windowEnd)
+				return Settle(Prefilter::Utf8, { TextEncoding::UTF8, 95, 0 });
+			if (!simd::IsTruncatedUtf8(invalid, windowEnd))
+				return Settle(Prefilter::SingleByte, { TextEncoding::Ansi, 60, 0 });
+			if (invalid != ascii || last)
+				return Settle(Prefilter::Utf8, { TextEncoding::UTF8, 95, 0 });
+		}
+		if (last)
+			return Settle(Prefilter::Ascii, { TextEncoding::UTF8, 60, 0 });
+	}
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef _101AF317_9231_45BA_B388_4755D26943D8_
+#define  _101AF317_9231_45BA_B388_4755D26943D8_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "SimdKernels.h"
+
+// "U+xxxx " formatting of code units for HexWriter. A unit takes at most
+// MaxHexUnitSize bytes; the vector variants store whole registers, so the
+// output range needs HexSlack bytes of room beyond the formatted text.
+namespace simd
+{
+
+const size_t MaxHexUnitSize = 11; // "U+", 8 digits, space
+const size_t HexSlack = 16;
+
+namespace scalar
+{
+
+// "000102...feff": the two digits of byte b are at 2 * b
+inline const char* HexPairs()
+{
+	struct Table
+	{
+		char pairs[512];
+		Table()
+		{
+			static const char digits[] = "0123456789abcdef";
+			for (int b = 0; b < 256; ++b)
+			{
+				pairs[2 * b] = digits[b >> 4];
+				pairs[2 * b + 1] = digits[b & 0xF];
+			}
+		}
+	};
+	static const Table table;
+	return table.pairs;
+}
+
+inline char* WriteHexUnit(char* o, uint32_t unit)
+{
+	const char* pairs = HexPairs();
+	*o++ = 'U';
+	*o++ = '+';
+	if (unit > 0xFFFF)
+	{
+		// beyond the BMP only for UTF-32 units; no leading zero pairs
+		if (unit > 0xFFFFFF)
+		{
+			std::memcpy(o, pairs + 2 * (unit >> 24), 2);
+			o += 2;
+		}
+		std::memcpy(o, pairs + 2 * ((unit >> 16) & 0xFF), 2);
+		o += 2;
+	}
+	std::memcpy(o, pairs + 2 * ((unit >> 8) & 0xFF), 2);
+	std::memcpy(o + 2, pairs + 2 * (unit & 0xFF), 2);
+	o[4] = ' ';
+	return o + 5;
+}
+
+// end of the text written for [begin, end)
+template<typename Unit>
+inline char* HexUnits(const Unit* begin, const Unit* end, char* out)
+{
+	for (; begin != end; ++begin)
+		out = WriteHexUnit(out, static_cast<uint32_t>(*begin));
+	return out;
+}
+
+} // namespace scalar
+
+#if SIMD_KERNELS_SSE42
+SIMD_TARGET_SSE42
+namespace sse42
+{
+
+// 4 units from the 16 bit lanes 0..3 of v: the nibbles become digits through
+// one pshufb, two more place them between the "U+" and the spaces
+inline char* WriteHexUnits4(__m128i v, char* out)
+{
+	const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	// per byte: high nibble, low nibble; the high byte of a unit comes first in text
+	const __m128i chars = _mm_shuffle_epi8(digits,
+		_mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(v, 4), nibble), _mm_and_si128(v, nibble)));
+
+	const __m128i first = _mm_shuffle_epi8(chars, _mm_setr_epi8(-1, -1, 2, 3, 0, 1, -1, -1, -1, 6, 7, 4, 5, -1, -1, -1));
+	const __m128i second = _mm_shuffle_epi8(chars, _mm_setr_epi8(10, 11, 8, 9, -1, -1, -1, 14, 15, 12, 13, -1, -1, -1, -1, -1));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+		_mm_or_si128(first, _mm_setr_epi8('U', '+', 0, 0, 0, 0, ' ', 'U', '+', 0, 0, 0, 0, ' ', 'U', '+')));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16),
+		_mm_or_si128(second, _mm_setr_epi8(0, 0, 0, 0, ' ', 'U', '+', 0, 0, 0, 0, ' ', 0, 0, 0, 0)));
+	return out + 28;
+}
+
+inline char* HexUnits(const char16_t* begin, const char16_t* end, char* out)
+{
+	for (; end - begin >= 4; begin += 4)
+		out = WriteHexUnits4(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(begin)), out);
+	return scalar::HexUnits(begin, end, out);
+}
+
+inline char* HexUnits(const char32_t* begin, const char32_t* end, char* out)
+{
+	for (; end - begin >= 4; begin += 4)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		if (_mm_testz_si128(v, _mm_set1_epi32(static_cast<int>(0xFFFF0000))))
+			out = WriteHexUnits4(_mm_packus_epi32(v, v), out);
+		else
+			out = scalar::HexUnits(begin, begin + 4, out);
+	}
+	return scalar::HexUnits(begin, end, out);
+}
+
+} // namespace sse42
+SIMD_TARGET_END
+#endif
+
+// the text is written 28 bytes a step whatever the register width
+#if SIMD_KERNELS_AVX2
+namespace avx2
+{
+using sse42::HexUnits;
+}
+#endif
+
+#if SIMD_KERNELS_AVX512
+namespace avx512
+{
+using sse42::HexUnits;
+}
+#endif
+
+#if SIMD_KERNELS_NEON
+namespace neon
+{
+using scalar::HexUnits;
+}
+#endif
+
+} // namespace simd
+
+#endif
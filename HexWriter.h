@@ -0,0 +1,98 @@
+#ifndef _5E2B7C90_1F4A_4D63_8A0E_C3B9D6741F28_
+#define  _5E2B7C90_1F4A_4D63_8A0E_C3B9D6741F28_
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+#include "Dispatch.h"
+#include "Metrics.h"
+
+// Buffered formatter for the dump output. Code units become "U+xxxx " through
+// simd::HexUnits, raw bytes and text are copied as they are; all of it is
+// collected in one large buffer that goes to the stream buffer in big writes,
+// without per character iostream formatting or a flush per line.
+class HexWriter
+{
+public:
+	static const size_t DefaultCapacity = 256 * 1024;
+
+	explicit HexWriter(std::ostream& out, size_t capacity = DefaultCapacity)
+		: out(out), buffer(capacity)
+	{
+		assert(capacity >= simd::MaxHexUnitSize + simd::HexSlack);
+	}
+	HexWriter(const HexWriter&) = delete;
+	HexWriter& operator=(const HexWriter&) = delete;
+	~HexWriter() { Flush(); }
+
+	// "U+" and at least 4 lower case hex digits and a space for every unit
+	template<typename CharT>
+	inline void CodeUnits(const CharT* begin, const CharT* end);
+
+	inline void Bytes(const char* begin, const char* end);
+	void Text(const char* text) { Bytes(text, text + std::strlen(text)); }
+	inline void EndLine();
+
+	inline void Flush();
+
+private:
+	std::ostream& out;
+	std::vector<char> buffer;
+	size_t used = 0;
+};
+
+
+template<typename CharT>
+void HexWriter::CodeUnits(const CharT* begin, const CharT* end)
+{
+	assert(begin <= end);
+	while (begin != end)
+	{
+		if (buffer.size() - used < simd::MaxHexUnitSize + simd::HexSlack)
+			Flush();
+
+		// as many units as surely fit, without a check per unit
+		const size_t room = (buffer.size() - used - simd::HexSlack) / simd::MaxHexUnitSize;
+		const CharT* stop = static_cast<size_t>(end - begin) > room ? begin + room : end;
+		used = simd::HexUnits(begin, stop, buffer.data() + used) - buffer.data();
+		begin = stop;
+	}
+}
+
+void HexWriter::Bytes(const char* begin, const char* end)
+{
+	assert(begin <= end);
+	const size_t size = end - begin;
+	if (buffer.size() - used < size)
+	{
+		Flush();
+		if (size >= buffer.size())
+		{
+			out.rdbuf()->sputn(begin, static_cast<std::streamsize>(size));
+			metrics::Add(metrics::Counter::BytesOut, size);
+			return;
+		}
+	}
+	std::memcpy(buffer.data() + used, begin, size);
+	used += size;
+}
+
+void HexWriter::EndLine()
+{
+	if (used == buffer.size())
+		Flush();
+	buffer[used++] = '\n';
+}
+
+void HexWriter::Flush()
+{
+	if (used)
+		out.rdbuf()->sputn(buffer.data(), static_cast<std::streamsize>(used));
+	metrics::Add(metrics::Counter::BytesOut, used);
+	used = 0;
+}
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef _F9D08533_8B75_47E6_8EC8_75091A4D4577_
+#define  _F9D08533_8B75_47E6_8EC8_75091A4D4577_
+
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "DecodeError.h"
+#include "DetectionCache.h"
+#include "Dispatch.h"
+#include "LineSplitter.h"
+#include "MappedFile.h"
+#include "ParallelDecoder.h"
+#include "Pipeline.h"
+#include "StreamingDecoder.h"
+#include "TextEncoding.h"
+
+// Random access to the lines of a decoded file (--index, --lines). One pass
+// over the input leaves a checkpoint at the first line feed after every
+// Interval bytes: the byte the next line starts at, and the lines and code
+// points decoded in front of it. Such a byte is a character boundary where
+// LineSplitter has nothing pending, so decoding may start there and gives the
+// lines behind it exactly as a decode from byte 0 would; a range of lines is
+// decoded from the checkpoint in front of it instead.
+//
+// Lines and code points are those of a decode from byte 0 with the encoding
+// and ErrorPolicy in the index. A BOM is a code point, as for --stats; the
+// decoder never passes an unpaired surrogate, so the code points are the units
+// less half the surrogates.
+//
+// The side file starts with the encoding, the options the decode depends on
+// and what the input is known by (size, modification time, fingerprint of the
+// first SniffSize bytes, as in DetectionCache); the checkpoints follow as
+// LEB128 deltas, 6 to 8 bytes each, some 100 KB for 1 GB of text. It is
+// written beside the old one and renamed over it.
+class LineIndex
+{
+public:
+	static const uint64_t DefaultInterval = 64 * 1024;
+
+	struct Checkpoint
+	{
+		uint64_t offset;    // input byte the next line starts at
+		uint64_t line;      // lines in front of it
+		uint64_t codePoint; // code points decoded in front of it
+	};
+
+	LineIndex() { Clear(); }
+
+	// decodes the whole file with codec; false if it stopped at malformed
+	// input, the index then covers the text in front of it
+	template<typename CharT, typename Codec>
+	inline bool Build(const Codec& codec, const MappedFile& file, ErrorPolicy policy, TextEncoding ansi, uint64_t interval = DefaultInterval);
+
+	// false for a missing, torn or foreign file; the index is empty then
+	inline bool Load(const char* fileName);
+	// false without a write for a Foreign file
+	inline bool Save(const char* fileName) const;
+	// an existing file with content that does not start with the magic,
+	// which Save does not replace
+	static inline bool Foreign(const char* fileName);
+
+	// built for this content of file with these options
+	inline bool Describes(const MappedFile& file, ErrorPolicy policy, TextEncoding ansi) const;
+
+	// the last checkpoint with at most line lines / codePoint code points in front
+	inline const Checkpoint& SeekLine(uint64_t line) const;
+	inline const Checkpoint& SeekCodePoint(uint64_t codePoint) const;
+
+	TextEncoding Encoding() const { return encoding; }
+	bool Complete() const { return complete; }
+	uint64_t Lines() const { return lines; }
+	uint64_t CodePoints() const { return codePoints; }
+	// input bytes decoded, the offset of the bad bytes if not Complete
+	uint64_t Consumed() const { return consumed; }
+	const std::vector<Checkpoint>& Checkpoints() const { return checkpoints; }
+
+private:
+	static const uint32_t Version = 1;
+	static const char* Magic() { return "UTLINDEX"; } // the 8 bytes in front
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		int32_t encoding;
+		int32_t ansi;
+		uint32_t policy;
+		uint64_t size;     // of the input
+		int64_t modified;
+		uint64_t prefix;
+		uint64_t lines;
+		uint64_t codePoints;
+		uint64_t consumed;
+		uint32_t complete;
+		uint32_t reserved;
+		uint64_t count;    // checkpoints, the one at byte 0 included
+		uint64_t bytes;    // of the deltas behind the header
+		uint64_t check;    // DetectionCache::Fingerprint of them
+	};
+
+	inline void Clear();
+	static inline uint64_t PrefixOf(const MappedFile& file);
+	static inline void PutVarint(std::string& out, uint64_t value);
+	static inline bool GetVarint(const char*& p, const char* end, uint64_t& value);
+
+	TextEncoding encoding;
+	TextEncoding ansi;
+	ErrorPolicy policy;
+	uint64_t size;
+	int64_t modified;
+	uint64_t prefix;
+	uint64_t lines;
+	uint64_t codePoints;
+	uint64_t consumed;
+	bool complete;
+	std::vector<Checkpoint> checkpoints; // by offset, line and code point alike
+};
+
+
+template<typename CharT, typename Codec>
+bool LineIndex::Build(const Codec& codec, const MappedFile& file, ErrorPolicy policy, TextEncoding ansi, uint64_t interval)
+{
+	assert(interval >= 4 && !(interval % 4)); // a cut stays on a UTF-32 unit boundary
+	Clear();
+	encoding = codec.Encoding();
+	this->ansi = ansi;
+	this->policy = policy;
+	size = file.Size();
+	modified = file.ModifiedTime();
+	prefix = PrefixOf(file);
+
+	uint64_t units = 0;
+	uint64_t classes[simd::UnitClassCount] = {};
+	LineSplitter<CharT> splitter;
+	auto onLine = [this](const CharT*, const CharT*) { ++lines; };
+	auto sink = [&](const CharT* begin, const CharT* end)
+	{
+		simd::CountUnitClasses(begin, end, classes);
+		units += end - begin;
+		splitter.Push(begin, end, onLine);
+	};
+
+	// fed up to a line feed at a time; after it the decoder carries nothing
+	StreamingDecoder<CharT, Codec> decoder(codec);
+	decoder.SetErrorPolicy(policy);
+	const char* p = file.begin();
+	while (p != file.end())
+	{
+		const char* next = static_cast<uint64_t>(file.end() - p) > interval ? AfterLineFeed(encoding, p + interval, file.end()) : file.end();
+		if (!decoder.Feed(p, next, sink))
+			break;
+		p = next;
+		if (p != file.end())
+			checkpoints.push_back({ static_cast<uint64_t>(p - file.begin()), lines, units - classes[simd::SurrogateUnits] / 2 });
+	}
+	complete = decoder.Finish(sink);
+	splitter.Finish(onLine);
+	codePoints = units - classes[simd::SurrogateUnits] / 2;
+	consumed = decoder.Consumed();
+	return complete;
+}
+
+bool LineIndex::Load(const char* fileName)
+{
+	assert(fileName);
+	Clear();
+	std::ifstream in(fileName, std::ios::binary);
+	const std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	Header header;
+	if (in.bad() || content.size() < sizeof(header))
+		return false;
+	std::memcpy(&header, content.data(), sizeof(header));
+	const char* p = content.data() + sizeof(header);
+	const char* end = content.data() + content.size();
+	if (std::memcmp(header.magic, Magic(), sizeof(header.magic)) || header.version != Version
+		|| header.bytes != static_cast<uint64_t>(end - p) || header.check != DetectionCache::Fingerprint(p, end)
+		|| !header.count || header.count > header.bytes)
+		return false;
+
+	std::vector<Checkpoint> loaded;
+	loaded.reserve(static_cast<size_t>(header.count));
+	Checkpoint at = { 0, 0, 0 };
+	for (uint64_t i = 0; i < header.count; ++i)
+	{
+		uint64_t offset, line, codePoint;
+		if (!GetVarint(p, end, offset) || !GetVarint(p, end, line) || !GetVarint(p, end, codePoint))
+			return false;
+		at = { at.offset + offset, at.line + line, at.codePoint + codePoint };
+		loaded.push_back(at);
+	}
+	if (p != end || loaded.front().offset || at.offset > header.size)
+		return false;
+
+	encoding = static_cast<TextEncoding>(header.encoding);
+	ansi = static_cast<TextEncoding>(header.ansi);
+	policy = static_cast<ErrorPolicy>(header.policy);
+	size = header.size;
+	modified = header.modified;
+	prefix = header.prefix;
+	lines = header.lines;
+	codePoints = header.codePoints;
+	consumed = header.consumed;
+	complete = header.complete != 0;
+	checkpoints.swap(loaded);
+	return true;
+}
+
+bool LineIndex::Save(const char* fileName) const
+{
+	assert(fileName);
+	std::string body;
+	Checkpoint at = { 0, 0, 0 };
+	for (const Checkpoint& checkpoint : checkpoints)
+	{
+		PutVarint(body, checkpoint.offset - at.offset);
+		PutVarint(body, checkpoint.line - at.line);
+		PutVarint(body, checkpoint.codePoint - at.codePoint);
+		at = checkpoint;
+	}
+
+	Header header = {};
+	std::memcpy(header.magic, Magic(), sizeof(header.magic));
+	header.version = Version;
+	header.encoding = static_cast<int32_t>(encoding);
+	header.ansi = static_cast<int32_t>(ansi);
+	header.policy = static_cast<uint32_t>(policy);
+	header.size = size;
+	header.modified = modified;
+	header.prefix = prefix;
+	header.lines = lines;
+	header.codePoints = codePoints;
+	header.consumed = consumed;
+	header.complete = complete;
+	header.count = checkpoints.size();
+	header.bytes = body.size();
+	header.check = DetectionCache::Fingerprint(body.data(), body.data() + body.size());
+
+	// only a torn or stale index is replaced, not what --index= named by
+	// mistake
+	if (Foreign(fileName))
+		return false;
+
+	// a reader of the old file sees it whole until the rename
+	const std::string temporary = std::string(fileName) + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(body.data(), body.size());
+		if (!out.flush())
+		{
+			out.close();
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+#ifdef _WIN32
+	// rename does not replace an existing file there
+	std::remove(fileName);
+#endif
+	if (std::rename(temporary.c_str(), fileName) != 0)
+	{
+		std::remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool LineIndex::Foreign(const char* fileName)
+{
+	std::ifstream in(fileName, std::ios::binary);
+	char magic[8] = {};
+	if (!in.read(magic, sizeof(magic)) && !in.gcount())
+		return false;
+	return in.gcount() != sizeof(magic) || std::memcmp(magic, Magic(), sizeof(magic)) != 0;
+}
+
+bool LineIndex::Describes(const MappedFile& file, ErrorPolicy policy, TextEncoding ansi) const
+{
+	return size == file.Size() && modified == file.ModifiedTime() && prefix == PrefixOf(file)
+		&& this->policy == policy && this->ansi == ansi;
+}
+
+const LineIndex::Checkpoint& LineIndex::SeekLine(uint64_t line) const
+{
+	assert(!checkpoints.empty());
+	const auto after = std::upper_bound(checkpoints.begin(), checkpoints.end(), line,
+		[](uint64_t value, const Checkpoint& checkpoint) { return value < checkpoint.line; });
+	return *std::prev(after);
+}
+
+const LineIndex::Checkpoint& LineIndex::SeekCodePoint(uint64_t codePoint) const
+{
+	assert(!checkpoints.empty());
+	const auto after = std::upper_bound(checkpoints.begin(), checkpoints.end(), codePoint,
+		[](uint64_t value, const Checkpoint& checkpoint) { return value < checkpoint.codePoint; });
+	return *std::prev(after);
+}
+
+// an empty index, the checkpoint at byte 0 alone
+void LineIndex::Clear()
+{
+	encoding = TextEncoding::Ansi;
+	ansi = TextEncoding::Ansi;
+	policy = ErrorPolicy::Stop;
+	size = 0;
+	modified = 0;
+	prefix = 0;
+	lines = 0;
+	codePoints = 0;
+	consumed = 0;
+	complete = false;
+	checkpoints.assign(1, Checkpoint{ 0, 0, 0 });
+}
+
+uint64_t LineIndex::PrefixOf(const MappedFile& file)
+{
+	return DetectionCache::Fingerprint(file.begin(), file.begin() + std::min(SniffSize, file.Size()));
+}
+
+void LineIndex::PutVarint(std::string& out, uint64_t value)
+{
+	for (; value >= 0x80; value >>= 7)
+		out += static_cast<char>(value | 0x80);
+	out += static_cast<char>(value);
+}
+
+bool LineIndex::GetVarint(const char*& p, const char* end, uint64_t& value)
+{
+	value = 0;
+	for (unsigned shift = 0; p != end && shift < 64; shift += 7)
+	{
+		const unsigned char byte = static_cast<unsigned char>(*p++);
+		value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+#endif
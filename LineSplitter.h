@@ -0,0 +1,114 @@
+#ifndef _D4A19CF2_6012_4B2D_83DE_4F32B99EA2C7_
+#define  _D4A19CF2_6012_4B2D_83DE_4F32B99EA2C7_
+
+#include <memory>
+#include <string>
+#include "Dispatch.h"
+
+// Splits decoded text into lines block by block, with the same rules as the
+// old character at a time SafeGetLine:
+//  - a line ends at LF, CR or CR LF (CR followed by byte swapped LF 0x0A00, too)
+//  - byte order marks U+FEFF / U+FFFE are dropped wherever they appear
+//  - a last line without line ending is reported if it is not empty
+// Lines are reported as [begin, end) ranges into the pushed block; only a line
+// crossing a block boundary (or containing a BOM) is assembled in a buffer,
+// which comes from Allocator (an ArenaAllocator for the batch workers).
+template<typename CharT, typename Allocator = std::allocator<CharT>>
+class LineSplitter
+{
+public:
+	explicit LineSplitter(const Allocator& allocator = Allocator())
+		: pending(allocator)
+	{
+	}
+
+	// onLine(const CharT* begin, const CharT* end) for every complete line
+	template<typename OnLine>
+	void Push(const CharT* begin, const CharT* end, OnLine&& onLine)
+	{
+		const CharT* p = begin;
+		if (pendingCR)
+		{
+			pendingCR = false;
+			if (p != end && IsLineFeed(*p))
+				++p;
+		}
+
+		const CharT* lineStart = p;
+		for (;;)
+		{
+			p = simd::FindLineBreakOrBom(p, end);
+			if (p == end)
+				break;
+
+			const CharT c = *p;
+			if (c != '\n' && c != '\r')
+			{
+				// BOM: keep what is before it, continue after it
+				pending.append(lineStart, p);
+				lineStart = ++p;
+				continue;
+			}
+
+			Emit(lineStart, p, onLine);
+			++p;
+			if (c == '\r')
+			{
+				if (p == end)
+				{
+					pendingCR = true;
+					lineStart = p;
+					break;
+				}
+				if (IsLineFeed(*p))
+					++p;
+			}
+			lineStart = p;
+		}
+		pending.append(lineStart, end);
+	}
+
+	// end of input: the last line may have no line ending
+	template<typename OnLine>
+	void Finish(OnLine&& onLine)
+	{
+		if (!pending.empty())
+			onLine(pending.data(), pending.data() + pending.size());
+		pending.clear();
+		pendingCR = false;
+	}
+
+	// gives the line buffer back to the allocator, before an arena behind it
+	// is Reset
+	void Release()
+	{
+		Buffer(pending.get_allocator()).swap(pending);
+		pendingCR = false;
+	}
+
+private:
+	static bool IsLineFeed(CharT c)
+	{
+		return c == '\n' || static_cast<uint32_t>(c) == 0x0A00;
+	}
+
+	template<typename OnLine>
+	void Emit(const CharT* begin, const CharT* end, OnLine& onLine)
+	{
+		if (pending.empty())
+		{
+			onLine(begin, end);
+			return;
+		}
+		pending.append(begin, end);
+		onLine(pending.data(), pending.data() + pending.size());
+		pending.clear();
+	}
+
+	typedef std::basic_string<CharT, std::char_traits<CharT>, Allocator> Buffer;
+
+	Buffer pending;         // start of a line split by a block boundary
+	bool pendingCR = false; // block ended with CR, LF may follow in the next one
+};
+
+#endif
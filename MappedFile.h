@@ -0,0 +1,207 @@
+#ifndef _7ACABB45_4B5C_47E4_ADDE_5507A2A75B93_
+#define  _7ACABB45_4B5C_47E4_ADDE_5507A2A75B93_
+
+#include <assert.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole input. Regular files are mapped into memory, so the
+// encoding sniff and the decoder both read straight from the page cache.
+// Pipes and character devices cannot be mapped; their content is read into
+// an owned buffer once and exposed the same way. stdin is not read through
+// here, main.cpp streams it.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) { *this = std::move(other); }
+	inline MappedFile& operator=(MappedFile&& other);
+	~MappedFile() { Close(); }
+
+	inline bool Open(const char* fileName);
+	inline void Close();
+
+	const char* begin() const { return data; }
+	const char* end() const { return data + size; }
+	size_t Size() const { return size; }
+	bool IsMapped() const { return mapped; }
+
+	// last write time of an opened file in ns since the file system's epoch,
+	// 0 for streams; only good for telling whether the file changed
+	int64_t ModifiedTime() const { return modified; }
+
+private:
+	inline bool ReadDescriptor();
+
+	const char* data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	int64_t modified = 0;
+	std::vector<char> owned; // fallback storage when mapping is impossible
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+	if (this != &other)
+	{
+		Close();
+		const bool wasOwned = !other.mapped && other.data == other.owned.data();
+		owned = std::move(other.owned);
+		data = wasOwned ? owned.data() : other.data;
+		size = other.size;
+		mapped = other.mapped;
+		modified = other.modified;
+#ifdef _WIN32
+		file = other.file;
+		mapping = other.mapping;
+		other.file = INVALID_HANDLE_VALUE;
+		other.mapping = nullptr;
+#else
+		fd = other.fd;
+		other.fd = -1;
+#endif
+		other.data = nullptr;
+		other.size = 0;
+		other.mapped = false;
+	}
+	return *this;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (mapped)
+		::UnmapViewOfFile(data);
+	if (mapping)
+		::CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		::CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	mapping = nullptr;
+#else
+	if (mapped)
+		::munmap(const_cast<char*>(data), size);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+	owned.clear();
+	data = nullptr;
+	size = 0;
+	mapped = false;
+	modified = 0;
+}
+
+bool MappedFile::Open(const char* fileName)
+{
+	assert(fileName);
+	Close();
+
+#ifdef _WIN32
+	file = ::CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (::GetFileType(file) != FILE_TYPE_DISK || !::GetFileSizeEx(file, &fileSize))
+		return ReadDescriptor();
+	FILETIME written;
+	if (::GetFileTime(file, nullptr, nullptr, &written))
+		modified = ((static_cast<int64_t>(written.dwHighDateTime) << 32) | written.dwLowDateTime) * 100;
+	if (!fileSize.QuadPart)
+		return true;
+
+	mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping ? ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+		return ReadDescriptor();
+	data = static_cast<const char*>(view);
+	size = static_cast<size_t>(fileSize.QuadPart);
+	mapped = true;
+	return true;
+#else
+	fd = ::open(fileName, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+		return ReadDescriptor();
+#ifdef __APPLE__
+	modified = static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+	modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+	if (!info.st_size)
+		return true;
+
+	void* view = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+		return ReadDescriptor();
+	::madvise(view, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+	data = static_cast<const char*>(view);
+	size = static_cast<size_t>(info.st_size);
+	mapped = true;
+	return true;
+#endif
+}
+
+// fallback for anything that cannot be mapped; false if a read failed,
+// nothing of the input is kept then
+bool MappedFile::ReadDescriptor()
+{
+	char chunk[64 * 1024];
+	for (;;)
+	{
+#ifdef _WIN32
+		DWORD count = 0;
+		if (!::ReadFile(file, chunk, sizeof(chunk), &count, nullptr))
+		{
+			// the end of a pipe is an error to ReadFile
+			if (::GetLastError() == ERROR_BROKEN_PIPE)
+				break;
+			Close();
+			return false;
+		}
+#else
+		const ssize_t count = ::read(fd, chunk, sizeof(chunk));
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+		{
+			Close();
+			return false;
+		}
+#endif
+		if (!count)
+			break;
+		owned.insert(owned.end(), chunk, chunk + count);
+	}
+	data = owned.data();
+	size = owned.size();
+	return true;
+}
+
+#endif
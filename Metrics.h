@@ -0,0 +1,255 @@
+#ifndef _0FF57DCB_7FBD_450E_A4AE_50E8F75D4731_
+#define  _0FF57DCB_7FBD_450E_A4AE_50E8F75D4731_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include "TextEncoding.h"
+
+// Optional counters of the hot path: wall time per stage, bytes in and out,
+// decoded units, lines, malformed sequences, what the detector decided and
+// which of its checks decided it.
+// Compiled in with UNICODE_TEST_METRICS=1; without it every call below is an
+// empty inline function and the clock is never read.
+//
+// Stage time is exclusive: a Stage scope opened inside another one (the line
+// splitter called from the decoder's sink) pauses the outer stage, so the
+// stages add up to the instrumented wall time. Counters are process wide and
+// relaxed atomics; callers add per file or per block, not per character.
+#ifndef UNICODE_TEST_METRICS
+#define UNICODE_TEST_METRICS 0
+#endif
+
+namespace metrics
+{
+
+const bool Enabled = UNICODE_TEST_METRICS != 0;
+
+enum class Stage { Read, Detect, Decode, Normalize, Split, Statistics, Output };
+const size_t StageCount = 7;
+
+enum class Counter { Files, BytesIn, BytesOut, UnitsOut, Lines, Malformed };
+const size_t CounterCount = 6;
+
+inline const char* StageName(Stage stage)
+{
+	static const char* const names[StageCount] = { "read", "detect", "decode", "normalize", "split", "statistics", "output" };
+	return names[static_cast<size_t>(stage)];
+}
+
+inline const char* CounterName(Counter counter)
+{
+	static const char* const names[CounterCount] = { "files", "bytes_in", "bytes_out", "units_out", "lines", "malformed_sequences" };
+	return names[static_cast<size_t>(counter)];
+}
+
+const TextEncoding Encodings[] = { TextEncoding::Ansi, TextEncoding::UTF8, TextEncoding::UTF16LE, TextEncoding::UTF16BE, TextEncoding::UTF32LE, TextEncoding::UTF32BE,
+	TextEncoding::Windows1250, TextEncoding::Windows1251, TextEncoding::Windows1252 };
+const size_t EncodingCount = sizeof(Encodings) / sizeof(Encodings[0]);
+
+inline size_t EncodingIndex(TextEncoding encoding)
+{
+	for (size_t i = 0; i < EncodingCount; ++i)
+	{
+		if (Encodings[i] == encoding)
+			return i;
+	}
+	return 0;
+}
+
+struct Registry
+{
+	std::atomic<uint64_t> stageNanos[StageCount];
+	std::atomic<uint64_t> counters[CounterCount];
+	std::atomic<uint64_t> detections[EncodingCount];
+	std::atomic<uint64_t> confidenceSum[EncodingCount];
+	std::atomic<uint64_t> prefilters[PrefilterCount];
+};
+
+inline Registry& Global()
+{
+	static Registry registry = {};
+	return registry;
+}
+
+inline void Add(Counter counter, uint64_t count)
+{
+	if (Enabled)
+		Global().counters[static_cast<size_t>(counter)].fetch_add(count, std::memory_order_relaxed);
+}
+
+inline void Detected(const DetectionResult& detected)
+{
+	if (!Enabled)
+		return;
+	const size_t i = EncodingIndex(detected.encoding);
+	Global().detections[i].fetch_add(1, std::memory_order_relaxed);
+	Global().confidenceSum[i].fetch_add(static_cast<uint64_t>(detected.confidence), std::memory_order_relaxed);
+}
+
+inline void Prefiltered(Prefilter prefilter)
+{
+	if (Enabled)
+		Global().prefilters[static_cast<size_t>(prefilter)].fetch_add(1, std::memory_order_relaxed);
+}
+
+// charges the time until it is destroyed to stage, minus nested scopes
+class ScopedStage
+{
+public:
+	explicit ScopedStage(Stage stage)
+	{
+		if (!Enabled)
+			return;
+		State& state = ThreadState();
+		const Clock::time_point now = Clock::now();
+		if (state.current >= 0)
+			Charge(state.current, now - state.since);
+		previous = state.current;
+		state.current = static_cast<int>(stage);
+		state.since = now;
+	}
+	ScopedStage(const ScopedStage&) = delete;
+	ScopedStage& operator=(const ScopedStage&) = delete;
+
+	~ScopedStage()
+	{
+		if (!Enabled)
+			return;
+		State& state = ThreadState();
+		const Clock::time_point now = Clock::now();
+		Charge(state.current, now - state.since);
+		state.current = previous;
+		state.since = now;
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct State
+	{
+		int current = -1; // stage being timed on this thread, -1 for none
+		Clock::time_point since;
+	};
+
+	static State& ThreadState()
+	{
+		thread_local State state;
+		return state;
+	}
+
+	static void Charge(int stage, Clock::duration elapsed)
+	{
+		const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		Global().stageNanos[stage].fetch_add(static_cast<uint64_t>(nanos), std::memory_order_relaxed);
+	}
+
+	int previous = -1;
+};
+
+enum class Format { None, Json, Prometheus };
+
+// "json" or "prometheus"; false for anything else
+inline bool ParseFormat(const char* name, Format& format)
+{
+	if (!std::strcmp(name, "json"))
+		format = Format::Json;
+	else if (!std::strcmp(name, "prometheus"))
+		format = Format::Prometheus;
+	else
+		return false;
+	return true;
+}
+
+inline double Seconds(Stage stage)
+{
+	return Global().stageNanos[static_cast<size_t>(stage)].load(std::memory_order_relaxed) / 1e9;
+}
+
+inline uint64_t Value(Counter counter)
+{
+	return Global().counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+}
+
+inline void WriteJson(std::ostream& out)
+{
+	out << "{\n  \"stage_seconds\": {";
+	for (size_t i = 0; i < StageCount; ++i)
+		out << (i ? ", " : " ") << '"' << StageName(static_cast<Stage>(i)) << "\": " << std::fixed << std::setprecision(9) << Seconds(static_cast<Stage>(i));
+	out << " },\n";
+	for (size_t i = 0; i < CounterCount; ++i)
+		out << "  \"" << CounterName(static_cast<Counter>(i)) << "\": " << Value(static_cast<Counter>(i)) << ",\n";
+	out << "  \"detections\": {";
+	bool first = true;
+	for (size_t i = 0; i < EncodingCount; ++i)
+	{
+		const uint64_t files = Global().detections[i].load(std::memory_order_relaxed);
+		if (!files)
+			continue;
+		const double confidence = static_cast<double>(Global().confidenceSum[i].load(std::memory_order_relaxed)) / files;
+		out << (first ? " " : ", ") << '"' << EncodingName(Encodings[i]) << "\": { \"files\": " << files
+			<< ", \"mean_confidence\": " << std::setprecision(1) << confidence << " }";
+		first = false;
+	}
+	out << " },\n  \"prefilter\": {";
+	for (size_t i = 0; i < PrefilterCount; ++i)
+		out << (i ? ", " : " ") << '"' << PrefilterName(static_cast<Prefilter>(i)) << "\": " << Global().prefilters[i].load(std::memory_order_relaxed);
+	out << " }\n}\n";
+}
+
+// text exposition format, one family per stage time / counter / detection
+inline void WritePrometheus(std::ostream& out)
+{
+	out << "# HELP unicode_test_stage_seconds_total Wall time spent in each stage.\n"
+		"# TYPE unicode_test_stage_seconds_total counter\n";
+	for (size_t i = 0; i < StageCount; ++i)
+		out << "unicode_test_stage_seconds_total{stage=\"" << StageName(static_cast<Stage>(i)) << "\"} "
+			<< std::fixed << std::setprecision(9) << Seconds(static_cast<Stage>(i)) << '\n';
+	for (size_t i = 0; i < CounterCount; ++i)
+	{
+		const char* name = CounterName(static_cast<Counter>(i));
+		out << "# TYPE unicode_test_" << name << "_total counter\n"
+			<< "unicode_test_" << name << "_total " << Value(static_cast<Counter>(i)) << '\n';
+	}
+	out << "# HELP unicode_test_detections_total Inputs by detected encoding.\n"
+		"# TYPE unicode_test_detections_total counter\n";
+	for (size_t i = 0; i < EncodingCount; ++i)
+		out << "unicode_test_detections_total{encoding=\"" << EncodingName(Encodings[i]) << "\"} " << Global().detections[i].load(std::memory_order_relaxed) << '\n';
+	out << "# HELP unicode_test_detection_confidence_sum Sum of the detection confidences (0..100) by encoding.\n"
+		"# TYPE unicode_test_detection_confidence_sum counter\n";
+	for (size_t i = 0; i < EncodingCount; ++i)
+		out << "unicode_test_detection_confidence_sum{encoding=\"" << EncodingName(Encodings[i]) << "\"} " << Global().confidenceSum[i].load(std::memory_order_relaxed) << '\n';
+	out << "# HELP unicode_test_prefilter_total Detections by the native check that settled them.\n"
+		"# TYPE unicode_test_prefilter_total counter\n";
+	for (size_t i = 0; i < PrefilterCount; ++i)
+		out << "unicode_test_prefilter_total{check=\"" << PrefilterName(static_cast<Prefilter>(i)) << "\"} " << Global().prefilters[i].load(std::memory_order_relaxed) << '\n';
+}
+
+// writes everything recorded so far when it goes out of scope
+class Report
+{
+public:
+	Report(Format format, std::ostream& out) : format(format), out(out) {}
+	Report(const Report&) = delete;
+	Report& operator=(const Report&) = delete;
+
+	~Report()
+	{
+		if (format == Format::Json)
+			WriteJson(out);
+		else if (format == Format::Prometheus)
+			WritePrometheus(out);
+	}
+
+private:
+	Format format;
+	std::ostream& out;
+};
+
+} // namespace metrics
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef _2D2FB0A3_6B71_4C0E_8C6F_21FAF0742E17_
+#define  _2D2FB0A3_6B71_4C0E_8C6F_21FAF0742E17_
+
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "Dispatch.h"
+#include "UnicodeTables.h"
+
+// Unicode normalization (NFC, NFD) and simple case folding of decoded UTF-16,
+// as a stage between the decoder and the line splitter: each block is worked
+// on while it is still in the cache, instead of in a pass of its own over the
+// lines.
+//
+// Most text is in the form already. A quick check skips the units below a
+// limit with a vector kernel (no character there changes) and looks the
+// others up in UnicodeTables.h; only the stretch between the stable
+// characters around one that may change (NFC_QC No or Maybe, NFD_QC No, a
+// combining class out of order, a folding character) goes through
+// decomposition, reordering and composition. A stable character has class 0
+// and quick check Yes, nothing before it interacts with anything after it.
+// The text from the last one in a block is held back for the next block.
+//
+// Folding is applied to the normalized text, as normalizing first and then
+// folding does. Unpaired surrogates go through unchanged.
+enum class NormalForm
+{
+	None,
+	NFC,
+	NFD
+};
+
+inline const char* NormalFormName(NormalForm form)
+{
+	switch (form)
+	{
+	case NormalForm::NFC: return "nfc";
+	case NormalForm::NFD: return "nfd";
+	default: return "none";
+	}
+}
+
+// the names of NormalFormName; false for anything else
+inline bool ParseNormalForm(const char* name, NormalForm& form)
+{
+	const NormalForm forms[] = { NormalForm::None, NormalForm::NFC, NormalForm::NFD };
+	for (const NormalForm candidate : forms)
+	{
+		if (std::strcmp(name, NormalFormName(candidate)) == 0)
+		{
+			form = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace normalization
+{
+
+// the bits of unicode_tables::PropertyBlocks
+const uint16_t CombiningClassMask = 0xFF;
+const uint16_t NfdNo = 0x100;
+const uint16_t NfcNo = 0x200;
+const uint16_t NfcMaybe = 0x400;
+const uint16_t Folds = 0x800;
+
+// Hangul syllables are composed from their jamo by arithmetic
+const char32_t SBase = 0xAC00, LBase = 0x1100, VBase = 0x1161, TBase = 0x11A7;
+const char32_t LCount = 19, VCount = 21, TCount = 28;
+const char32_t SCount = LCount * VCount * TCount;
+
+inline uint16_t Properties(char32_t cp)
+{
+	using namespace unicode_tables;
+	if (cp >= 0x110000)
+		return 0;
+	const size_t block = PropertyIndex[cp >> PropertyBlockBits];
+	return PropertyBlocks[(block << PropertyBlockBits) | (cp & ((1u << PropertyBlockBits) - 1))];
+}
+
+inline uint32_t CombiningClass(char32_t cp)
+{
+	return Properties(cp) & CombiningClassMask;
+}
+
+inline char32_t SimpleFold(char32_t cp)
+{
+	if (cp < 0x80)
+		return cp - 'A' < 26 ? cp + 0x20 : cp;
+	if (!(Properties(cp) & Folds))
+		return cp;
+	using unicode_tables::CaseFolds;
+	const auto found = std::lower_bound(std::begin(CaseFolds), std::end(CaseFolds), cp,
+		[](const unicode_tables::CaseFold& entry, char32_t key) { return entry.codePoint < key; });
+	assert(found != std::end(CaseFolds) && found->codePoint == cp);
+	return found->folded;
+}
+
+// appends the full canonical decomposition of cp
+inline void Decompose(char32_t cp, std::vector<char32_t>& out)
+{
+	if (cp - SBase < SCount)
+	{
+		const char32_t index = cp - SBase;
+		out.push_back(LBase + index / (VCount * TCount));
+		out.push_back(VBase + index % (VCount * TCount) / TCount);
+		if (index % TCount)
+			out.push_back(TBase + index % TCount);
+		return;
+	}
+	if (!(Properties(cp) & NfdNo))
+	{
+		out.push_back(cp);
+		return;
+	}
+	using unicode_tables::Decompositions;
+	const auto found = std::lower_bound(std::begin(Decompositions), std::end(Decompositions), cp,
+		[](const unicode_tables::Decomposition& entry, char32_t key) { return entry.codePoint < key; });
+	assert(found != std::end(Decompositions) && found->codePoint == cp);
+	const char32_t* data = unicode_tables::DecompositionData + found->offset;
+	out.insert(out.end(), data, data + found->length);
+}
+
+// the primary composite of a pair, false if there is none
+inline bool ComposePair(char32_t first, char32_t second, char32_t& composite)
+{
+	if (first - LBase < LCount && second - VBase < VCount)
+	{
+		composite = SBase + ((first - LBase) * VCount + second - VBase) * TCount;
+		return true;
+	}
+	if (first - SBase < SCount && !((first - SBase) % TCount) && second - TBase - 1 < TCount - 1)
+	{
+		composite = first + second - TBase;
+		return true;
+	}
+	using unicode_tables::Compositions;
+	const auto found = std::lower_bound(std::begin(Compositions), std::end(Compositions), std::make_pair(first, second),
+		[](const unicode_tables::Composition& entry, const std::pair<char32_t, char32_t>& key)
+		{
+			return entry.first < key.first || (entry.first == key.first && entry.second < key.second);
+		});
+	if (found == std::end(Compositions) || found->first != first || found->second != second)
+		return false;
+	composite = found->composite;
+	return true;
+}
+
+// canonical ordering: a stable sort of every run of non-starters by class
+inline void Reorder(std::vector<char32_t>& text)
+{
+	for (size_t i = 1; i < text.size(); ++i)
+	{
+		const char32_t cp = text[i];
+		const uint32_t ccc = CombiningClass(cp);
+		if (!ccc)
+			continue;
+		size_t j = i;
+		for (; j > 0 && CombiningClass(text[j - 1]) > ccc; --j)
+			text[j] = text[j - 1];
+		text[j] = cp;
+	}
+}
+
+// canonical composition of decomposed, ordered text, in place
+inline void Compose(std::vector<char32_t>& text)
+{
+	if (text.empty())
+		return;
+	size_t starter = 0;
+	bool haveStarter = !CombiningClass(text[0]);
+	// a non-starter in front never composes
+	uint32_t lastClass = haveStarter ? 0 : 256;
+	size_t kept = 1;
+	for (size_t i = 1; i < text.size(); ++i)
+	{
+		const char32_t cp = text[i];
+		const uint32_t ccc = CombiningClass(cp);
+		char32_t composite;
+		// not blocked: nothing in between, or only marks of a lower class
+		if (haveStarter && (lastClass < ccc || !lastClass) && ComposePair(text[starter], cp, composite))
+		{
+			text[starter] = composite;
+			continue;
+		}
+		if (!ccc)
+		{
+			starter = kept;
+			haveStarter = true;
+		}
+		lastClass = ccc;
+		text[kept++] = cp;
+	}
+	text.resize(kept);
+}
+
+} // namespace normalization
+
+// NormalForm and folding over a stream of UTF-16 blocks; CharT holds UTF-16
+// code units, as the decoders write them. Push hands the sink ranges into the
+// pushed block where nothing changed and ranges of its own buffer otherwise;
+// Finish the text held back at the end.
+template<typename CharT>
+class TextNormalizer
+{
+public:
+	// held back text this long is normalized without waiting for a stable
+	// character (Stream-Safe text has one every 32 code points)
+	static const size_t MaxCarry = 256;
+
+	explicit TextNormalizer(NormalForm form = NormalForm::None, bool fold = false) { Reset(form, fold); }
+
+	// start over, for another text
+	void Reset(NormalForm form, bool fold)
+	{
+		this->form = form;
+		this->fold = fold;
+		const uint16_t formFlags = form == NormalForm::NFC ? normalization::NfcNo | normalization::NfcMaybe
+			: form == NormalForm::NFD ? normalization::NfdNo : 0;
+		quickMask = formFlags | (fold ? normalization::Folds : 0);
+		// without a form every character is a boundary
+		boundaryMask = form == NormalForm::None ? 0 : formFlags | normalization::CombiningClassMask;
+		// nothing below U+0300 changes in NFC, below U+00C0 in NFD, below
+		// U+0080 but A..Z when folding
+		fastLimit = fold || form == NormalForm::None ? 0x80 : form == NormalForm::NFC ? 0x300 : 0xC0;
+		carry.clear();
+		out.clear();
+	}
+
+	// false: Push passes the text through as it is
+	bool Enabled() const { return form != NormalForm::None || fold; }
+
+	// sink(const CharT* begin, const CharT* end), valid during the call
+	template<typename Sink>
+	void Push(const CharT* begin, const CharT* end, Sink&& sink)
+	{
+		const CharT* p = begin;
+		if (!carry.empty())
+		{
+			// the held back text up to the first boundary of this block
+			if (IsHighSurrogate(carry.back()) && p != end && IsLowSurrogate(*p))
+				carry.push_back(*p++);
+			const CharT* boundary = NextBoundary(p, end);
+			carry.insert(carry.end(), p, boundary);
+			if (boundary == end && carry.size() < MaxCarry)
+				return;
+			Normalize(carry.data(), carry.data() + carry.size());
+			carry.clear();
+			p = boundary;
+		}
+
+		const CharT* clean = p;  // [clean, stable) is in the form already
+		const CharT* stable = p; // the last boundary
+		uint32_t lastClass = 0;
+		while (p != end)
+		{
+			if (static_cast<uint32_t>(*p) < fastLimit)
+			{
+				p = simd::SkipBelow(p, end, fastLimit);
+				stable = p - 1;
+				lastClass = 0;
+				if (p == end)
+					break;
+			}
+			size_t length;
+			const char32_t cp = CodePointAt(p, end, length);
+			if (!length)
+				break; // the other half of the pair is in the next block
+			const uint16_t properties = normalization::Properties(cp);
+			const uint32_t ccc = properties & normalization::CombiningClassMask;
+			if (!(properties & quickMask) && (!ccc || ccc >= lastClass || form == NormalForm::None))
+			{
+				if (!(properties & boundaryMask))
+					stable = p;
+				lastClass = ccc;
+				p += length;
+				continue;
+			}
+
+			// from the boundary in front to the one behind
+			Pass(clean, stable, sink);
+			clean = stable;
+			const CharT* segmentEnd = NextBoundary(p + length, end);
+			if (segmentEnd == end)
+				break;
+			Normalize(stable, segmentEnd);
+			p = clean = stable = segmentEnd;
+			lastClass = 0;
+		}
+		Pass(clean, stable, sink);
+		carry.assign(stable, end);
+		Flush(sink);
+	}
+
+	// end of input: the text held back
+	template<typename Sink>
+	void Finish(Sink&& sink)
+	{
+		if (!carry.empty())
+			Normalize(carry.data(), carry.data() + carry.size());
+		carry.clear();
+		Flush(sink);
+	}
+
+private:
+	static bool IsHighSurrogate(CharT unit) { return (static_cast<uint32_t>(unit) & 0xFC00) == 0xD800; }
+	static bool IsLowSurrogate(CharT unit) { return (static_cast<uint32_t>(unit) & 0xFC00) == 0xDC00; }
+
+	// the code point at p and its units; 0 units for a high surrogate at end
+	static char32_t CodePointAt(const CharT* p, const CharT* end, size_t& length)
+	{
+		const char32_t unit = static_cast<char32_t>(*p);
+		length = 1;
+		if (!IsHighSurrogate(*p))
+			return unit;
+		if (p + 1 == end)
+		{
+			length = 0;
+			return unit;
+		}
+		if (!IsLowSurrogate(p[1]))
+			return unit;
+		length = 2;
+		return 0x10000 + ((unit - 0xD800) << 10) + (static_cast<char32_t>(p[1]) - 0xDC00);
+	}
+
+	// first character from p on that nothing in front of it interacts with
+	const CharT* NextBoundary(const CharT* p, const CharT* end) const
+	{
+		while (p != end)
+		{
+			if (static_cast<uint32_t>(*p) < fastLimit)
+				return p;
+			size_t length;
+			const char32_t cp = CodePointAt(p, end, length);
+			if (!length)
+				return end;
+			if (!(normalization::Properties(cp) & boundaryMask))
+				return p;
+			p += length;
+		}
+		return end;
+	}
+
+	// text that is in the form: to the sink as it is, unless folding or
+	// behind text in the buffer
+	template<typename Sink>
+	void Pass(const CharT* begin, const CharT* end, Sink& sink)
+	{
+		if (begin == end)
+			return;
+		if (!fold && out.empty())
+		{
+			sink(begin, end);
+			return;
+		}
+		if (!fold)
+		{
+			out.insert(out.end(), begin, end);
+			return;
+		}
+		// only A..Z of these fold, the others were checked
+		const size_t size = out.size();
+		out.resize(size + (end - begin));
+		simd::FoldAscii(begin, end, out.data() + size);
+	}
+
+	template<typename Sink>
+	void Flush(Sink& sink)
+	{
+		if (!out.empty())
+			sink(out.data(), out.data() + out.size());
+		out.clear();
+	}
+
+	// [begin, end) normalized and folded into the buffer
+	void Normalize(const CharT* begin, const CharT* end)
+	{
+		text.clear();
+		while (begin != end)
+		{
+			size_t length;
+			const char32_t cp = CodePointAt(begin, end, length);
+			length = std::max<size_t>(length, 1);
+			if (form == NormalForm::None)
+				text.push_back(cp);
+			else
+				normalization::Decompose(cp, text);
+			begin += length;
+		}
+		if (form != NormalForm::None)
+			normalization::Reorder(text);
+		if (form == NormalForm::NFC)
+			normalization::Compose(text);
+		for (char32_t cp : text)
+		{
+			if (fold)
+				cp = normalization::SimpleFold(cp);
+			if (cp < 0x10000)
+				out.push_back(static_cast<CharT>(cp));
+			else
+			{
+				out.push_back(static_cast<CharT>(0xD800 + ((cp - 0x10000) >> 10)));
+				out.push_back(static_cast<CharT>(0xDC00 + ((cp - 0x10000) & 0x3FF)));
+			}
+		}
+	}
+
+	NormalForm form;
+	bool fold;
+	uint16_t quickMask;
+	uint16_t boundaryMask;
+	uint32_t fastLimit;
+	std::vector<CharT> carry;   // from the last boundary of the previous block
+	std::vector<CharT> out;     // what changed, and everything pushed after it
+	std::vector<char32_t> text; // code points of the segment in Normalize
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef _C2A84E1F_0B96_4F3D_9D57_6E18A3B70C52_
+#define  _C2A84E1F_0B96_4F3D_9D57_6E18A3B70C52_
+
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "DecodeError.h"
+#include "Decoder.h"
+#include "StreamingDecoder.h"
+#include "TextEncoding.h"
+#include "WorkStealingPool.h"
+
+// the unit after the next line feed at or after p, or end; p is on a unit
+// boundary of the encoding
+inline const char* AfterLineFeed(TextEncoding encoding, const char* p, const char* end)
+{
+	size_t unit = 1;
+	size_t lowByte = 0;
+	switch (encoding)
+	{
+	case TextEncoding::UTF16LE: unit = 2; break;
+	case TextEncoding::UTF16BE: unit = 2; lowByte = 1; break;
+	case TextEncoding::UTF32LE: unit = 4; break;
+	case TextEncoding::UTF32BE: unit = 4; lowByte = 3; break;
+	default:
+		p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		return p ? p + 1 : end;
+	}
+
+	for (; static_cast<size_t>(end - p) >= unit; p += unit)
+	{
+		bool lineFeed = p[lowByte] == '\n';
+		for (size_t i = 0; i < unit && lineFeed; ++i)
+			lineFeed = i == lowByte || !p[i];
+		if (lineFeed)
+			return p + unit;
+	}
+	return end;
+}
+
+// Decodes one large in-memory input (a MappedFile) on all cores. The input is
+// cut into chunks that each start on a character boundary of the encoding: not
+// on a UTF-8 continuation byte, not inside a UTF-16 / UTF-32 unit and not
+// between the halves of a surrogate pair; optionally right after a line feed.
+// A window of chunks is decoded in parallel, then handed to the sink in input
+// order, so the sink sees exactly what a StreamingDecoder would produce and
+// memory stays at a few chunks per thread.
+//
+// The chunk decode restarts at every boundary. That is only equivalent to one
+// sequential run because a sequential decoder can never be in the middle of a
+// character at such a boundary: the first chunk that does not decode to its
+// very end is where the sequential run fails too.
+//
+// Codec works as for StreamingDecoder: a Decoder<E> or the default
+// DynamicDecoder. With the Replace and Skip policies a chunk boundary never
+// falls inside a maximal subpart the sequential run would replace in one go,
+// so the output is the same as well; the kind of an error at a boundary may
+// read "truncated" where the sequential run names the byte that follows.
+template<typename CharT, typename Codec = DynamicDecoder<CharT>>
+class ParallelDecoder
+{
+public:
+	static const size_t DefaultChunkSize = 1024 * 1024;
+
+	// threads == 0: one per hardware thread
+	explicit ParallelDecoder(const Codec& codec, size_t threads = 0, size_t chunkSize = DefaultChunkSize, bool lineBoundaries = false)
+		: pool(threads), decoders(pool.Size(), StreamingDecoder<CharT, Codec>(codec)), window(2 * pool.Size()),
+		encoding(codec.Encoding()), chunkSize(chunkSize), lineBoundaries(lineBoundaries)
+	{
+		assert(chunkSize >= 16);
+	}
+
+	// smaller inputs are decoded faster by one StreamingDecoder
+	static bool IsWorthwhile(size_t size) { return size >= 4 * DefaultChunkSize; }
+
+	void Reset(const Codec& codec)
+	{
+		encoding = codec.Encoding();
+		for (auto& decoder : decoders)
+			decoder.Reset(codec);
+	}
+
+	void SetErrorPolicy(ErrorPolicy policy)
+	{
+		for (auto& decoder : decoders)
+			decoder.SetErrorPolicy(policy);
+	}
+
+	// decodes the whole [begin, end); false at the first malformed byte, with
+	// everything decoded in front of it passed to the sink
+	template<typename Sink>
+	inline bool Decode(const char* begin, const char* end, Sink&& sink);
+
+	bool Failed() const { return failed; }
+
+	// input bytes decoded, the offset of the bad bytes after a failure
+	uint64_t Consumed() const { return consumed; }
+
+	// as for StreamingDecoder, offsets from the begin of the whole input
+	uint64_t ErrorCount() const { return errorCount; }
+	const std::vector<DecodeError>& Errors() const { return errors; }
+
+private:
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		std::vector<CharT> units;
+		bool ok;
+		uint64_t consumed;
+		uint64_t errorCount;
+		std::vector<DecodeError> errors; // offsets from the chunk begin
+	};
+
+	inline const char* Boundary(const char* begin, const char* p, const char* end) const;
+
+	WorkStealingPool pool;
+	std::vector<StreamingDecoder<CharT, Codec>> decoders; // one per worker
+	std::vector<Chunk> window;
+	TextEncoding encoding; // of the codec, for the boundary rules
+	size_t chunkSize;
+	bool lineBoundaries;
+	uint64_t consumed = 0;
+	bool failed = false;
+	uint64_t errorCount = 0;
+	std::vector<DecodeError> errors;
+};
+
+
+template<typename CharT, typename Codec>
+template<typename Sink>
+bool ParallelDecoder<CharT, Codec>::Decode(const char* begin, const char* end, Sink&& sink)
+{
+	assert(begin <= end);
+	consumed = 0;
+	failed = false;
+	errorCount = 0;
+	errors.clear();
+
+	const char* p = begin;
+	while (p != end && !failed)
+	{
+		size_t count = 0;
+		for (; count < window.size() && p != end; ++count)
+		{
+			window[count].begin = p;
+			p = static_cast<size_t>(end - p) > chunkSize ? Boundary(begin, p + chunkSize, end) : end;
+			window[count].end = p;
+		}
+
+		pool.ForEach(count, [this](size_t index, size_t worker)
+		{
+			Chunk& chunk = window[index];
+			StreamingDecoder<CharT, Codec>& decoder = decoders[worker];
+			auto append = [&chunk](const CharT* begin, const CharT* end)
+			{
+				chunk.units.insert(chunk.units.end(), begin, end);
+			};
+			chunk.units.clear();
+			decoder.Reset();
+			chunk.ok = decoder.Feed(chunk.begin, chunk.end, append) && decoder.Finish(append);
+			chunk.consumed = decoder.Consumed();
+			chunk.errorCount = decoder.ErrorCount();
+			chunk.errors = decoder.Errors();
+		});
+
+		// stitch in order, stop at the first chunk with an error
+		for (size_t i = 0; i < count && !failed; ++i)
+		{
+			const Chunk& chunk = window[i];
+			if (!chunk.units.empty())
+				sink(chunk.units.data(), chunk.units.data() + chunk.units.size());
+			const uint64_t base = chunk.begin - begin;
+			for (const DecodeError& error : chunk.errors)
+			{
+				if (errors.size() < StreamingDecoder<CharT, Codec>::MaxRecordedErrors)
+					errors.push_back({ base + error.offset, error.kind });
+			}
+			errorCount += chunk.errorCount;
+			consumed += chunk.consumed;
+			failed = !chunk.ok;
+		}
+	}
+	return !failed;
+}
+
+// first character boundary at or after p (before it for UTF-16 / UTF-32 units)
+template<typename CharT, typename Codec>
+const char* ParallelDecoder<CharT, Codec>::Boundary(const char* begin, const char* p, const char* end) const
+{
+	switch (encoding)
+	{
+	case TextEncoding::UTF8:
+		while (p != end && (static_cast<unsigned char>(*p) & 0xC0) == 0x80)
+			++p;
+		break;
+	case TextEncoding::UTF16LE:
+	case TextEncoding::UTF16BE:
+	{
+		p -= (p - begin) % 2;
+		if (end - p < 2)
+			break;
+		const auto s = reinterpret_cast<const unsigned char*>(p);
+		const unsigned high = encoding == TextEncoding::UTF16LE ? s[1] : s[0];
+		// low surrogate: the cut moves past it, the pair stays in the
+		// earlier chunk
+		if ((high & 0xFC) == 0xDC)
+			p += 2;
+		break;
+	}
+	case TextEncoding::UTF32LE:
+	case TextEncoding::UTF32BE:
+		p -= (p - begin) % 4;
+		break;
+	default:
+		break;
+	}
+	return lineBoundaries ? AfterLineFeed(encoding, p, end) : p;
+}
+
+#endif
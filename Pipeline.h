@@ -0,0 +1,80 @@
+#ifndef _E47B9C25_3A1D_4F86_A0C3_9D52B8E16F04_
+#define  _E47B9C25_3A1D_4F86_A0C3_9D52B8E16F04_
+
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include "CodePages.h"
+#include "TextEncoding.h"
+#include "DetectorBackend.h"
+#include "EncodingCandidate.h"
+#include "FastEncodingDetect.h"
+#include "Metrics.h"
+
+// Steps shared by the single file dump and the batch mode.
+
+// how many leading bytes the dump shows before the text; detection reads as
+// far as ProgressiveDetector needs
+const size_t SniffSize = 1024;
+
+// BOM first, then the native detector on a growing window, the selected
+// DetectorBackend for what stays ambiguous and for the code page of single
+// byte text, which the native detector cannot tell. Pass all the bytes at
+// hand, the detector stops as soon as it is sure.
+inline DetectionResult DetectEncoding(const char* begin, const char* end)
+{
+	assert(begin != nullptr);
+	assert(end != nullptr);
+	assert(begin <= end);
+
+	// BOM, zero pattern, 7-bit and UTF-8 checks settle most input without a
+	// backend; metrics count which one did. A BOM is sure, the backend is
+	// never asked about it.
+	ProgressiveDetector detector;
+	DetectionResult detected = detector.Detect(begin, end);
+	metrics::Prefiltered(detector.Settled());
+	if (detected.confidence < FastEncodeDetector::ConfidentThreshold)
+		ThreadDetectorBackend().Refine(begin, begin + detector.Examined(), detected);
+	else if (detected.encoding == TextEncoding::Ansi)
+	{
+		// sure it is single byte: only a code page is taken from the backend
+		DetectionResult refined = detected;
+		ThreadDetectorBackend().Refine(begin, begin + detector.Examined(), refined);
+		if (IsSingleByte(refined.encoding))
+			detected.encoding = refined.encoding;
+	}
+	return detected;
+}
+
+// The readings DetectEncoding chooses from, best first, at most capacity of
+// them. Only input the native detector is unsure about costs a backend call
+// for all candidates: a BOM and a sure Unicode form are the one candidate,
+// and sure single byte text only asks for the code pages. The native guess
+// comes last unless a backend names the same encoding.
+inline size_t RankEncodings(const char* begin, const char* end, EncodingCandidate* candidates, size_t capacity)
+{
+	assert(begin != nullptr);
+	assert(end != nullptr);
+	assert(begin <= end);
+	assert(capacity);
+
+	ProgressiveDetector detector;
+	const DetectionResult native = detector.Detect(begin, end);
+	const EncodingCandidate guess = { native.encoding, native.confidence, 100 };
+	const bool sure = native.confidence >= FastEncodeDetector::ConfidentThreshold;
+	if (sure && native.encoding != TextEncoding::Ansi)
+	{
+		candidates[0] = guess;
+		return 1;
+	}
+
+	size_t count = ThreadDetectorBackend().Candidates(begin, begin + detector.Examined(), candidates, capacity);
+	if (sure)
+		count = std::remove_if(candidates, candidates + count, [](const EncodingCandidate& c) { return !IsSingleByte(c.encoding); }) - candidates;
+	if (count == capacity && std::none_of(candidates, candidates + count, [&guess](const EncodingCandidate& c) { return c.encoding == guess.encoding; }))
+		--count;
+	MergeCandidate(candidates, count, capacity, guess);
+	return count;
+}
+
+#endif
@@ -0,0 +1,1223 @@
+#ifndef _C9868223_ADB7_418D_990C_6C4F6214369A_
+#define  _C9868223_ADB7_418D_990C_6C4F6214369A_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Every instruction set the target architecture has is compiled in, whatever
+// the -m / /arch flags are; Dispatch.h picks one at run time. SIMD_NO_AVX512
+// leaves out the AVX-512 kernels for compilers that lack the intrinsics.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define SIMD_KERNELS_SSE42 1
+#define SIMD_KERNELS_AVX2 1
+#ifndef SIMD_NO_AVX512
+#define SIMD_KERNELS_AVX512 1
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SIMD_KERNELS_NEON 1
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// SIMD_TARGET_x ... SIMD_TARGET_END compile the functions in between for
+// instruction set x. GCC and clang need it to accept the intrinsics, MSVC
+// takes them anywhere. Only call such code after Dispatch.h has checked the CPU.
+#if defined(__clang__)
+#define SIMD_TARGET_SSE42 _Pragma("clang attribute push (__attribute__((target(\"sse4.2,popcnt\"))), apply_to = function)")
+#define SIMD_TARGET_AVX2 _Pragma("clang attribute push (__attribute__((target(\"avx2,bmi,bmi2,popcnt\"))), apply_to = function)")
+#define SIMD_TARGET_AVX512 _Pragma("clang attribute push (__attribute__((target(\"avx512f,avx512bw,avx2,bmi,bmi2,popcnt\"))), apply_to = function)")
+#define SIMD_TARGET_END _Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+// GCC 12 warns about the _mm512_undefined_* in its own AVX-512 headers
+#define SIMD_TARGET_SSE42 _Pragma("GCC push_options") _Pragma("GCC target(\"sse4.2,popcnt\")") \
+	_Pragma("GCC diagnostic push")
+#define SIMD_TARGET_AVX2 _Pragma("GCC push_options") _Pragma("GCC target(\"avx2,bmi,bmi2,popcnt\")") \
+	_Pragma("GCC diagnostic push")
+#define SIMD_TARGET_AVX512 _Pragma("GCC push_options") _Pragma("GCC target(\"avx512f,avx512bw,avx2,bmi,bmi2,popcnt\")") \
+	_Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+#define SIMD_TARGET_END _Pragma("GCC diagnostic pop") _Pragma("GCC pop_options")
+#else
+#define SIMD_TARGET_SSE42
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX512
+#define SIMD_TARGET_END
+#endif
+
+// for the decode loops that get their vector steps inlined in every target
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIMD_FORCE_INLINE __forceinline
+#else
+#define SIMD_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+// Kernels of the detector and the decode loop. Every vector variant
+// produces exactly the same answer as the scalar one, only faster.
+namespace simd
+{
+
+// wchar_t is handled through the char type of the same size
+template<typename CharT>
+struct UnitOf
+{
+	typedef typename std::conditional<sizeof(CharT) == 2, char16_t, char32_t>::type type;
+};
+
+template<typename CharT>
+inline typename UnitOf<CharT>::type* AsUnits(CharT* p)
+{
+	return reinterpret_cast<typename UnitOf<CharT>::type*>(p);
+}
+
+template<typename CharT>
+inline const typename UnitOf<CharT>::type* AsUnits(const CharT* p)
+{
+	return reinterpret_cast<const typename UnitOf<CharT>::type*>(p);
+}
+
+inline int PopCount(uint32_t v)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return static_cast<int>((((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+#else
+	return __builtin_popcount(v);
+#endif
+}
+
+inline int CountTrailingZeros(uint32_t v)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward(&index, v);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(v);
+#endif
+}
+
+inline int PopCount64(uint64_t v)
+{
+	return PopCount(static_cast<uint32_t>(v)) + PopCount(static_cast<uint32_t>(v >> 32));
+}
+
+inline int CountTrailingZeros64(uint64_t v)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	const uint32_t low = static_cast<uint32_t>(v);
+	return low ? CountTrailingZeros(low) : 32 + CountTrailingZeros(static_cast<uint32_t>(v >> 32));
+#else
+	return __builtin_ctzll(v);
+#endif
+}
+
+// the counters of CountUnitClasses
+enum UnitClass
+{
+	AsciiUnits,       // below U+0080
+	TwoByteUnits,     // U+0080..U+07FF, two bytes in UTF-8
+	SurrogateUnits,   // U+D800..U+DFFF
+	ControlUnits,     // C0, DEL and C1 controls other than tab, LF and CR
+	ReplacementUnits, // U+FFFD
+	UnitClassCount
+};
+
+namespace scalar
+{
+
+// first byte with the high bit set, or end
+inline const char* SkipAscii(const char* begin, const char* end)
+{
+	for (; end - begin >= 8; begin += 8)
+	{
+		uint64_t v;
+		std::memcpy(&v, begin, sizeof(v));
+		if (v & 0x8080808080808080ull)
+			break;
+	}
+	while (begin < end && !(static_cast<unsigned char>(*begin) & 0x80))
+		++begin;
+	return begin;
+}
+
+// counts[i] += number of zero bytes at offsets == i (mod 4) from begin
+inline void CountZeroBytes(const char* begin, const char* end, size_t (&counts)[4])
+{
+	const size_t size = end - begin;
+	for (size_t i = 0; i < size; ++i)
+		counts[i & 3] += begin[i] == 0;
+}
+
+// length of a complete and well-formed UTF-8 sequence at s, 0 otherwise
+inline size_t Utf8SequenceLength(const unsigned char* s, const unsigned char* end)
+{
+	const unsigned char lead = s[0];
+	if (lead < 0x80)
+		return 1;
+
+	size_t length;
+	unsigned char low = 0x80, high = 0xBF; // allowed range of the second byte
+	if (lead >= 0xC2 && lead <= 0xDF)
+		length = 2;
+	else if (lead >= 0xE0 && lead <= 0xEF)
+	{
+		length = 3;
+		if (lead == 0xE0) low = 0xA0;      // overlong
+		else if (lead == 0xED) high = 0x9F; // surrogates
+	}
+	else if (lead >= 0xF0 && lead <= 0xF4)
+	{
+		length = 4;
+		if (lead == 0xF0) low = 0x90;       // overlong
+		else if (lead == 0xF4) high = 0x8F; // above U+10FFFF
+	}
+	else
+		return 0;
+
+	if (static_cast<size_t>(end - s) < length)
+		return 0;
+	if (s[1] < low || s[1] > high)
+		return 0;
+	for (size_t i = 2; i < length; ++i)
+	{
+		if ((s[i] & 0xC0) != 0x80)
+			return 0;
+	}
+	return length;
+}
+
+// true if [begin, end) is a well-formed but unfinished UTF-8 sequence,
+// i.e. the data was simply cut in the middle of a character
+inline bool IsTruncatedUtf8(const char* begin, const char* end)
+{
+	const auto s = reinterpret_cast<const unsigned char*>(begin);
+	const size_t size = end - begin;
+	if (size == 0 || size > 3)
+		return false;
+
+	unsigned char padded[4] = { s[0], 0x80, 0x80, 0x80 };
+	for (size_t i = 1; i < size; ++i)
+		padded[i] = s[i];
+	// second byte range depends on the lead, so fill it with an acceptable value
+	if (size == 1)
+	{
+		if (s[0] == 0xE0) padded[1] = 0xA0;
+		else if (s[0] == 0xF0) padded[1] = 0x90;
+	}
+	const size_t length = Utf8SequenceLength(padded, padded + 4);
+	return length > size;
+}
+
+// first byte of the first sequence that is malformed or incomplete, or end
+inline const char* ValidateUtf8(const char* begin, const char* end)
+{
+	const auto e = reinterpret_cast<const unsigned char*>(end);
+	while (begin < end)
+	{
+		begin = SkipAscii(begin, end);
+		if (begin == end)
+			break;
+		const size_t length = Utf8SequenceLength(reinterpret_cast<const unsigned char*>(begin), e);
+		if (!length)
+			break;
+		begin += length;
+	}
+	return begin;
+}
+
+// start of the sequence covering pos: vector code validates whole blocks,
+// so a scalar rescan must not start in the middle of a character
+inline const char* RewindToLead(const char* begin, const char* pos)
+{
+	const char* p = pos;
+	while (p > begin && pos - p < 3 && (static_cast<unsigned char>(p[-1]) & 0xC0) == 0x80)
+		--p;
+	if (p > begin && pos - p < 4 && static_cast<unsigned char>(p[-1]) >= 0xC0)
+		--p;
+	return p;
+}
+
+// first '\n', '\r' or byte order mark (U+FEFF, or byte swapped U+FFFE)
+template<typename CharT>
+inline const CharT* FindLineBreakOrBom(const CharT* begin, const CharT* end)
+{
+	for (; begin != end; ++begin)
+	{
+		const uint32_t c = static_cast<uint32_t>(*begin);
+		if (c == '\n' || c == '\r' || c == 0xFEFF || c == 0xFFFE)
+			break;
+	}
+	return begin;
+}
+
+// first unit of limit or above; Normalizer.h skips the units below its quick
+// check limit with it
+template<typename CharT>
+inline const CharT* SkipBelow(const CharT* begin, const CharT* end, uint32_t limit)
+{
+	for (; begin != end && static_cast<uint32_t>(*begin) < limit; ++begin)
+	{
+	}
+	return begin;
+}
+
+// A..Z to a..z, every other unit as it is; out may be begin
+template<typename CharT>
+inline CharT* FoldAscii(const CharT* begin, const CharT* end, CharT* out)
+{
+	for (; begin != end; ++begin)
+		*out++ = static_cast<CharT>(*begin + ((static_cast<uint32_t>(*begin) - 'A' < 26) << 5));
+	return out;
+}
+
+// counts[c] += units of class c
+template<typename CharT>
+inline void CountUnitClasses(const CharT* begin, const CharT* end, uint64_t (&counts)[UnitClassCount])
+{
+	for (; begin != end; ++begin)
+	{
+		const uint32_t unit = static_cast<uint32_t>(*begin);
+		counts[AsciiUnits] += unit < 0x80;
+		counts[TwoByteUnits] += unit - 0x80 < 0x780;
+		counts[SurrogateUnits] += unit - 0xD800 < 0x800;
+		counts[ControlUnits] += (unit < 0x20 && unit != '\t' && unit != '\n' && unit != '\r') || unit - 0x7F < 0x21;
+		counts[ReplacementUnits] += unit == 0xFFFD;
+	}
+}
+
+} // namespace scalar
+
+// Lookup tables of the "validating UTF-8 in less than one instruction per byte"
+// algorithm (Keiser, Lemire): three nibble lookups classify every byte pair.
+namespace utf8_tables
+{
+const unsigned char TooShort = 1 << 0;
+const unsigned char TooLong = 1 << 1;
+const unsigned char Overlong3 = 1 << 2;
+const unsigned char TooLarge = 1 << 3;
+const unsigned char Surrogate = 1 << 4;
+const unsigned char Overlong2 = 1 << 5;
+const unsigned char TooLarge1000 = 1 << 6;
+const unsigned char Overlong4 = 1 << 6;
+const unsigned char TwoConts = 1 << 7;
+const unsigned char Carry = TooShort | TooLong | TwoConts;
+}
+
+#define UTF8_BYTE_1_HIGH \
+	utf8_tables::TooLong, utf8_tables::TooLong, utf8_tables::TooLong, utf8_tables::TooLong, \
+	utf8_tables::TooLong, utf8_tables::TooLong, utf8_tables::TooLong, utf8_tables::TooLong, \
+	utf8_tables::TwoConts, utf8_tables::TwoConts, utf8_tables::TwoConts, utf8_tables::TwoConts, \
+	utf8_tables::TooShort | utf8_tables::Overlong2, \
+	utf8_tables::TooShort, \
+	utf8_tables::TooShort | utf8_tables::Overlong3 | utf8_tables::Surrogate, \
+	utf8_tables::TooShort | utf8_tables::TooLarge | utf8_tables::TooLarge1000 | utf8_tables::Overlong4
+
+#define UTF8_BYTE_1_LOW \
+	utf8_tables::Carry | utf8_tables::Overlong3 | utf8_tables::Overlong2 | utf8_tables::Overlong4, \
+	utf8_tables::Carry | utf8_tables::Overlong2, \
+	utf8_tables::Carry, \
+	utf8_tables::Carry, \
+	utf8_tables::Carry | utf8_tables::TooLarge, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000 | utf8_tables::Surrogate, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000, \
+	utf8_tables::Carry | utf8_tables::TooLarge | utf8_tables::TooLarge1000
+
+#define UTF8_BYTE_2_HIGH \
+	utf8_tables::TooShort, utf8_tables::TooShort, utf8_tables::TooShort, utf8_tables::TooShort, \
+	utf8_tables::TooShort, utf8_tables::TooShort, utf8_tables::TooShort, utf8_tables::TooShort, \
+	utf8_tables::TooLong | utf8_tables::Overlong2 | utf8_tables::TwoConts | utf8_tables::Overlong3 | utf8_tables::TooLarge1000 | utf8_tables::Overlong4, \
+	utf8_tables::TooLong | utf8_tables::Overlong2 | utf8_tables::TwoConts | utf8_tables::Overlong3 | utf8_tables::TooLarge, \
+	utf8_tables::TooLong | utf8_tables::Overlong2 | utf8_tables::TwoConts | utf8_tables::Surrogate | utf8_tables::TooLarge, \
+	utf8_tables::TooLong | utf8_tables::Overlong2 | utf8_tables::TwoConts | utf8_tables::Surrogate | utf8_tables::TooLarge, \
+	utf8_tables::TooShort, utf8_tables::TooShort, utf8_tables::TooShort, utf8_tables::TooShort
+
+// bytes that must not end a block: leads of 2/3/4 byte sequences in the last 1/2/3 positions
+#define UTF8_INCOMPLETE_TAIL 0xEF, 0xDF, 0xBF
+
+#if SIMD_KERNELS_SSE42
+SIMD_TARGET_SSE42
+namespace sse42
+{
+
+inline const char* SkipAscii(const char* begin, const char* end)
+{
+	for (; end - begin >= 16; begin += 16)
+	{
+		const int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin)));
+		if (mask)
+			return begin + CountTrailingZeros(mask);
+	}
+	return scalar::SkipAscii(begin, end);
+}
+
+inline void CountZeroBytes(const char* begin, const char* end, size_t (&counts)[4])
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (; end - begin >= 16; begin += 16)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		if (!mask)
+			continue;
+		counts[0] += PopCount(mask & 0x1111);
+		counts[1] += PopCount(mask & 0x2222);
+		counts[2] += PopCount(mask & 0x4444);
+		counts[3] += PopCount(mask & 0x8888);
+	}
+	// processed length is a multiple of 16, so the phase of the tail is kept
+	scalar::CountZeroBytes(begin, end, counts);
+}
+
+inline const char* ValidateUtf8(const char* begin, const char* end)
+{
+	const __m128i byte1High = _mm_setr_epi8(UTF8_BYTE_1_HIGH);
+	const __m128i byte1Low = _mm_setr_epi8(UTF8_BYTE_1_LOW);
+	const __m128i byte2High = _mm_setr_epi8(UTF8_BYTE_2_HIGH);
+	const __m128i incompleteTail = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, UTF8_INCOMPLETE_TAIL);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+
+	__m128i previous = _mm_setzero_si128();
+	__m128i previousIncomplete = _mm_setzero_si128();
+	const char* p = begin;
+	for (; end - p >= 16; p += 16)
+	{
+		const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		if (!_mm_movemask_epi8(input))
+		{
+			if (!_mm_testz_si128(previousIncomplete, previousIncomplete))
+				break;
+			previous = input;
+			continue;
+		}
+
+		const __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+		const __m128i specialCases = _mm_and_si128(
+			_mm_and_si128(
+				_mm_shuffle_epi8(byte1High, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+				_mm_shuffle_epi8(byte1Low, _mm_and_si128(prev1, nibble))),
+			_mm_shuffle_epi8(byte2High, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+		const __m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+		const __m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+		const __m128i mustBeContinuation = _mm_and_si128(
+			_mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+				_mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80)))),
+			_mm_set1_epi8(static_cast<char>(0x80)));
+
+		const __m128i error = _mm_xor_si128(mustBeContinuation, specialCases);
+		if (!_mm_testz_si128(error, error))
+			break;
+
+		previousIncomplete = _mm_subs_epu8(input, incompleteTail);
+		previous = input;
+	}
+	// the scalar pass pinpoints the error (if any) and checks the tail
+	return scalar::ValidateUtf8(scalar::RewindToLead(begin, p), end);
+}
+
+inline const char16_t* FindLineBreakOrBom(const char16_t* begin, const char16_t* end)
+{
+	const __m128i lf = _mm_set1_epi16('\n');
+	const __m128i cr = _mm_set1_epi16('\r');
+	const __m128i bom = _mm_set1_epi16(static_cast<short>(0xFEFF));
+	const __m128i swapped = _mm_set1_epi16(static_cast<short>(0xFFFE));
+	for (; end - begin >= 8; begin += 8)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(v, lf), _mm_cmpeq_epi16(v, cr)),
+			_mm_or_si128(_mm_cmpeq_epi16(v, bom), _mm_cmpeq_epi16(v, swapped))));
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 2;
+	}
+	return scalar::FindLineBreakOrBom(begin, end);
+}
+
+inline const char32_t* FindLineBreakOrBom(const char32_t* begin, const char32_t* end)
+{
+	const __m128i lf = _mm_set1_epi32('\n');
+	const __m128i cr = _mm_set1_epi32('\r');
+	const __m128i bom = _mm_set1_epi32(0xFEFF);
+	const __m128i swapped = _mm_set1_epi32(0xFFFE);
+	for (; end - begin >= 4; begin += 4)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(v, lf), _mm_cmpeq_epi32(v, cr)),
+			_mm_or_si128(_mm_cmpeq_epi32(v, bom), _mm_cmpeq_epi32(v, swapped))));
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 4;
+	}
+	return scalar::FindLineBreakOrBom(begin, end);
+}
+
+// a unit u >= limit is u - (limit - 1) > 0 in saturating arithmetic
+inline const char16_t* SkipBelow(const char16_t* begin, const char16_t* end, uint32_t limit)
+{
+	const __m128i below = _mm_set1_epi16(static_cast<short>(limit - 1));
+	for (; end - begin >= 8; begin += 8)
+	{
+		const __m128i v = _mm_subs_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin)), below);
+		const int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_setzero_si128())) & 0xFFFF;
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 2;
+	}
+	return scalar::SkipBelow(begin, end, limit);
+}
+
+inline const char32_t* SkipBelow(const char32_t* begin, const char32_t* end, uint32_t limit)
+{
+	const __m128i below = _mm_set1_epi32(static_cast<int>(limit - 1));
+	for (; end - begin >= 4; begin += 4)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		const int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_min_epu32(v, below), v)) & 0xFFFF;
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 4;
+	}
+	return scalar::SkipBelow(begin, end, limit);
+}
+
+// a unit u in A..Z is u - 'A' <= 25 as unsigned, min(u - 'A', 25) == u - 'A'
+inline char16_t* FoldAscii(const char16_t* begin, const char16_t* end, char16_t* out)
+{
+	const __m128i a = _mm_set1_epi16('A');
+	const __m128i z = _mm_set1_epi16(25);
+	const __m128i bit = _mm_set1_epi16(0x20);
+	for (; end - begin >= 8; begin += 8, out += 8)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		const __m128i offset = _mm_sub_epi16(v, a);
+		const __m128i upper = _mm_cmpeq_epi16(_mm_min_epu16(offset, z), offset);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_add_epi16(v, _mm_and_si128(upper, bit)));
+	}
+	return scalar::FoldAscii(begin, end, out);
+}
+
+inline char32_t* FoldAscii(const char32_t* begin, const char32_t* end, char32_t* out)
+{
+	const __m128i a = _mm_set1_epi32('A');
+	const __m128i z = _mm_set1_epi32(25);
+	const __m128i bit = _mm_set1_epi32(0x20);
+	for (; end - begin >= 4; begin += 4, out += 4)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		const __m128i offset = _mm_sub_epi32(v, a);
+		const __m128i upper = _mm_cmpeq_epi32(_mm_min_epu32(offset, z), offset);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_add_epi32(v, _mm_and_si128(upper, bit)));
+	}
+	return scalar::FoldAscii(begin, end, out);
+}
+
+// all ones in the lanes where v <= limit, unsigned
+inline __m128i AtMost16(__m128i v, __m128i limit)
+{
+	return _mm_cmpeq_epi16(_mm_min_epu16(v, limit), v);
+}
+
+inline __m128i AtMost32(__m128i v, __m128i limit)
+{
+	return _mm_cmpeq_epi32(_mm_min_epu32(v, limit), v);
+}
+
+// lane counters per class, added up before they can overflow
+inline void CountUnitClasses(const char16_t* begin, const char16_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	while (end - begin >= 8)
+	{
+		__m128i lanes[UnitClassCount];
+		for (auto& lane : lanes)
+			lane = _mm_setzero_si128();
+		for (int i = 0; i < 0x7FFF && end - begin >= 8; ++i, begin += 8)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+			const __m128i layout = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(v, _mm_set1_epi16('\t')),
+				_mm_cmpeq_epi16(v, _mm_set1_epi16('\n'))), _mm_cmpeq_epi16(v, _mm_set1_epi16('\r')));
+			const __m128i c0 = _mm_andnot_si128(layout, AtMost16(v, _mm_set1_epi16(0x1F)));
+			const __m128i c1 = AtMost16(_mm_sub_epi16(v, _mm_set1_epi16(0x7F)), _mm_set1_epi16(0x20));
+			lanes[AsciiUnits] = _mm_sub_epi16(lanes[AsciiUnits], AtMost16(v, _mm_set1_epi16(0x7F)));
+			lanes[TwoByteUnits] = _mm_sub_epi16(lanes[TwoByteUnits], AtMost16(_mm_sub_epi16(v, _mm_set1_epi16(0x80)), _mm_set1_epi16(0x77F)));
+			lanes[SurrogateUnits] = _mm_sub_epi16(lanes[SurrogateUnits], AtMost16(_mm_sub_epi16(v, _mm_set1_epi16(static_cast<short>(0xD800))), _mm_set1_epi16(0x7FF)));
+			lanes[ControlUnits] = _mm_sub_epi16(lanes[ControlUnits], _mm_or_si128(c0, c1));
+			lanes[ReplacementUnits] = _mm_sub_epi16(lanes[ReplacementUnits], _mm_cmpeq_epi16(v, _mm_set1_epi16(static_cast<short>(0xFFFD))));
+		}
+		for (int c = 0; c < UnitClassCount; ++c)
+		{
+			uint32_t sums[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums), _mm_madd_epi16(lanes[c], ones));
+			counts[c] += static_cast<uint64_t>(sums[0]) + sums[1] + sums[2] + sums[3];
+		}
+	}
+	scalar::CountUnitClasses(begin, end, counts);
+}
+
+inline void CountUnitClasses(const char32_t* begin, const char32_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	while (end - begin >= 4)
+	{
+		__m128i lanes[UnitClassCount];
+		for (auto& lane : lanes)
+			lane = _mm_setzero_si128();
+		for (int i = 0; i < 0x7FFF && end - begin >= 4; ++i, begin += 4)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+			const __m128i layout = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(v, _mm_set1_epi32('\t')),
+				_mm_cmpeq_epi32(v, _mm_set1_epi32('\n'))), _mm_cmpeq_epi32(v, _mm_set1_epi32('\r')));
+			const __m128i c0 = _mm_andnot_si128(layout, AtMost32(v, _mm_set1_epi32(0x1F)));
+			const __m128i c1 = AtMost32(_mm_sub_epi32(v, _mm_set1_epi32(0x7F)), _mm_set1_epi32(0x20));
+			lanes[AsciiUnits] = _mm_sub_epi32(lanes[AsciiUnits], AtMost32(v, _mm_set1_epi32(0x7F)));
+			lanes[TwoByteUnits] = _mm_sub_epi32(lanes[TwoByteUnits], AtMost32(_mm_sub_epi32(v, _mm_set1_epi32(0x80)), _mm_set1_epi32(0x77F)));
+			lanes[SurrogateUnits] = _mm_sub_epi32(lanes[SurrogateUnits], AtMost32(_mm_sub_epi32(v, _mm_set1_epi32(0xD800)), _mm_set1_epi32(0x7FF)));
+			lanes[ControlUnits] = _mm_sub_epi32(lanes[ControlUnits], _mm_or_si128(c0, c1));
+			lanes[ReplacementUnits] = _mm_sub_epi32(lanes[ReplacementUnits], _mm_cmpeq_epi32(v, _mm_set1_epi32(0xFFFD)));
+		}
+		for (int c = 0; c < UnitClassCount; ++c)
+		{
+			uint32_t sums[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums), lanes[c]);
+			counts[c] += static_cast<uint64_t>(sums[0]) + sums[1] + sums[2] + sums[3];
+		}
+	}
+	scalar::CountUnitClasses(begin, end, counts);
+}
+
+} // namespace sse42
+SIMD_TARGET_END
+#endif
+
+#if SIMD_KERNELS_AVX2
+SIMD_TARGET_AVX2
+namespace avx2
+{
+
+inline const char* SkipAscii(const char* begin, const char* end)
+{
+	for (; end - begin >= 32; begin += 32)
+	{
+		const uint32_t mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin)));
+		if (mask)
+			return begin + CountTrailingZeros(mask);
+	}
+	return sse42::SkipAscii(begin, end);
+}
+
+inline void CountZeroBytes(const char* begin, const char* end, size_t (&counts)[4])
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for (; end - begin >= 32; begin += 32)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+		if (!mask)
+			continue;
+		counts[0] += PopCount(mask & 0x11111111);
+		counts[1] += PopCount(mask & 0x22222222);
+		counts[2] += PopCount(mask & 0x44444444);
+		counts[3] += PopCount(mask & 0x88888888);
+	}
+	sse42::CountZeroBytes(begin, end, counts);
+}
+
+template<int N>
+inline __m256i Prev(__m256i input, __m256i previous)
+{
+	return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - N);
+}
+
+inline const char* ValidateUtf8(const char* begin, const char* end)
+{
+	const __m256i byte1High = _mm256_setr_epi8(UTF8_BYTE_1_HIGH, UTF8_BYTE_1_HIGH);
+	const __m256i byte1Low = _mm256_setr_epi8(UTF8_BYTE_1_LOW, UTF8_BYTE_1_LOW);
+	const __m256i byte2High = _mm256_setr_epi8(UTF8_BYTE_2_HIGH, UTF8_BYTE_2_HIGH);
+	const __m256i incompleteTail = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, UTF8_INCOMPLETE_TAIL);
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+	__m256i previous = _mm256_setzero_si256();
+	__m256i previousIncomplete = _mm256_setzero_si256();
+	const char* p = begin;
+	for (; end - p >= 32; p += 32)
+	{
+		const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		if (!_mm256_movemask_epi8(input))
+		{
+			if (!_mm256_testz_si256(previousIncomplete, previousIncomplete))
+				break;
+			previous = input;
+			continue;
+		}
+
+		const __m256i prev1 = Prev<1>(input, previous);
+		const __m256i specialCases = _mm256_and_si256(
+			_mm256_and_si256(
+				_mm256_shuffle_epi8(byte1High, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+				_mm256_shuffle_epi8(byte1Low, _mm256_and_si256(prev1, nibble))),
+			_mm256_shuffle_epi8(byte2High, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+		const __m256i mustBeContinuation = _mm256_and_si256(
+			_mm256_or_si256(_mm256_subs_epu8(Prev<2>(input, previous), _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80))),
+				_mm256_subs_epu8(Prev<3>(input, previous), _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)))),
+			_mm256_set1_epi8(static_cast<char>(0x80)));
+
+		const __m256i error = _mm256_xor_si256(mustBeContinuation, specialCases);
+		if (!_mm256_testz_si256(error, error))
+			break;
+
+		previousIncomplete = _mm256_subs_epu8(input, incompleteTail);
+		previous = input;
+	}
+	return scalar::ValidateUtf8(scalar::RewindToLead(begin, p), end);
+}
+
+inline const char16_t* FindLineBreakOrBom(const char16_t* begin, const char16_t* end)
+{
+	const __m256i lf = _mm256_set1_epi16('\n');
+	const __m256i cr = _mm256_set1_epi16('\r');
+	const __m256i bom = _mm256_set1_epi16(static_cast<short>(0xFEFF));
+	const __m256i swapped = _mm256_set1_epi16(static_cast<short>(0xFFFE));
+	for (; end - begin >= 16; begin += 16)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		const uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi16(v, lf), _mm256_cmpeq_epi16(v, cr)),
+			_mm256_or_si256(_mm256_cmpeq_epi16(v, bom), _mm256_cmpeq_epi16(v, swapped))));
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 2;
+	}
+	return sse42::FindLineBreakOrBom(begin, end);
+}
+
+inline const char32_t* FindLineBreakOrBom(const char32_t* begin, const char32_t* end)
+{
+	const __m256i lf = _mm256_set1_epi32('\n');
+	const __m256i cr = _mm256_set1_epi32('\r');
+	const __m256i bom = _mm256_set1_epi32(0xFEFF);
+	const __m256i swapped = _mm256_set1_epi32(0xFFFE);
+	for (; end - begin >= 8; begin += 8)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		const uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(v, lf), _mm256_cmpeq_epi32(v, cr)),
+			_mm256_or_si256(_mm256_cmpeq_epi32(v, bom), _mm256_cmpeq_epi32(v, swapped))));
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 4;
+	}
+	return sse42::FindLineBreakOrBom(begin, end);
+}
+
+inline const char16_t* SkipBelow(const char16_t* begin, const char16_t* end, uint32_t limit)
+{
+	const __m256i below = _mm256_set1_epi16(static_cast<short>(limit - 1));
+	for (; end - begin >= 16; begin += 16)
+	{
+		const __m256i v = _mm256_subs_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin)), below);
+		const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_setzero_si256())));
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 2;
+	}
+	return sse42::SkipBelow(begin, end, limit);
+}
+
+inline const char32_t* SkipBelow(const char32_t* begin, const char32_t* end, uint32_t limit)
+{
+	const __m256i below = _mm256_set1_epi32(static_cast<int>(limit - 1));
+	for (; end - begin >= 8; begin += 8)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_min_epu32(v, below), v)));
+		if (mask)
+			return begin + CountTrailingZeros(mask) / 4;
+	}
+	return sse42::SkipBelow(begin, end, limit);
+}
+
+inline char16_t* FoldAscii(const char16_t* begin, const char16_t* end, char16_t* out)
+{
+	const __m256i a = _mm256_set1_epi16('A');
+	const __m256i z = _mm256_set1_epi16(25);
+	const __m256i bit = _mm256_set1_epi16(0x20);
+	for (; end - begin >= 16; begin += 16, out += 16)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		const __m256i offset = _mm256_sub_epi16(v, a);
+		const __m256i upper = _mm256_cmpeq_epi16(_mm256_min_epu16(offset, z), offset);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_add_epi16(v, _mm256_and_si256(upper, bit)));
+	}
+	return sse42::FoldAscii(begin, end, out);
+}
+
+inline char32_t* FoldAscii(const char32_t* begin, const char32_t* end, char32_t* out)
+{
+	const __m256i a = _mm256_set1_epi32('A');
+	const __m256i z = _mm256_set1_epi32(25);
+	const __m256i bit = _mm256_set1_epi32(0x20);
+	for (; end - begin >= 8; begin += 8, out += 8)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		const __m256i offset = _mm256_sub_epi32(v, a);
+		const __m256i upper = _mm256_cmpeq_epi32(_mm256_min_epu32(offset, z), offset);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_add_epi32(v, _mm256_and_si256(upper, bit)));
+	}
+	return sse42::FoldAscii(begin, end, out);
+}
+
+inline __m256i AtMost16(__m256i v, __m256i limit)
+{
+	return _mm256_cmpeq_epi16(_mm256_min_epu16(v, limit), v);
+}
+
+inline __m256i AtMost32(__m256i v, __m256i limit)
+{
+	return _mm256_cmpeq_epi32(_mm256_min_epu32(v, limit), v);
+}
+
+inline uint64_t SumLanes32(__m256i v)
+{
+	uint32_t sums[8];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), v);
+	uint64_t sum = 0;
+	for (uint32_t lane : sums)
+		sum += lane;
+	return sum;
+}
+
+inline void CountUnitClasses(const char16_t* begin, const char16_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+	while (end - begin >= 16)
+	{
+		__m256i lanes[UnitClassCount];
+		for (auto& lane : lanes)
+			lane = _mm256_setzero_si256();
+		for (int i = 0; i < 0x7FFF && end - begin >= 16; ++i, begin += 16)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+			const __m256i layout = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi16(v, _mm256_set1_epi16('\t')),
+				_mm256_cmpeq_epi16(v, _mm256_set1_epi16('\n'))), _mm256_cmpeq_epi16(v, _mm256_set1_epi16('\r')));
+			const __m256i c0 = _mm256_andnot_si256(layout, AtMost16(v, _mm256_set1_epi16(0x1F)));
+			const __m256i c1 = AtMost16(_mm256_sub_epi16(v, _mm256_set1_epi16(0x7F)), _mm256_set1_epi16(0x20));
+			lanes[AsciiUnits] = _mm256_sub_epi16(lanes[AsciiUnits], AtMost16(v, _mm256_set1_epi16(0x7F)));
+			lanes[TwoByteUnits] = _mm256_sub_epi16(lanes[TwoByteUnits], AtMost16(_mm256_sub_epi16(v, _mm256_set1_epi16(0x80)), _mm256_set1_epi16(0x77F)));
+			lanes[SurrogateUnits] = _mm256_sub_epi16(lanes[SurrogateUnits], AtMost16(_mm256_sub_epi16(v, _mm256_set1_epi16(static_cast<short>(0xD800))), _mm256_set1_epi16(0x7FF)));
+			lanes[ControlUnits] = _mm256_sub_epi16(lanes[ControlUnits], _mm256_or_si256(c0, c1));
+			lanes[ReplacementUnits] = _mm256_sub_epi16(lanes[ReplacementUnits], _mm256_cmpeq_epi16(v, _mm256_set1_epi16(static_cast<short>(0xFFFD))));
+		}
+		for (int c = 0; c < UnitClassCount; ++c)
+			counts[c] += SumLanes32(_mm256_madd_epi16(lanes[c], ones));
+	}
+	sse42::CountUnitClasses(begin, end, counts);
+}
+
+inline void CountUnitClasses(const char32_t* begin, const char32_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	while (end - begin >= 8)
+	{
+		__m256i lanes[UnitClassCount];
+		for (auto& lane : lanes)
+			lane = _mm256_setzero_si256();
+		for (int i = 0; i < 0x7FFF && end - begin >= 8; ++i, begin += 8)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+			const __m256i layout = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(v, _mm256_set1_epi32('\t')),
+				_mm256_cmpeq_epi32(v, _mm256_set1_epi32('\n'))), _mm256_cmpeq_epi32(v, _mm256_set1_epi32('\r')));
+			const __m256i c0 = _mm256_andnot_si256(layout, AtMost32(v, _mm256_set1_epi32(0x1F)));
+			const __m256i c1 = AtMost32(_mm256_sub_epi32(v, _mm256_set1_epi32(0x7F)), _mm256_set1_epi32(0x20));
+			lanes[AsciiUnits] = _mm256_sub_epi32(lanes[AsciiUnits], AtMost32(v, _mm256_set1_epi32(0x7F)));
+			lanes[TwoByteUnits] = _mm256_sub_epi32(lanes[TwoByteUnits], AtMost32(_mm256_sub_epi32(v, _mm256_set1_epi32(0x80)), _mm256_set1_epi32(0x77F)));
+			lanes[SurrogateUnits] = _mm256_sub_epi32(lanes[SurrogateUnits], AtMost32(_mm256_sub_epi32(v, _mm256_set1_epi32(0xD800)), _mm256_set1_epi32(0x7FF)));
+			lanes[ControlUnits] = _mm256_sub_epi32(lanes[ControlUnits], _mm256_or_si256(c0, c1));
+			lanes[ReplacementUnits] = _mm256_sub_epi32(lanes[ReplacementUnits], _mm256_cmpeq_epi32(v, _mm256_set1_epi32(0xFFFD)));
+		}
+		for (int c = 0; c < UnitClassCount; ++c)
+			counts[c] += SumLanes32(lanes[c]);
+	}
+	sse42::CountUnitClasses(begin, end, counts);
+}
+
+} // namespace avx2
+#endif
+
+#if SIMD_KERNELS_NEON
+namespace neon
+{
+
+inline const char* SkipAscii(const char* begin, const char* end)
+{
+	for (; end - begin >= 16; begin += 16)
+	{
+		if (vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(begin))) >= 0x80)
+			return scalar::SkipAscii(begin, begin + 16);
+	}
+	return scalar::SkipAscii(begin, end);
+}
+
+inline void CountZeroBytes(const char* begin, const char* end, size_t (&counts)[4])
+{
+	while (end - begin >= 16)
+	{
+		// lane counters are 8 bit wide, flush them before they can overflow
+		uint8x16_t lanes = vdupq_n_u8(0);
+		for (int i = 0; i < 255 && end - begin >= 16; ++i, begin += 16)
+			lanes = vsubq_u8(lanes, vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(begin)), vdupq_n_u8(0)));
+
+		uint8_t perLane[16];
+		vst1q_u8(perLane, lanes);
+		for (int i = 0; i < 16; ++i)
+			counts[i & 3] += perLane[i];
+	}
+	scalar::CountZeroBytes(begin, end, counts);
+}
+
+inline const char* ValidateUtf8(const char* begin, const char* end)
+{
+	static const uint8_t tables[4][16] = {
+		{ UTF8_BYTE_1_HIGH }, { UTF8_BYTE_1_LOW }, { UTF8_BYTE_2_HIGH },
+		{ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, UTF8_INCOMPLETE_TAIL }
+	};
+	const uint8x16_t byte1High = vld1q_u8(tables[0]);
+	const uint8x16_t byte1Low = vld1q_u8(tables[1]);
+	const uint8x16_t byte2High = vld1q_u8(tables[2]);
+	const uint8x16_t incompleteTail = vld1q_u8(tables[3]);
+	const uint8x16_t nibble = vdupq_n_u8(0x0F);
+
+	uint8x16_t previous = vdupq_n_u8(0);
+	uint8x16_t previousIncomplete = vdupq_n_u8(0);
+	const char* p = begin;
+	for (; end - p >= 16; p += 16)
+	{
+		const uint8x16_t input = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+		if (vmaxvq_u8(input) < 0x80)
+		{
+			if (vmaxvq_u8(previousIncomplete))
+				break;
+			previous = input;
+			continue;
+		}
+
+		const uint8x16_t prev1 = vextq_u8(previous, input, 15);
+		const uint8x16_t specialCases = vandq_u8(
+			vandq_u8(vqtbl1q_u8(byte1High, vshrq_n_u8(prev1, 4)), vqtbl1q_u8(byte1Low, vandq_u8(prev1, nibble))),
+			vqtbl1q_u8(byte2High, vshrq_n_u8(input, 4)));
+
+		const uint8x16_t mustBeContinuation = vandq_u8(
+			vorrq_u8(vqsubq_u8(vextq_u8(previous, input, 14), vdupq_n_u8(0xE0 - 0x80)),
+				vqsubq_u8(vextq_u8(previous, input, 13), vdupq_n_u8(0xF0 - 0x80))),
+			vdupq_n_u8(0x80));
+
+		if (vmaxvq_u8(veorq_u8(mustBeContinuation, specialCases)))
+			break;
+
+		previousIncomplete = vqsubq_u8(input, incompleteTail);
+		previous = input;
+	}
+	return scalar::ValidateUtf8(scalar::RewindToLead(begin, p), end);
+}
+
+inline const char16_t* FindLineBreakOrBom(const char16_t* begin, const char16_t* end)
+{
+	for (; end - begin >= 8; begin += 8)
+	{
+		const uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(begin));
+		const uint16x8_t hit = vorrq_u16(vorrq_u16(vceqq_u16(v, vdupq_n_u16('\n')), vceqq_u16(v, vdupq_n_u16('\r'))),
+			vorrq_u16(vceqq_u16(v, vdupq_n_u16(0xFEFF)), vceqq_u16(v, vdupq_n_u16(0xFFFE))));
+		if (vmaxvq_u16(hit))
+			return scalar::FindLineBreakOrBom(begin, begin + 8);
+	}
+	return scalar::FindLineBreakOrBom(begin, end);
+}
+
+inline const char32_t* FindLineBreakOrBom(const char32_t* begin, const char32_t* end)
+{
+	for (; end - begin >= 4; begin += 4)
+	{
+		const uint32x4_t v = vld1q_u32(reinterpret_cast<const uint32_t*>(begin));
+		const uint32x4_t hit = vorrq_u32(vorrq_u32(vceqq_u32(v, vdupq_n_u32('\n')), vceqq_u32(v, vdupq_n_u32('\r'))),
+			vorrq_u32(vceqq_u32(v, vdupq_n_u32(0xFEFF)), vceqq_u32(v, vdupq_n_u32(0xFFFE))));
+		if (vmaxvq_u32(hit))
+			return scalar::FindLineBreakOrBom(begin, begin + 4);
+	}
+	return scalar::FindLineBreakOrBom(begin, end);
+}
+
+inline const char16_t* SkipBelow(const char16_t* begin, const char16_t* end, uint32_t limit)
+{
+	const uint16x8_t bound = vdupq_n_u16(static_cast<uint16_t>(limit));
+	for (; end - begin >= 8; begin += 8)
+	{
+		if (vmaxvq_u16(vcgeq_u16(vld1q_u16(reinterpret_cast<const uint16_t*>(begin)), bound)))
+			return scalar::SkipBelow(begin, begin + 8, limit);
+	}
+	return scalar::SkipBelow(begin, end, limit);
+}
+
+inline const char32_t* SkipBelow(const char32_t* begin, const char32_t* end, uint32_t limit)
+{
+	const uint32x4_t bound = vdupq_n_u32(limit);
+	for (; end - begin >= 4; begin += 4)
+	{
+		if (vmaxvq_u32(vcgeq_u32(vld1q_u32(reinterpret_cast<const uint32_t*>(begin)), bound)))
+			return scalar::SkipBelow(begin, begin + 4, limit);
+	}
+	return scalar::SkipBelow(begin, end, limit);
+}
+
+inline char16_t* FoldAscii(const char16_t* begin, const char16_t* end, char16_t* out)
+{
+	for (; end - begin >= 8; begin += 8, out += 8)
+	{
+		const uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(begin));
+		const uint16x8_t upper = vcleq_u16(vsubq_u16(v, vdupq_n_u16('A')), vdupq_n_u16(25));
+		vst1q_u16(reinterpret_cast<uint16_t*>(out), vaddq_u16(v, vandq_u16(upper, vdupq_n_u16(0x20))));
+	}
+	return scalar::FoldAscii(begin, end, out);
+}
+
+inline char32_t* FoldAscii(const char32_t* begin, const char32_t* end, char32_t* out)
+{
+	for (; end - begin >= 4; begin += 4, out += 4)
+	{
+		const uint32x4_t v = vld1q_u32(reinterpret_cast<const uint32_t*>(begin));
+		const uint32x4_t upper = vcleq_u32(vsubq_u32(v, vdupq_n_u32('A')), vdupq_n_u32(25));
+		vst1q_u32(reinterpret_cast<uint32_t*>(out), vaddq_u32(v, vandq_u32(upper, vdupq_n_u32(0x20))));
+	}
+	return scalar::FoldAscii(begin, end, out);
+}
+
+inline void CountUnitClasses(const char16_t* begin, const char16_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	while (end - begin >= 8)
+	{
+		uint16x8_t lanes[UnitClassCount];
+		for (auto& lane : lanes)
+			lane = vdupq_n_u16(0);
+		for (int i = 0; i < 0x7FFF && end - begin >= 8; ++i, begin += 8)
+		{
+			const uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(begin));
+			const uint16x8_t layout = vorrq_u16(vorrq_u16(vceqq_u16(v, vdupq_n_u16('\t')), vceqq_u16(v, vdupq_n_u16('\n'))), vceqq_u16(v, vdupq_n_u16('\r')));
+			const uint16x8_t c0 = vbicq_u16(vcleq_u16(v, vdupq_n_u16(0x1F)), layout);
+			const uint16x8_t c1 = vcleq_u16(vsubq_u16(v, vdupq_n_u16(0x7F)), vdupq_n_u16(0x20));
+			lanes[AsciiUnits] = vsubq_u16(lanes[AsciiUnits], vcleq_u16(v, vdupq_n_u16(0x7F)));
+			lanes[TwoByteUnits] = vsubq_u16(lanes[TwoByteUnits], vcleq_u16(vsubq_u16(v, vdupq_n_u16(0x80)), vdupq_n_u16(0x77F)));
+			lanes[SurrogateUnits] = vsubq_u16(lanes[SurrogateUnits], vcleq_u16(vsubq_u16(v, vdupq_n_u16(0xD800)), vdupq_n_u16(0x7FF)));
+			lanes[ControlUnits] = vsubq_u16(lanes[ControlUnits], vorrq_u16(c0, c1));
+			lanes[ReplacementUnits] = vsubq_u16(lanes[ReplacementUnits], vceqq_u16(v, vdupq_n_u16(0xFFFD)));
+		}
+		for (int c = 0; c < UnitClassCount; ++c)
+			counts[c] += vaddlvq_u16(lanes[c]);
+	}
+	scalar::CountUnitClasses(begin, end, counts);
+}
+
+inline void CountUnitClasses(const char32_t* begin, const char32_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	while (end - begin >= 4)
+	{
+		uint32x4_t lanes[UnitClassCount];
+		for (auto& lane : lanes)
+			lane = vdupq_n_u32(0);
+		for (int i = 0; i < 0x7FFF && end - begin >= 4; ++i, begin += 4)
+		{
+			const uint32x4_t v = vld1q_u32(reinterpret_cast<const uint32_t*>(begin));
+			const uint32x4_t layout = vorrq_u32(vorrq_u32(vceqq_u32(v, vdupq_n_u32('\t')), vceqq_u32(v, vdupq_n_u32('\n'))), vceqq_u32(v, vdupq_n_u32('\r')));
+			const uint32x4_t c0 = vbicq_u32(vcleq_u32(v, vdupq_n_u32(0x1F)), layout);
+			const uint32x4_t c1 = vcleq_u32(vsubq_u32(v, vdupq_n_u32(0x7F)), vdupq_n_u32(0x20));
+			lanes[AsciiUnits] = vsubq_u32(lanes[AsciiUnits], vcleq_u32(v, vdupq_n_u32(0x7F)));
+			lanes[TwoByteUnits] = vsubq_u32(lanes[TwoByteUnits], vcleq_u32(vsubq_u32(v, vdupq_n_u32(0x80)), vdupq_n_u32(0x77F)));
+			lanes[SurrogateUnits] = vsubq_u32(lanes[SurrogateUnits], vcleq_u32(vsubq_u32(v, vdupq_n_u32(0xD800)), vdupq_n_u32(0x7FF)));
+			lanes[ControlUnits] = vsubq_u32(lanes[ControlUnits], vorrq_u32(c0, c1));
+			lanes[ReplacementUnits] = vsubq_u32(lanes[ReplacementUnits], vceqq_u32(v, vdupq_n_u32(0xFFFD)));
+		}
+		for (int c = 0; c < UnitClassCount; ++c)
+			counts[c] += vaddlvq_u32(lanes[c]);
+	}
+	scalar::CountUnitClasses(begin, end, counts);
+}
+
+} // namespace neon
+#endif
+
+#if SIMD_KERNELS_AVX512
+SIMD_TARGET_AVX512
+namespace avx512
+{
+
+// AVX-512F and BW: 64 byte blocks with mask registers instead of movemask
+inline const char* SkipAscii(const char* begin, const char* end)
+{
+	for (; end - begin >= 64; begin += 64)
+	{
+		const uint64_t mask = _mm512_movepi8_mask(_mm512_loadu_si512(begin));
+		if (mask)
+			return begin + CountTrailingZeros64(mask);
+	}
+	return avx2::SkipAscii(begin, end);
+}
+
+inline void CountZeroBytes(const char* begin, const char* end, size_t (&counts)[4])
+{
+	const __m512i zero = _mm512_setzero_si512();
+	for (; end - begin >= 64; begin += 64)
+	{
+		const uint64_t mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(begin), zero);
+		if (!mask)
+			continue;
+		counts[0] += PopCount64(mask & 0x1111111111111111ull);
+		counts[1] += PopCount64(mask & 0x2222222222222222ull);
+		counts[2] += PopCount64(mask & 0x4444444444444444ull);
+		counts[3] += PopCount64(mask & 0x8888888888888888ull);
+	}
+	avx2::CountZeroBytes(begin, end, counts);
+}
+
+// the 32 byte blocks already run at memory speed
+using avx2::ValidateUtf8;
+
+inline const char16_t* FindLineBreakOrBom(const char16_t* begin, const char16_t* end)
+{
+	const __m512i lf = _mm512_set1_epi16('\n');
+	const __m512i cr = _mm512_set1_epi16('\r');
+	const __m512i bom = _mm512_set1_epi16(static_cast<short>(0xFEFF));
+	const __m512i swapped = _mm512_set1_epi16(static_cast<short>(0xFFFE));
+	for (; end - begin >= 32; begin += 32)
+	{
+		const __m512i v = _mm512_loadu_si512(begin);
+		const uint32_t mask = _mm512_cmpeq_epi16_mask(v, lf) | _mm512_cmpeq_epi16_mask(v, cr)
+			| _mm512_cmpeq_epi16_mask(v, bom) | _mm512_cmpeq_epi16_mask(v, swapped);
+		if (mask)
+			return begin + CountTrailingZeros(mask);
+	}
+	return avx2::FindLineBreakOrBom(begin, end);
+}
+
+inline const char32_t* FindLineBreakOrBom(const char32_t* begin, const char32_t* end)
+{
+	const __m512i lf = _mm512_set1_epi32('\n');
+	const __m512i cr = _mm512_set1_epi32('\r');
+	const __m512i bom = _mm512_set1_epi32(0xFEFF);
+	const __m512i swapped = _mm512_set1_epi32(0xFFFE);
+	for (; end - begin >= 16; begin += 16)
+	{
+		const __m512i v = _mm512_loadu_si512(begin);
+		const uint32_t mask = _mm512_cmpeq_epi32_mask(v, lf) | _mm512_cmpeq_epi32_mask(v, cr)
+			| _mm512_cmpeq_epi32_mask(v, bom) | _mm512_cmpeq_epi32_mask(v, swapped);
+		if (mask)
+			return begin + CountTrailingZeros(mask);
+	}
+	return avx2::FindLineBreakOrBom(begin, end);
+}
+
+inline const char16_t* SkipBelow(const char16_t* begin, const char16_t* end, uint32_t limit)
+{
+	const __m512i bound = _mm512_set1_epi16(static_cast<short>(limit));
+	for (; end - begin >= 32; begin += 32)
+	{
+		const uint32_t mask = _mm512_cmpge_epu16_mask(_mm512_loadu_si512(begin), bound);
+		if (mask)
+			return begin + CountTrailingZeros(mask);
+	}
+	return avx2::SkipBelow(begin, end, limit);
+}
+
+inline const char32_t* SkipBelow(const char32_t* begin, const char32_t* end, uint32_t limit)
+{
+	const __m512i bound = _mm512_set1_epi32(static_cast<int>(limit));
+	for (; end - begin >= 16; begin += 16)
+	{
+		const uint32_t mask = _mm512_cmpge_epu32_mask(_mm512_loadu_si512(begin), bound);
+		if (mask)
+			return begin + CountTrailingZeros(mask);
+	}
+	return avx2::SkipBelow(begin, end, limit);
+}
+
+inline char16_t* FoldAscii(const char16_t* begin, const char16_t* end, char16_t* out)
+{
+	const __m512i a = _mm512_set1_epi16('A');
+	const __m512i z = _mm512_set1_epi16(25);
+	const __m512i bit = _mm512_set1_epi16(0x20);
+	for (; end - begin >= 32; begin += 32, out += 32)
+	{
+		const __m512i v = _mm512_loadu_si512(begin);
+		const __mmask32 upper = _mm512_cmple_epu16_mask(_mm512_sub_epi16(v, a), z);
+		_mm512_storeu_si512(out, _mm512_mask_add_epi16(v, upper, v, bit));
+	}
+	return avx2::FoldAscii(begin, end, out);
+}
+
+inline char32_t* FoldAscii(const char32_t* begin, const char32_t* end, char32_t* out)
+{
+	const __m512i a = _mm512_set1_epi32('A');
+	const __m512i z = _mm512_set1_epi32(25);
+	const __m512i bit = _mm512_set1_epi32(0x20);
+	for (; end - begin >= 16; begin += 16, out += 16)
+	{
+		const __m512i v = _mm512_loadu_si512(begin);
+		const __mmask16 upper = _mm512_cmple_epu32_mask(_mm512_sub_epi32(v, a), z);
+		_mm512_storeu_si512(out, _mm512_mask_add_epi32(v, upper, v, bit));
+	}
+	return avx2::FoldAscii(begin, end, out);
+}
+
+// a population count of every compare mask
+inline void CountUnitClasses(const char16_t* begin, const char16_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	for (; end - begin >= 32; begin += 32)
+	{
+		const __m512i v = _mm512_loadu_si512(begin);
+		const __mmask32 layout = _mm512_cmpeq_epi16_mask(v, _mm512_set1_epi16('\t'))
+			| _mm512_cmpeq_epi16_mask(v, _mm512_set1_epi16('\n')) | _mm512_cmpeq_epi16_mask(v, _mm512_set1_epi16('\r'));
+		const __mmask32 c0 = _mm512_cmple_epu16_mask(v, _mm512_set1_epi16(0x1F)) & ~layout;
+		const __mmask32 c1 = _mm512_cmple_epu16_mask(_mm512_sub_epi16(v, _mm512_set1_epi16(0x7F)), _mm512_set1_epi16(0x20));
+		counts[AsciiUnits] += PopCount(_mm512_cmple_epu16_mask(v, _mm512_set1_epi16(0x7F)));
+		counts[TwoByteUnits] += PopCount(_mm512_cmple_epu16_mask(_mm512_sub_epi16(v, _mm512_set1_epi16(0x80)), _mm512_set1_epi16(0x77F)));
+		counts[SurrogateUnits] += PopCount(_mm512_cmple_epu16_mask(_mm512_sub_epi16(v, _mm512_set1_epi16(static_cast<short>(0xD800))), _mm512_set1_epi16(0x7FF)));
+		counts[ControlUnits] += PopCount(c0 | c1);
+		counts[ReplacementUnits] += PopCount(_mm512_cmpeq_epi16_mask(v, _mm512_set1_epi16(static_cast<short>(0xFFFD))));
+	}
+	avx2::CountUnitClasses(begin, end, counts);
+}
+
+inline void CountUnitClasses(const char32_t* begin, const char32_t* end, uint64_t (&counts)[UnitClassCount])
+{
+	for (; end - begin >= 16; begin += 16)
+	{
+		const __m512i v = _mm512_loadu_si512(begin);
+		const __mmask16 layout = _mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32('\t'))
+			| _mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32('\n')) | _mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32('\r'));
+		const __mmask16 c0 = _mm512_cmple_epu32_mask(v, _mm512_set1_epi32(0x1F)) & ~layout;
+		const __mmask16 c1 = _mm512_cmple_epu32_mask(_mm512_sub_epi32(v, _mm512_set1_epi32(0x7F)), _mm512_set1_epi32(0x20));
+		counts[AsciiUnits] += PopCount(_mm512_cmple_epu32_mask(v, _mm512_set1_epi32(0x7F)));
+		counts[TwoByteUnits] += PopCount(_mm512_cmple_epu32_mask(_mm512_sub_epi32(v, _mm512_set1_epi32(0x80)), _mm512_set1_epi32(0x77F)));
+		counts[SurrogateUnits] += PopCount(_mm512_cmple_epu32_mask(_mm512_sub_epi32(v, _mm512_set1_epi32(0xD800)), _mm512_set1_epi32(0x7FF)));
+		counts[ControlUnits] += PopCount(c0 | c1);
+		counts[ReplacementUnits] += PopCount(_mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32(0xFFFD)));
+	}
+	avx2::CountUnitClasses(begin, end, counts);
+}
+
+} // namespace avx512
+SIMD_TARGET_END
+#endif
+
+#undef UTF8_BYTE_1_HIGH
+#undef UTF8_BYTE_1_LOW
+#undef UTF8_BYTE_2_HIGH
+#undef UTF8_INCOMPLETE_TAIL
+
+using scalar::IsTruncatedUtf8;
+
+} // namespace simd
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef _3B0E6F51_9C2D_4A8E_B7F4_61D2A05C8E93_
+#define  _3B0E6F51_9C2D_4A8E_B7F4_61D2A05C8E93_
+
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "DecodeError.h"
+#include "Decoder.h"
+#include "TextEncoding.h"
+#include "Transcode.h"
+
+// Incremental decoder for input that arrives in chunks of any size (pipes,
+// sockets, a mapping walked piece by piece). A character split between two
+// chunks - a multi-byte UTF-8 sequence, part of a UTF-16 / UTF-32 unit or a
+// surrogate pair - is carried over to the next Feed. Output goes through one
+// buffer of fixed size that is handed to the sink whenever it fills up, so
+// memory does not grow with the input length.
+//
+// sink(const CharT* begin, const CharT* end) receives decoded UTF-16 code
+// units; the range is only valid during the call. Codec is a Decoder<E> for a
+// loop specialized to one encoding, or the default DynamicDecoder.
+//
+// Malformed input is validated and converted in the same pass: the offset and
+// kind of every bad sequence are recorded and the ErrorPolicy says whether the
+// text stops there, gets a U+FFFD or goes on without the bytes. Nothing is
+// ever read twice, a pipe works like a file.
+template<typename CharT, typename Codec = DynamicDecoder<CharT>>
+class StreamingDecoder
+{
+public:
+	static const size_t DefaultCapacity = 16 * 1024;
+	static const size_t MaxRecordedErrors = 64; // ErrorCount() goes on counting
+
+	explicit StreamingDecoder(const Codec& codec, size_t capacity = DefaultCapacity)
+		: codec(codec), buffer(capacity)
+	{
+		assert(capacity >= 8); // room for any character in any Converter.h output
+		errors.reserve(MaxRecordedErrors);
+	}
+
+	// start over, pending bytes and recorded errors are dropped; the policy stays
+	inline void Reset();
+	// start over with another encoding
+	void Reset(const Codec& codec)
+	{
+		this->codec = codec;
+		Reset();
+	}
+
+	TextEncoding Encoding() const { return codec.Encoding(); }
+
+	ErrorPolicy Policy() const { return policy; }
+	void SetErrorPolicy(ErrorPolicy policy) { this->policy = policy; }
+
+	// false once the input turned out to be malformed and the policy is Stop;
+	// everything decoded in front of the bad bytes has been passed to the sink
+	// by then
+	template<typename Sink>
+	inline bool Feed(const char* begin, const char* end, Sink&& sink);
+
+	// end of input: a character still waiting for its other bytes is an error
+	template<typename Sink>
+	inline bool Finish(Sink&& sink);
+
+	bool Failed() const { return failed; }
+
+	// input bytes decoded so far, the offset of the bad bytes after a failure
+	uint64_t Consumed() const { return consumed; }
+
+	// malformed sequences seen since the last Reset, the first
+	// MaxRecordedErrors of them with offset and kind
+	uint64_t ErrorCount() const { return errorCount; }
+	const std::vector<DecodeError>& Errors() const { return errors; }
+
+private:
+	template<typename Sink>
+	inline TranscodeResult Decode(const char* begin, const char* end, Sink& sink);
+
+	template<typename Sink>
+	inline size_t Recover(const char* begin, const char* end, Sink& sink);
+
+	inline void Record(DecodeErrorKind kind);
+
+	template<typename Sink>
+	inline void Put(CharT unit, Sink& sink);
+
+	template<typename Sink>
+	inline void PutReplacement(Sink& sink);
+
+	template<typename Sink>
+	inline bool Fail(Sink& sink);
+
+	template<typename Sink>
+	inline void Flush(Sink& sink);
+
+	static const size_t MaxCarry = 4; // longest UTF-8 sequence, a surrogate pair
+	static const size_t MaxReplacement = 4; // U+FFFD in UTF-32, for byte output
+
+	Codec codec;
+	std::vector<CharT> buffer;
+	size_t used = 0;
+	char carry[MaxCarry] = {};
+	size_t carried = 0;
+	uint64_t consumed = 0;
+	bool failed = false;
+	ErrorPolicy policy = ErrorPolicy::Stop;
+	uint64_t errorCount = 0;
+	std::vector<DecodeError> errors;
+};
+
+
+template<typename CharT, typename Codec>
+void StreamingDecoder<CharT, Codec>::Reset()
+{
+	used = 0;
+	carried = 0;
+	consumed = 0;
+	failed = false;
+	errorCount = 0;
+	errors.clear();
+}
+
+template<typename CharT, typename Codec>
+template<typename Sink>
+bool StreamingDecoder<CharT, Codec>::Feed(const char* begin, const char* end, Sink&& sink)
+{
+	assert(begin <= end);
+	if (failed)
+		return false;
+
+	// finish the character split by the previous chunk, one byte at a time:
+	// it needs at most MaxCarry - 1 more. Bytes behind a bad sequence in
+	// carry are decoded from carry as well.
+	while (carried)
+	{
+		const TranscodeResult result = Decode(carry, carry + carried, sink);
+		size_t done = result.consumed;
+		if (result.status == TranscodeStatus::Incomplete && !done)
+		{
+			if (begin == end)
+				break;
+			assert(carried < MaxCarry);
+			carry[carried++] = *begin++;
+			continue;
+		}
+		consumed += done;
+		if (result.status == TranscodeStatus::Invalid)
+		{
+			const size_t skipped = Recover(carry + done, carry + carried, sink);
+			if (!skipped)
+				return Fail(sink);
+			consumed += skipped;
+			done += skipped;
+		}
+		std::copy(carry + done, carry + carried, carry);
+		carried -= done;
+	}
+
+	while (begin != end)
+	{
+		const TranscodeResult result = Decode(begin, end, sink);
+		consumed += result.consumed;
+		begin += result.consumed;
+		if (result.status == TranscodeStatus::Incomplete)
+		{
+			carried = end - begin;
+			assert(carried < MaxCarry);
+			std::copy(begin, end, carry);
+			break;
+		}
+		if (result.status != TranscodeStatus::Invalid)
+			break;
+		const size_t skipped = Recover(begin, end, sink);
+		if (!skipped)
+			return Fail(sink);
+		consumed += skipped;
+		begin += skipped;
+	}
+	Flush(sink);
+	return true;
+}
+
+template<typename CharT, typename Codec>
+template<typename Sink>
+bool StreamingDecoder<CharT, Codec>::Finish(Sink&& sink)
+{
+	// a character still waiting for its other bytes at the end of input
+	if (carried && !failed)
+	{
+		Record(DecodeErrorKind::Truncated);
+		if (policy == ErrorPolicy::Stop)
+			failed = true;
+		else
+		{
+			if (policy == ErrorPolicy::Replace)
+				PutReplacement(sink);
+			consumed += carried;
+		}
+	}
+	carried = 0;
+	Flush(sink);
+	return !failed;
+}
+
+// runs the kernel over [begin, end), emptying the buffer whenever it fills up
+template<typename CharT, typename Codec>
+template<typename Sink>
+TranscodeResult StreamingDecoder<CharT, Codec>::Decode(const char* begin, const char* end, Sink& sink)
+{
+	TranscodeResult total = { 0, 0, TranscodeStatus::Ok };
+	for (;;)
+	{
+		const TranscodeResult result = codec.Decode(begin + total.consumed, end, buffer.data() + used, buffer.data() + buffer.size());
+		used += result.produced;
+		total.consumed += result.consumed;
+		total.produced += result.produced;
+		total.status = result.status;
+		if (result.status != TranscodeStatus::OutputFull)
+			return total;
+		Flush(sink);
+	}
+}
+
+// the bad sequence at begin is recorded; the bytes to step over, 0 to stop
+template<typename CharT, typename Codec>
+template<typename Sink>
+size_t StreamingDecoder<CharT, Codec>::Recover(const char* begin, const char* end, Sink& sink)
+{
+	const MalformedSequence bad = ClassifyMalformed(codec.Encoding(), begin, end);
+	Record(bad.kind);
+	if (policy == ErrorPolicy::Stop)
+		return 0;
+	if (policy == ErrorPolicy::Replace)
+		PutReplacement(sink);
+	return bad.length;
+}
+
+// at the current offset
+template<typename CharT, typename Codec>
+void StreamingDecoder<CharT, Codec>::Record(DecodeErrorKind kind)
+{
+	if (errors.size() < MaxRecordedErrors)
+		errors.push_back({ consumed, kind });
+	++errorCount;
+}
+
+template<typename CharT, typename Codec>
+template<typename Sink>
+void StreamingDecoder<CharT, Codec>::Put(CharT unit, Sink& sink)
+{
+	if (used == buffer.size())
+		Flush(sink);
+	buffer[used++] = unit;
+}
+
+// U+FFFD as the codec writes it
+template<typename CharT, typename Codec>
+template<typename Sink>
+void StreamingDecoder<CharT, Codec>::PutReplacement(Sink& sink)
+{
+	CharT units[MaxReplacement];
+	const size_t count = codec.Replacement(units);
+	assert(count <= MaxReplacement);
+	for (size_t i = 0; i < count; ++i)
+		Put(units[i], sink);
+}
+
+template<typename CharT, typename Codec>
+template<typename Sink>
+bool StreamingDecoder<CharT, Codec>::Fail(Sink& sink)
+{
+	failed = true;
+	Flush(sink);
+	return false;
+}
+
+template<typename CharT, typename Codec>
+template<typename Sink>
+void StreamingDecoder<CharT, Codec>::Flush(Sink& sink)
+{
+	if (used)
+		sink(buffer.data(), buffer.data() + used);
+	used = 0;
+}
+
+#endif
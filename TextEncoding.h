@@ -0,0 +1,64 @@
+#ifndef _72D0843D_CEA0_4787_980B_1C2E94ED27B7_
+#define  _72D0843D_CEA0_4787_980B_1C2E94ED27B7_
+
+#include <cstddef>
+
+// Windows headers define these, keep the same values elsewhere
+#ifndef CP_ACP
+#define CP_ACP 0
+#endif
+#ifndef CP_UTF8
+#define CP_UTF8 65001
+#endif
+
+#define CP_UTF16_LE 1200
+#define CP_UTF16_BE 1201
+#define CP_UTF32_LE 12000
+#define CP_UTF32_BE 12001
+
+enum class TextEncoding : int
+{
+	Ansi = CP_ACP, UTF8 = CP_UTF8, UTF16LE = CP_UTF16_LE, UTF16BE = CP_UTF16_BE, UTF32LE = CP_UTF32_LE, UTF32BE = CP_UTF32_BE,
+	// the single byte code pages of CodePages.h; Ansi is ISO-8859-1
+	Windows1250 = 1250, Windows1251 = 1251, Windows1252 = 1252
+};
+
+inline const char* EncodingName(TextEncoding encoding)
+{
+	switch (encoding)
+	{
+	case TextEncoding::UTF8: return "UTF-8";
+	case TextEncoding::UTF16LE: return "UTF-16LE";
+	case TextEncoding::UTF16BE: return "UTF-16BE";
+	case TextEncoding::UTF32LE: return "UTF-32LE";
+	case TextEncoding::UTF32BE: return "UTF-32BE";
+	case TextEncoding::Windows1250: return "windows-1250";
+	case TextEncoding::Windows1251: return "windows-1251";
+	case TextEncoding::Windows1252: return "windows-1252";
+	default: return "ANSI";
+	}
+}
+
+// what a detector thinks about the data:
+//  confidence - 0 (pure guess) .. 100 (BOM or unambiguous)
+//  bomLength  - bytes of byte order mark in front of the text, 0 if none
+struct DetectionResult
+{
+	TextEncoding encoding;
+	int confidence;
+	size_t bomLength;
+};
+
+// which check of the native detector settled the input: the first four are
+// sure enough that no backend is asked, SingleByte only leaves the code page
+// to one, Ambiguous (no bytes, zeros without a pattern) all of it
+enum class Prefilter { Bom, Ascii, Wide, Utf8, SingleByte, Ambiguous };
+const size_t PrefilterCount = 6;
+
+inline const char* PrefilterName(Prefilter prefilter)
+{
+	static const char* const names[PrefilterCount] = { "bom", "ascii", "wide", "utf8", "single_byte", "ambiguous" };
+	return names[static_cast<size_t>(prefilter)];
+}
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef _F9115177_8107_4AEC_B0F1_609D12DCE807_
+#define  _F9115177_8107_4AEC_B0F1_609D12DCE807_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include "Dispatch.h"
+#include "UnicodeTables.h"
+
+// What --stats reports instead of the dump: the decoded text counted by
+// UTF-8 sequence length, plane and Unicode block, its controls (U+0000..001F
+// but tab, LF and CR, and U+007F..009F), U+FFFD and unpaired surrogates, and
+// its lines by length. One vector pass per block (CountUnitClasses) gives
+// the classes. For the blocks ASCII runs are skipped with SkipBelow; the
+// units of the stretch after one are looked up one by one, ASCII among them,
+// and without a branch per unit when the kernel found no surrogates in the
+// block. The counters are kept four times over, so that a run of one block
+// does not wait for the increment of its previous character.
+//
+// Line breaks and BOMs are text like any other; line lengths are in UTF-16
+// units, without the line ending, as LineSplitter reports them.
+template<typename CharT>
+class TextStatistics
+{
+public:
+	// 0 for empty lines, then [2^(k-1), 2^k) units; the last one is open
+	static const size_t LineBuckets = 33;
+	// units looked up after an ASCII run before looking for the next one
+	static const ptrdiff_t Stretch = 64;
+	static const size_t Banks = 4;
+
+	TextStatistics() { Reset(); }
+
+	void Reset()
+	{
+		std::fill(std::begin(classes), std::end(classes), 0);
+		std::fill(std::begin(planes), std::end(planes), 0);
+		for (auto& bank : blocks)
+			std::fill(std::begin(bank), std::end(bank), 0);
+		std::fill(std::begin(lineLengths), std::end(lineLengths), 0);
+		units = 0;
+		pairs = 0;
+		lines = 0;
+		longestLine = 0;
+		pendingHigh = 0;
+		lastSupplementary = 0;
+	}
+
+	// the decoded text, in the blocks it comes in
+	void Count(const CharT* begin, const CharT* end)
+	{
+		const uint64_t surrogates = classes[simd::SurrogateUnits];
+		simd::CountUnitClasses(begin, end, classes);
+		const bool paired = classes[simd::SurrogateUnits] != surrogates;
+		units += end - begin;
+		const CharT* p = begin;
+		if (pendingHigh && p != end)
+		{
+			++blocks[0][IsLowSurrogate(*p) ? PairBlock(pendingHigh, *p++) : BlockOf(pendingHigh)];
+			pendingHigh = 0;
+		}
+		size_t bank = 0;
+		while (p != end)
+		{
+			if (static_cast<uint32_t>(*p) < 0x80)
+			{
+				const CharT* ascii = p;
+				p = simd::SkipBelow(p, end, 0x80);
+				blocks[0][0] += p - ascii;
+				continue;
+			}
+			const CharT* const stretchEnd = end - p > Stretch ? p + Stretch : end;
+			if (!paired)
+			{
+				// BMP only, by the kernel: no unit needs a look at the next
+				static_assert(Banks == 4, "one increment per bank");
+				for (; stretchEnd - p >= 4; p += 4)
+				{
+					++blocks[0][Column(p[0])];
+					++blocks[1][Column(p[1])];
+					++blocks[2][Column(p[2])];
+					++blocks[3][Column(p[3])];
+				}
+				for (; p != stretchEnd; ++p)
+					++blocks[0][Column(*p)];
+				continue;
+			}
+			while (p < stretchEnd)
+			{
+				const uint32_t unit = static_cast<uint32_t>(*p);
+				size_t block = Column(*p++);
+				if (unit - 0xD800 < 0x400)
+				{
+					if (p == end)
+					{
+						pendingHigh = unit;
+						break;
+					}
+					if (IsLowSurrogate(*p))
+						block = PairBlock(unit, *p++);
+				}
+				++blocks[bank++ & (Banks - 1)][block];
+			}
+		}
+	}
+
+	// a line of the counted text
+	void Line(const CharT* begin, const CharT* end)
+	{
+		uint64_t length = end - begin;
+		longestLine = std::max(longestLine, length);
+		size_t bucket = 0;
+		for (; length && bucket < LineBuckets - 1; length >>= 1)
+			++bucket;
+		++lineLengths[bucket];
+		++lines;
+	}
+
+	// end of the text: a high surrogate held back for its low one is unpaired
+	void Finish()
+	{
+		if (pendingHigh)
+			++blocks[0][BlockOf(pendingHigh)];
+		pendingHigh = 0;
+	}
+
+	// the members of a JSON object, "units": ..., "line_lengths": { ... }
+	void AppendJson(std::string& out) const
+	{
+		using namespace simd;
+		const uint64_t threeByte = units - classes[AsciiUnits] - classes[TwoByteUnits] - classes[SurrogateUnits];
+		out += "\"units\": " + std::to_string(units);
+		out += ", \"code_points\": " + std::to_string(units - pairs);
+		out += ", \"utf8_lengths\": [" + std::to_string(classes[AsciiUnits]) + ", " + std::to_string(classes[TwoByteUnits])
+			+ ", " + std::to_string(threeByte) + ", " + std::to_string(pairs) + "]";
+		out += ", \"controls\": " + std::to_string(classes[ControlUnits]);
+		out += ", \"replacements\": " + std::to_string(classes[ReplacementUnits]);
+		out += ", \"unpaired_surrogates\": " + std::to_string(classes[SurrogateUnits] - 2 * pairs);
+
+		out += ", \"planes\": {";
+		bool first = true;
+		uint64_t supplementary = 0;
+		for (size_t plane = 1; plane < 17; ++plane)
+			supplementary += planes[plane];
+		for (size_t plane = 0; plane < 17; ++plane)
+		{
+			const uint64_t count = plane ? planes[plane] : units - pairs - supplementary;
+			if (!count)
+				continue;
+			out += (first ? " \"" : ", \"") + std::to_string(plane) + "\": " + std::to_string(count);
+			first = false;
+		}
+		out += first ? "}" : " }";
+
+		out += ", \"blocks\": {";
+		first = true;
+		for (size_t i = 0; i <= unicode_tables::BlockCount; ++i)
+		{
+			uint64_t count = 0;
+			for (const auto& bank : blocks)
+				count += bank[i];
+			if (!count)
+				continue;
+			out += first ? " " : ", ";
+			AppendJsonString(out, i < unicode_tables::BlockCount ? unicode_tables::Blocks[i].name : "No_Block");
+			out += ": " + std::to_string(count);
+			first = false;
+		}
+		out += first ? "}" : " }";
+
+		out += ", \"lines\": " + std::to_string(lines);
+		out += ", \"longest_line\": " + std::to_string(longestLine);
+		out += ", \"line_lengths\": {";
+		first = true;
+		for (size_t bucket = 0; bucket < LineBuckets; ++bucket)
+		{
+			if (!lineLengths[bucket])
+				continue;
+			std::string range = bucket < 2 ? std::to_string(bucket) : std::to_string(uint64_t(1) << (bucket - 1)) + "-";
+			if (bucket >= 2 && bucket < LineBuckets - 1)
+				range += std::to_string((uint64_t(1) << bucket) - 1);
+			out += (first ? " \"" : ", \"") + range + "\": " + std::to_string(lineLengths[bucket]);
+			first = false;
+		}
+		out += first ? "}" : " }";
+	}
+
+	// as a JSON string: quotes, backslashes and controls escaped, other bytes
+	// as they are
+	static void AppendJsonString(std::string& out, const char* text)
+	{
+		static const char hex[] = "0123456789abcdef";
+		out += '"';
+		for (; *text; ++text)
+		{
+			const unsigned char c = static_cast<unsigned char>(*text);
+			if (c == '"' || c == '\\')
+				out += '\\';
+			if (c >= 0x20)
+			{
+				out += static_cast<char>(c);
+				continue;
+			}
+			out += "\\u00";
+			out += hex[c >> 4];
+			out += hex[c & 15];
+		}
+		out += '"';
+	}
+
+private:
+	static bool IsLowSurrogate(CharT unit)
+	{
+		return static_cast<uint32_t>(unit) - 0xDC00 < 0x400;
+	}
+
+	// the block of a UTF-16 unit; the mask keeps anything else inside the table
+	static size_t Column(CharT unit)
+	{
+		return unicode_tables::ColumnBlocks[(static_cast<uint32_t>(unit) >> 4) & 0xFFF];
+	}
+
+	// counts the pair, returns the block of its code point
+	size_t PairBlock(uint32_t high, CharT low)
+	{
+		const char32_t cp = 0x10000 + ((high - 0xD800) << 10) + (static_cast<uint32_t>(low) - 0xDC00);
+		++planes[cp >> 16];
+		++pairs;
+		return BlockOf(cp);
+	}
+
+	// index into unicode_tables::Blocks, BlockCount for No_Block
+	size_t BlockOf(char32_t cp)
+	{
+		using unicode_tables::Blocks;
+		if (cp < unicode_tables::ColumnLimit)
+			return unicode_tables::ColumnBlocks[cp >> 4];
+		const unicode_tables::Block& last = Blocks[lastSupplementary];
+		if (cp >= last.first && cp <= last.last)
+			return lastSupplementary;
+		const auto after = std::upper_bound(std::begin(Blocks), std::end(Blocks), cp,
+			[](char32_t value, const unicode_tables::Block& block) { return value < block.first; });
+		if (after == std::begin(Blocks) || cp > std::prev(after)->last)
+			return unicode_tables::BlockCount;
+		lastSupplementary = std::prev(after) - std::begin(Blocks);
+		return lastSupplementary;
+	}
+
+	uint64_t classes[simd::UnitClassCount];
+	uint64_t planes[17];                              // supplementary code points by plane
+	uint64_t blocks[Banks][unicode_tables::BlockCount + 1]; // No_Block last
+	uint64_t lineLengths[LineBuckets];
+	uint64_t units;
+	uint64_t pairs;
+	uint64_t lines;
+	uint64_t longestLine;
+	uint32_t pendingHigh; // high surrogate at the end of the last block, or 0
+	size_t lastSupplementary; // the block of the last code point above the BMP
+};
+
+#endif
@@ -0,0 +1,1445 @@
+#ifndef _0F9B154B_2F60_4B3B_8429_805B31BD7A6B_
+#define  _0F9B154B_2F60_4B3B_8429_805B31BD7A6B_
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include "SimdKernels.h"
+
+enum class TranscodeStatus
+{
+	Ok,         // all input converted
+	Incomplete, // input ends in the middle of a character, feed the rest later
+	Invalid,    // malformed sequence at begin + consumed
+	OutputFull  // stopped because the output range is full
+};
+
+// span in / span out conversion result: consumed bytes, produced code units,
+// and for Invalid / Incomplete the error position is begin + consumed
+struct TranscodeResult
+{
+	size_t consumed;
+	size_t produced;
+	TranscodeStatus status;
+};
+
+// Bulk UTF-8 / UTF-16 / UTF-32 -> UTF-16 conversion. CharT is any type of at least 16
+// bits (char16_t, or wchar_t which is 32 bit outside Windows); either way it
+// receives UTF-16 code units, as std::codecvt_utf8_utf16 does.
+namespace simd
+{
+
+namespace scalar
+{
+
+template<typename CharT>
+inline TranscodeStatus DecodeUtf8Sequence(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+{
+	static_assert(sizeof(CharT) >= 2, "UTF-16 needs at least 16 bit code units");
+	if (out == outEnd)
+		return TranscodeStatus::OutputFull;
+
+	const auto s = reinterpret_cast<const unsigned char*>(p);
+	if (s[0] < 0x80)
+	{
+		*out++ = static_cast<CharT>(s[0]);
+		++p;
+		return TranscodeStatus::Ok;
+	}
+
+	// the common 2 and 3 byte forms without the generic range tables
+	const size_t available = end - p;
+	if (s[0] >= 0xC2 && s[0] < 0xE0 && available >= 2 && (s[1] & 0xC0) == 0x80)
+	{
+		*out++ = static_cast<CharT>(((s[0] & 0x1Fu) << 6) | (s[1] & 0x3Fu));
+		p += 2;
+		return TranscodeStatus::Ok;
+	}
+	if ((s[0] & 0xF0) == 0xE0 && available >= 3 && (s[1] & 0xC0) == 0x80 && (s[2] & 0xC0) == 0x80)
+	{
+		const uint32_t cp = ((s[0] & 0x0Fu) << 12) | ((s[1] & 0x3Fu) << 6) | (s[2] & 0x3Fu);
+		if (cp >= 0x800 && (cp & 0xF800) != 0xD800)
+		{
+			*out++ = static_cast<CharT>(cp);
+			p += 3;
+			return TranscodeStatus::Ok;
+		}
+	}
+
+	const size_t length = Utf8SequenceLength(s, reinterpret_cast<const unsigned char*>(end));
+	if (!length)
+		return IsTruncatedUtf8(p, end) ? TranscodeStatus::Incomplete : TranscodeStatus::Invalid;
+
+	uint32_t cp;
+	switch (length)
+	{
+	case 2:
+		cp = ((s[0] & 0x1Fu) << 6) | (s[1] & 0x3Fu);
+		break;
+	case 3:
+		cp = ((s[0] & 0x0Fu) << 12) | ((s[1] & 0x3Fu) << 6) | (s[2] & 0x3Fu);
+		break;
+	default:
+		cp = ((s[0] & 0x07u) << 18) | ((s[1] & 0x3Fu) << 12) | ((s[2] & 0x3Fu) << 6) | (s[3] & 0x3Fu);
+		if (outEnd - out < 2)
+			return TranscodeStatus::OutputFull;
+		cp -= 0x10000;
+		*out++ = static_cast<CharT>(0xD800 + (cp >> 10));
+		*out++ = static_cast<CharT>(0xDC00 + (cp & 0x3FF));
+		p += length;
+		return TranscodeStatus::Ok;
+	}
+	*out++ = static_cast<CharT>(cp);
+	p += length;
+	return TranscodeStatus::Ok;
+}
+
+template<bool BigEndian>
+inline uint32_t LoadUtf16(const char* p)
+{
+	const auto s = reinterpret_cast<const unsigned char*>(p);
+	return BigEndian ? (s[0] << 8) | s[1] : s[0] | (s[1] << 8);
+}
+
+// the character at p of UTF-16 in either byte order, a unit or a surrogate
+// pair of length bytes; a surrogate must be paired, a high one or a part of a
+// unit at the end of input is Incomplete
+template<bool BigEndian>
+inline TranscodeStatus NextUtf16(const char* p, const char* end, uint32_t& cp, size_t& length)
+{
+	if (end - p < 2)
+		return TranscodeStatus::Incomplete;
+	cp = LoadUtf16<BigEndian>(p);
+	length = 2;
+	if ((cp & 0xF800) != 0xD800)
+		return TranscodeStatus::Ok;
+	if (cp >= 0xDC00)
+		return TranscodeStatus::Invalid;
+	if (end - p < 4)
+		return TranscodeStatus::Incomplete;
+	const uint32_t low = LoadUtf16<BigEndian>(p + 2);
+	if ((low & 0xFC00) != 0xDC00)
+		return TranscodeStatus::Invalid;
+	cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+	length = 4;
+	return TranscodeStatus::Ok;
+}
+
+template<bool BigEndian>
+inline uint32_t LoadUtf32(const char* p)
+{
+	const auto s = reinterpret_cast<const unsigned char*>(p);
+	return BigEndian ? (uint32_t(s[0]) << 24) | (s[1] << 16) | (s[2] << 8) | s[3]
+		: (uint32_t(s[3]) << 24) | (s[2] << 16) | (s[1] << 8) | s[0];
+}
+
+// a code point as one or two UTF-16 units; surrogate code points and values
+// above U+10FFFF are not characters
+template<typename CharT>
+inline TranscodeStatus EncodeUtf16(uint32_t cp, CharT*& out, CharT* outEnd)
+{
+	static_assert(sizeof(CharT) >= 2, "UTF-16 needs at least 16 bit code units");
+	if (cp > 0x10FFFF || (cp & 0xFFFFF800) == 0xD800)
+		return TranscodeStatus::Invalid;
+	if (cp < 0x10000)
+	{
+		if (out == outEnd)
+			return TranscodeStatus::OutputFull;
+		*out++ = static_cast<CharT>(cp);
+		return TranscodeStatus::Ok;
+	}
+	if (outEnd - out < 2)
+		return TranscodeStatus::OutputFull;
+	cp -= 0x10000;
+	*out++ = static_cast<CharT>(0xD800 + (cp >> 10));
+	*out++ = static_cast<CharT>(0xDC00 + (cp & 0x3FF));
+	return TranscodeStatus::Ok;
+}
+
+inline TranscodeStatus EncodeUtf8(uint32_t cp, char*& out, char* outEnd)
+{
+	if (cp > 0x10FFFF || (cp & 0xFFFFF800) == 0xD800)
+		return TranscodeStatus::Invalid;
+	const ptrdiff_t length = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+	if (outEnd - out < length)
+		return TranscodeStatus::OutputFull;
+	switch (length)
+	{
+	case 1:
+		out[0] = static_cast<char>(cp);
+		break;
+	case 2:
+		out[0] = static_cast<char>(0xC0 | (cp >> 6));
+		out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+		break;
+	case 3:
+		out[0] = static_cast<char>(0xE0 | (cp >> 12));
+		out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+		out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+		break;
+	default:
+		out[0] = static_cast<char>(0xF0 | (cp >> 18));
+		out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+		out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+		out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+		break;
+	}
+	out += length;
+	return TranscodeStatus::Ok;
+}
+
+// first byte of the first unit that is a surrogate or above U+10FFFF, or of a
+// partial unit at the end, or end
+template<bool BigEndian>
+inline const char* ValidateUtf32(const char* begin, const char* end)
+{
+	const char* p = begin;
+	for (; end - p >= 4; p += 4)
+	{
+		const uint32_t cp = LoadUtf32<BigEndian>(p);
+		if (cp > 0x10FFFF || (cp & 0xFFFFF800) == 0xD800)
+			break;
+	}
+	return p;
+}
+
+// no-op vector steps: the driver then runs purely on DecodeUtf8Sequence
+struct Utf8Kernels
+{
+	template<typename CharT>
+	static void Ascii(const char*&, const char*, CharT*&, CharT*) {}
+
+	template<typename CharT>
+	static bool MultiByte(const char*&, const char*, CharT*&, CharT*) { return false; }
+};
+
+template<bool BigEndian>
+struct Utf32Kernels
+{
+	template<typename CharT>
+	static void Bmp(const char*&, const char*, CharT*&, CharT*) {}
+
+	static void Ascii(const char*&, const char*, char*&, char*) {}
+};
+
+template<bool BigEndian>
+struct Utf16Kernels
+{
+	template<typename CharT>
+	static void Paired(const char*&, const char*, CharT*&, CharT*) {}
+
+	static void WellFormed(const char*&, const char*) {}
+
+	static void Ascii(const char*&, const char*, char*&, char*) {}
+
+	static bool MultiByte(const char*&, const char*, char*&, char*) { return false; }
+};
+
+struct SingleByteKernels
+{
+	template<typename CharT>
+	static void Ascii(const char*&, const char*, CharT*&, CharT*) {}
+
+	template<typename CharT>
+	static void Mapped(const char16_t*, const char*&, const char*, CharT*&) {}
+};
+
+} // namespace scalar
+
+// Common loop for all instruction sets: vector ASCII runs, vector blocks of
+// uniform 2 or 3 byte sequences (Cyrillic, Greek, CJK...), scalar for the rest.
+template<typename Kernels, typename CharT>
+SIMD_FORCE_INLINE TranscodeResult Utf8ToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	assert(begin <= end && out <= outEnd);
+	const char* p = begin;
+	CharT* o = out;
+	for (;;)
+	{
+		Kernels::Ascii(p, end, o, outEnd);
+		if (Kernels::MultiByte(p, end, o, outEnd))
+			continue;
+		if (p == end)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), TranscodeStatus::Ok };
+
+		const TranscodeStatus status = scalar::DecodeUtf8Sequence(p, end, o, outEnd);
+		if (status != TranscodeStatus::Ok)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), status };
+	}
+}
+
+// UTF-32 in either byte order: vector blocks of BMP characters (ASCII for
+// UTF-8 output), one code point at a time for the rest
+template<typename Kernels, bool BigEndian, typename CharT>
+SIMD_FORCE_INLINE TranscodeResult Utf32ToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	assert(begin <= end && out <= outEnd);
+	const char* p = begin;
+	CharT* o = out;
+	for (;;)
+	{
+		Kernels::Bmp(p, end, o, outEnd);
+		if (end - p < 4)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), p == end ? TranscodeStatus::Ok : TranscodeStatus::Incomplete };
+
+		const TranscodeStatus status = scalar::EncodeUtf16(scalar::LoadUtf32<BigEndian>(p), o, outEnd);
+		if (status != TranscodeStatus::Ok)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), status };
+		p += 4;
+	}
+}
+
+template<typename Kernels, bool BigEndian>
+SIMD_FORCE_INLINE TranscodeResult Utf32ToUtf8(const char* begin, const char* end, char* out, char* outEnd)
+{
+	assert(begin <= end && out <= outEnd);
+	const char* p = begin;
+	char* o = out;
+	for (;;)
+	{
+		Kernels::Ascii(p, end, o, outEnd);
+		if (end - p < 4)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), p == end ? TranscodeStatus::Ok : TranscodeStatus::Incomplete };
+
+		const TranscodeStatus status = scalar::EncodeUtf8(scalar::LoadUtf32<BigEndian>(p), o, outEnd);
+		if (status != TranscodeStatus::Ok)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), status };
+		p += 4;
+	}
+}
+
+// UTF-16 in either byte order: vector blocks byte swapped for big endian,
+// taken when their surrogates are paired; one character at a time for what
+// stopped them
+template<typename Kernels, bool BigEndian, typename CharT>
+SIMD_FORCE_INLINE TranscodeResult Utf16ToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	assert(begin <= end && out <= outEnd);
+	const char* p = begin;
+	CharT* o = out;
+	for (;;)
+	{
+		Kernels::Paired(p, end, o, outEnd);
+		if (p == end)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), TranscodeStatus::Ok };
+
+		uint32_t cp;
+		size_t length;
+		TranscodeStatus status = scalar::NextUtf16<BigEndian>(p, end, cp, length);
+		if (status == TranscodeStatus::Ok)
+			status = scalar::EncodeUtf16(cp, o, outEnd);
+		if (status != TranscodeStatus::Ok)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), status };
+		p += length;
+	}
+}
+
+// the same straight to UTF-8: vector ASCII runs, vector blocks of BMP
+// characters, one character at a time for the rest
+template<typename Kernels, bool BigEndian>
+SIMD_FORCE_INLINE TranscodeResult Utf16ToUtf8(const char* begin, const char* end, char* out, char* outEnd)
+{
+	assert(begin <= end && out <= outEnd);
+	const char* p = begin;
+	char* o = out;
+	for (;;)
+	{
+		Kernels::Ascii(p, end, o, outEnd);
+		if (Kernels::MultiByte(p, end, o, outEnd))
+			continue;
+		if (p == end)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), TranscodeStatus::Ok };
+
+		uint32_t cp;
+		size_t length;
+		TranscodeStatus status = scalar::NextUtf16<BigEndian>(p, end, cp, length);
+		if (status == TranscodeStatus::Ok)
+			status = scalar::EncodeUtf8(cp, o, outEnd);
+		if (status != TranscodeStatus::Ok)
+			return{ static_cast<size_t>(p - begin), static_cast<size_t>(o - out), status };
+		p += length;
+	}
+}
+
+// first byte of the first unit that is not part of well formed UTF-16 (an
+// unpaired surrogate, a high surrogate or a byte at the end), or end
+template<typename Kernels, bool BigEndian>
+SIMD_FORCE_INLINE const char* ValidateUtf16(const char* begin, const char* end)
+{
+	assert(begin <= end);
+	const char* p = begin;
+	for (;;)
+	{
+		Kernels::WellFormed(p, end);
+		uint32_t cp;
+		size_t length;
+		if (p == end || scalar::NextUtf16<BigEndian>(p, end, cp, length) != TranscodeStatus::Ok)
+			return p;
+		p += length;
+	}
+}
+
+// Single byte code pages through the table of their upper half (CodePages.h):
+// vector ASCII runs, vector lookups where the instruction set has a wide
+// enough permute, one lookup per byte up to the next block for the rest.
+// There are no errors, all that can stop it is the output.
+template<typename Kernels, typename CharT>
+SIMD_FORCE_INLINE TranscodeResult SingleByteToUtf16(const char16_t* high, const char* begin, const char* end, CharT* out, CharT* outEnd)
+{
+	assert(begin <= end && out <= outEnd);
+	const size_t size = end - begin;
+	const size_t count = size < static_cast<size_t>(outEnd - out) ? size : outEnd - out;
+	const char* p = begin;
+	const char* const stop = begin + count;
+	CharT* o = out;
+	while (p != stop)
+	{
+		Kernels::Ascii(p, stop, o, outEnd);
+		Kernels::Mapped(high, p, stop, o);
+		const char* blockEnd = stop - p > 16 ? p + 16 : stop;
+		for (; p != blockEnd; ++p)
+		{
+			const unsigned char c = static_cast<unsigned char>(*p);
+			*o++ = static_cast<CharT>(c < 0x80 ? c : high[c - 0x80]);
+		}
+	}
+	return{ count, count, count == size ? TranscodeStatus::Ok : TranscodeStatus::OutputFull };
+}
+
+// The conversions Dispatch.h binds, stamped out in every instruction set
+// namespace over its Utf8Kernels / Utf16Kernels / Utf32Kernels /
+// SingleByteKernels; the drivers are force inlined so that the vector steps
+// inline into them too.
+#define SIMD_TRANSCODE_ENTRY_POINTS \
+	template<typename CharT> \
+	inline TranscodeResult Utf8ToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd) \
+	{ \
+		return simd::Utf8ToUtf16<Utf8Kernels>(begin, end, out, outEnd); \
+	} \
+	template<bool BigEndian, typename CharT> \
+	inline TranscodeResult Utf32ToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd) \
+	{ \
+		return simd::Utf32ToUtf16<Utf32Kernels<BigEndian>, BigEndian>(begin, end, out, outEnd); \
+	} \
+	template<bool BigEndian> \
+	inline TranscodeResult Utf32ToUtf8(const char* begin, const char* end, char* out, char* outEnd) \
+	{ \
+		return simd::Utf32ToUtf8<Utf32Kernels<BigEndian>, BigEndian>(begin, end, out, outEnd); \
+	} \
+	template<bool BigEndian, typename CharT> \
+	inline TranscodeResult Utf16ToUtf16(const char* begin, const char* end, CharT* out, CharT* outEnd) \
+	{ \
+		return simd::Utf16ToUtf16<Utf16Kernels<BigEndian>, BigEndian>(begin, end, out, outEnd); \
+	} \
+	template<bool BigEndian> \
+	inline TranscodeResult Utf16ToUtf8(const char* begin, const char* end, char* out, char* outEnd) \
+	{ \
+		return simd::Utf16ToUtf8<Utf16Kernels<BigEndian>, BigEndian>(begin, end, out, outEnd); \
+	} \
+	template<bool BigEndian> \
+	inline const char* ValidateUtf16(const char* begin, const char* end) \
+	{ \
+		return simd::ValidateUtf16<Utf16Kernels<BigEndian>, BigEndian>(begin, end); \
+	} \
+	template<typename CharT> \
+	inline TranscodeResult SingleByteToUtf16(const char16_t* high, const char* begin, const char* end, CharT* out, CharT* outEnd) \
+	{ \
+		return simd::SingleByteToUtf16<SingleByteKernels>(high, begin, end, out, outEnd); \
+	}
+
+namespace scalar
+{
+SIMD_TRANSCODE_ENTRY_POINTS
+} // namespace scalar
+
+#if SIMD_KERNELS_SSE42
+SIMD_TARGET_SSE42
+namespace sse42
+{
+
+// store 4 / 8 UTF-16 code units held in 16 bit lanes
+inline void Store4(char16_t* out, __m128i units) { _mm_storel_epi64(reinterpret_cast<__m128i*>(out), units); }
+inline void Store8(char16_t* out, __m128i units) { _mm_storeu_si128(reinterpret_cast<__m128i*>(out), units); }
+inline void Store4(char32_t* out, __m128i units) { _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_cvtepu16_epi32(units)); }
+inline void Store8(char32_t* out, __m128i units)
+{
+	Store4(out, units);
+	Store4(out + 4, _mm_srli_si128(units, 8));
+}
+
+struct Utf8Kernels
+{
+	template<typename CharT>
+	static void Ascii(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		while (end - p >= 16 && outEnd - out >= 16)
+		{
+			// mixed blocks are cheaper in MultiByte than split here
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			if (_mm_movemask_epi8(v))
+				return;
+			Store8(AsUnits(out), _mm_unpacklo_epi8(v, zero));
+			Store8(AsUnits(out) + 8, _mm_unpackhi_epi8(v, zero));
+			p += 16;
+			out += 16;
+		}
+	}
+
+	// Any mix of 1, 2 and 3 byte sequences in a 16 byte block: every position is
+	// decoded as if a sequence started there, then the lanes of real sequence
+	// starts are packed together. 4 byte sequences are left to the scalar code.
+	template<typename CharT>
+	static bool MultiByte(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		if (end - p < 18 || outEnd - out < 16)
+			return false;
+		const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+		const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+
+		const __m128i isCont = _mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(-64)), _mm_set1_epi8(-128));
+		const __m128i isLead2 = _mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(-32)), _mm_set1_epi8(-64));
+		const __m128i isLead3 = _mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(-16)), _mm_set1_epi8(-32));
+		// 4 byte leads, F5..FF and the overlong C0 / C1
+		const __m128i isOther = _mm_or_si128(_mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(-16)), _mm_set1_epi8(-16)),
+			_mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(-2)), _mm_set1_epi8(-64)));
+		if (_mm_movemask_epi8(isOther))
+			return false;
+
+		const uint32_t cont = _mm_movemask_epi8(isCont);
+		const uint32_t lead2 = _mm_movemask_epi8(isLead2);
+		const uint32_t lead3 = _mm_movemask_epi8(isLead3);
+		const uint32_t starts = ~cont & 0xFFFF;
+		// the block ends at the first sequence start in 12..14, so that every
+		// sequence taken lies completely inside the 16 loaded bytes
+		if (!(starts & 0x7000))
+			return false;
+		const int length = 12 + CountTrailingZeros(starts >> 12);
+		const uint32_t expected = ((lead2 | lead3) << 1) | (lead3 << 2);
+		if ((cont ^ expected) & ((2u << length) - 1))
+			return false;
+
+		__m128i units[2];
+		const __m128i zero = _mm_setzero_si128();
+		__m128i bad = zero;
+		for (int half = 0; half < 2; ++half)
+		{
+			const __m128i b = _mm_cvtepu8_epi16(half ? _mm_srli_si128(v0, 8) : v0);
+			const __m128i n1 = _mm_and_si128(_mm_cvtepu8_epi16(half ? _mm_srli_si128(v1, 8) : v1), _mm_set1_epi16(0x3F));
+			const __m128i n2 = _mm_and_si128(_mm_cvtepu8_epi16(half ? _mm_srli_si128(v2, 8) : v2), _mm_set1_epi16(0x3F));
+			const __m128i lead2Lanes = _mm_cvtepi8_epi16(half ? _mm_srli_si128(isLead2, 8) : isLead2);
+			const __m128i lead3Lanes = _mm_cvtepi8_epi16(half ? _mm_srli_si128(isLead3, 8) : isLead3);
+
+			const __m128i cp2 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, _mm_set1_epi16(0x1F)), 6), n1);
+			const __m128i cp3 = _mm_or_si128(_mm_slli_epi16(b, 12), _mm_or_si128(_mm_slli_epi16(n1, 6), n2));
+			units[half] = _mm_blendv_epi8(_mm_blendv_epi8(b, cp2, lead2Lanes), cp3, lead3Lanes);
+
+			// 3 byte overlong forms and surrogates
+			const __m128i overlong = _mm_cmpeq_epi16(_mm_min_epu16(cp3, _mm_set1_epi16(0x7FF)), cp3);
+			const __m128i surrogate = _mm_cmpeq_epi16(_mm_and_si128(cp3, _mm_set1_epi16(static_cast<short>(0xF800))), _mm_set1_epi16(static_cast<short>(0xD800)));
+			const __m128i invalid = _mm_and_si128(lead3Lanes, _mm_or_si128(overlong, surrogate));
+			bad = half ? _mm_packs_epi16(bad, invalid) : invalid;
+		}
+		const uint32_t taken = starts & ((1u << length) - 1);
+		if (_mm_movemask_epi8(bad) & taken)
+			return false;
+
+		const uint32_t low = taken & 0xFF;
+		const uint32_t high = taken >> 8;
+		const int lowCount = PopCount(low);
+		Store8(AsUnits(out), _mm_shuffle_epi8(units[0], PackTable().masks[low]));
+		Store8(AsUnits(out) + lowCount, _mm_shuffle_epi8(units[1], PackTable().masks[high]));
+		p += length;
+		out += lowCount + PopCount(high);
+		return true;
+	}
+
+private:
+	// pshufb masks moving the 16 bit lanes selected by an 8 bit mask to the front
+	struct LeftPack
+	{
+		__m128i masks[256];
+
+		LeftPack()
+		{
+			for (int mask = 0; mask < 256; ++mask)
+			{
+				alignas(16) char bytes[16];
+				int n = 0;
+				for (int lane = 0; lane < 8; ++lane)
+				{
+					if (mask & (1 << lane))
+					{
+						bytes[n++] = static_cast<char>(lane * 2);
+						bytes[n++] = static_cast<char>(lane * 2 + 1);
+					}
+				}
+				while (n < 16)
+					bytes[n++] = static_cast<char>(0x80);
+				masks[mask] = _mm_load_si128(reinterpret_cast<const __m128i*>(bytes));
+			}
+		}
+	};
+
+	static const LeftPack& PackTable()
+	{
+		static const LeftPack table;
+		return table;
+	}
+};
+
+// 8 code points per step: byte swap for big endian, then pack the 32 bit
+// lanes to 16 bits once they are known to be BMP and not surrogates
+template<bool BigEndian>
+struct Utf32Kernels
+{
+	static __m128i Load(const char* p)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		return BigEndian ? _mm_shuffle_epi8(v, _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)) : v;
+	}
+
+	template<typename CharT>
+	static void Bmp(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 32 && outEnd - out >= 8)
+		{
+			const __m128i a = Load(p);
+			const __m128i b = Load(p + 16);
+			if (!_mm_testz_si128(_mm_or_si128(a, b), _mm_set1_epi32(static_cast<int>(0xFFFF0000))))
+				return;
+			const __m128i units = _mm_packus_epi32(a, b);
+			const __m128i surrogate = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16(static_cast<short>(0xF800))),
+				_mm_set1_epi16(static_cast<short>(0xD800)));
+			if (_mm_movemask_epi8(surrogate))
+				return;
+			Store8(AsUnits(out), units);
+			p += 32;
+			out += 8;
+		}
+	}
+
+	// 16 code points below 0x80 become 16 bytes
+	static void Ascii(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		while (end - p >= 64 && outEnd - out >= 16)
+		{
+			const __m128i a = Load(p);
+			const __m128i b = Load(p + 16);
+			const __m128i c = Load(p + 32);
+			const __m128i d = Load(p + 48);
+			if (!_mm_testz_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), _mm_set1_epi32(static_cast<int>(0xFFFFFF80))))
+				return;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d)));
+			p += 64;
+			out += 16;
+		}
+	}
+};
+
+// 8 units per step: byte swap for big endian, then the block is taken up to
+// its last unit when every high surrogate in it is followed by a low one and
+// every low one follows a high one; a high surrogate in the last lane waits
+// for the next block
+template<bool BigEndian>
+struct Utf16Kernels
+{
+	static __m128i Load(const char* p)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		return BigEndian ? _mm_shuffle_epi8(v, _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)) : v;
+	}
+
+	// units of the block that may be passed on, 0 if a surrogate is unpaired
+	static int Taken(__m128i units)
+	{
+		const __m128i top = _mm_and_si128(units, _mm_set1_epi16(static_cast<short>(0xFC00)));
+		const uint32_t high = _mm_movemask_epi8(_mm_cmpeq_epi16(top, _mm_set1_epi16(static_cast<short>(0xD800))));
+		const uint32_t low = _mm_movemask_epi8(_mm_cmpeq_epi16(top, _mm_set1_epi16(static_cast<short>(0xDC00))));
+		if (low != ((high << 2) & 0xFFFF))
+			return 0;
+		return 8 - static_cast<int>(high >> 15);
+	}
+
+	template<typename CharT>
+	static void Paired(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 16 && outEnd - out >= 8)
+		{
+			const __m128i units = Load(p);
+			const int taken = Taken(units);
+			if (!taken)
+				return;
+			Store8(AsUnits(out), units);
+			p += 2 * taken;
+			out += taken;
+		}
+	}
+
+	static void WellFormed(const char*& p, const char* end)
+	{
+		while (end - p >= 16)
+		{
+			const int taken = Taken(Load(p));
+			if (!taken)
+				return;
+			p += 2 * taken;
+		}
+	}
+
+	// 16 units below 0x80 become 16 bytes
+	static void Ascii(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		while (end - p >= 32 && outEnd - out >= 16)
+		{
+			const __m128i a = Load(p);
+			const __m128i b = Load(p + 16);
+			if (!_mm_testz_si128(_mm_or_si128(a, b), _mm_set1_epi16(static_cast<short>(0xFF80))))
+				return;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(a, b));
+			p += 32;
+			out += 16;
+		}
+	}
+
+	// 8 units of characters of 1 to 4 bytes in any mix per step: every unit is
+	// encoded as 3 bytes of a 32 bit lane, the bytes its length keeps are then
+	// packed together, 4 lanes at a time. A surrogate pair gives 2 bytes in each
+	// of its lanes; with a high surrogate in the last lane only the first 4 are
+	// taken. An ASCII block ends the steps, the driver has a faster one for it.
+	static bool MultiByte(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		const char* const start = p;
+		const Utf8Pack& table = PackTable();
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i trail = _mm_set1_epi16(0x80);
+		const __m128i bits = _mm_set1_epi16(0x3F);
+		while (end - p >= 16 && outEnd - out >= 28)
+		{
+			const __m128i units = Load(p);
+			const __m128i top = _mm_and_si128(units, _mm_set1_epi16(static_cast<short>(0xFC00)));
+			const __m128i high = _mm_cmpeq_epi16(top, _mm_set1_epi16(static_cast<short>(0xD800)));
+			const __m128i low = _mm_cmpeq_epi16(top, _mm_set1_epi16(static_cast<short>(0xDC00)));
+			const uint32_t highBits = _mm_movemask_epi8(high);
+			const uint32_t lowBits = _mm_movemask_epi8(low);
+			if (lowBits != ((highBits << 2) & 0xFFFF) || (highBits & 0x80 && highBits >> 15))
+				break;
+
+			const __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16(static_cast<short>(0xFF80))), zero);
+			const __m128i small = _mm_cmpeq_epi16(_mm_and_si128(units, _mm_set1_epi16(static_cast<short>(0xF800))), zero);
+			const __m128i last = _mm_or_si128(trail, _mm_and_si128(units, bits));
+			__m128i middle = _mm_blendv_epi8(_mm_or_si128(trail, _mm_and_si128(_mm_srli_epi16(units, 6), bits)), last, small);
+			__m128i lead = _mm_blendv_epi8(_mm_blendv_epi8(_mm_or_si128(_mm_set1_epi16(0xE0), _mm_srli_epi16(units, 12)),
+				_mm_or_si128(_mm_set1_epi16(0xC0), _mm_srli_epi16(units, 6)), small), units, ascii);
+			__m128i twoBytes = small;
+			if (lowBits)
+			{
+				// the code point >> 10 in the high lane, its low 2 bits go to the low lane
+				const __m128i surrogate = _mm_or_si128(high, low);
+				const __m128i plane = _mm_add_epi16(_mm_and_si128(units, _mm_set1_epi16(0x3FF)), _mm_set1_epi16(0x40));
+				const __m128i carried = _mm_slli_epi16(_mm_and_si128(_mm_slli_si128(plane, 2), _mm_set1_epi16(3)), 4);
+				const __m128i pairLead = _mm_blendv_epi8(_mm_or_si128(_mm_or_si128(trail, carried), _mm_and_si128(_mm_srli_epi16(units, 6), _mm_set1_epi16(0xF))),
+					_mm_or_si128(_mm_set1_epi16(0xF0), _mm_srli_epi16(plane, 8)), high);
+				const __m128i pairMiddle = _mm_blendv_epi8(last, _mm_or_si128(trail, _mm_and_si128(_mm_srli_epi16(plane, 2), bits)), high);
+				lead = _mm_blendv_epi8(lead, pairLead, surrogate);
+				middle = _mm_blendv_epi8(middle, pairMiddle, surrogate);
+				twoBytes = _mm_or_si128(small, surrogate);
+			}
+			const __m128i leadMiddle = _mm_or_si128(lead, _mm_slli_epi16(middle, 8));
+
+			const uint32_t lengths = _mm_movemask_epi8(_mm_packs_epi16(ascii, twoBytes));
+			const uint32_t first = (lengths & 0xF) | ((lengths >> 4) & 0xF0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(_mm_unpacklo_epi16(leadMiddle, last), table.masks[first]));
+			out += table.lengths[first];
+			if (highBits >> 15)
+			{
+				p += 8;
+				continue;
+			}
+			const uint32_t second = ((lengths >> 4) & 0xF) | ((lengths >> 8) & 0xF0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(_mm_unpackhi_epi16(leadMiddle, last), table.masks[second]));
+			out += table.lengths[second];
+			p += 16;
+			if ((lengths & 0xFF) == 0xFF)
+				break;
+		}
+		return p != start;
+	}
+
+private:
+	// pshufb masks keeping the first 1, 2 or 3 bytes of four 32 bit lanes, by
+	// the 4 bits of ASCII lanes and the 4 bits of 2 byte lanes (below U+0800,
+	// or a surrogate)
+	struct Utf8Pack
+	{
+		__m128i masks[256];
+		uint8_t lengths[256];
+
+		Utf8Pack()
+		{
+			for (int key = 0; key < 256; ++key)
+			{
+				alignas(16) char bytes[16];
+				int n = 0;
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					const int length = key & (1 << lane) ? 1 : key & (16 << lane) ? 2 : 3;
+					for (int i = 0; i < length; ++i)
+						bytes[n++] = static_cast<char>(lane * 4 + i);
+				}
+				lengths[key] = static_cast<uint8_t>(n);
+				while (n < 16)
+					bytes[n++] = static_cast<char>(0x80);
+				masks[key] = _mm_load_si128(reinterpret_cast<const __m128i*>(bytes));
+			}
+		}
+	};
+
+	static const Utf8Pack& PackTable()
+	{
+		static const Utf8Pack table;
+		return table;
+	}
+};
+
+// the ASCII step of UTF-8, table lookups are left to the driver
+struct SingleByteKernels : Utf8Kernels
+{
+	template<typename CharT>
+	static void Mapped(const char16_t*, const char*&, const char*, CharT*&) {}
+};
+
+SIMD_TRANSCODE_ENTRY_POINTS
+
+} // namespace sse42
+SIMD_TARGET_END
+#endif
+
+#if SIMD_KERNELS_AVX2
+SIMD_TARGET_AVX2
+namespace avx2
+{
+
+struct Utf8Kernels : sse42::Utf8Kernels
+{
+	template<typename CharT>
+	static void Ascii(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 32 && outEnd - out >= 32)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			const uint32_t mask = _mm256_movemask_epi8(v);
+			if (mask)
+				break;
+			const __m128i low = _mm256_castsi256_si128(v);
+			const __m128i high = _mm256_extracti128_si256(v, 1);
+			if (sizeof(CharT) == 2)
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu8_epi16(low));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16), _mm256_cvtepu8_epi16(high));
+			}
+			else
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu8_epi32(low));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16), _mm256_cvtepu8_epi32(high));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)));
+			}
+			p += 32;
+			out += 32;
+		}
+		sse42::Utf8Kernels::Ascii(p, end, out, outEnd);
+	}
+};
+
+template<bool BigEndian>
+struct Utf32Kernels : sse42::Utf32Kernels<BigEndian>
+{
+	static __m256i Load(const char* p)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		return BigEndian ? _mm256_shuffle_epi8(v, _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)) : v;
+	}
+
+	template<typename CharT>
+	static void Bmp(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 64 && outEnd - out >= 16)
+		{
+			const __m256i a = Load(p);
+			const __m256i b = Load(p + 32);
+			if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_set1_epi32(static_cast<int>(0xFFFF0000))))
+				break;
+			// pack works per 128 bit lane, the permute puts the units back in order
+			const __m256i units = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+			const __m256i surrogate = _mm256_cmpeq_epi16(_mm256_and_si256(units, _mm256_set1_epi16(static_cast<short>(0xF800))),
+				_mm256_set1_epi16(static_cast<short>(0xD800)));
+			if (_mm256_movemask_epi8(surrogate))
+				break;
+			if (sizeof(CharT) == 2)
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), units);
+			else
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(units)));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(units, 1)));
+			}
+			p += 64;
+			out += 16;
+		}
+		sse42::Utf32Kernels<BigEndian>::Bmp(p, end, out, outEnd);
+	}
+};
+
+// 16 units per step, like the SSE4.2 kernels; UTF-8 output of other than
+// ASCII is left to them
+template<bool BigEndian>
+struct Utf16Kernels : sse42::Utf16Kernels<BigEndian>
+{
+	static __m256i Load(const char* p)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		return BigEndian ? _mm256_shuffle_epi8(v, _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)) : v;
+	}
+
+	static int Taken(__m256i units)
+	{
+		const __m256i top = _mm256_and_si256(units, _mm256_set1_epi16(static_cast<short>(0xFC00)));
+		const uint32_t high = _mm256_movemask_epi8(_mm256_cmpeq_epi16(top, _mm256_set1_epi16(static_cast<short>(0xD800))));
+		const uint32_t low = _mm256_movemask_epi8(_mm256_cmpeq_epi16(top, _mm256_set1_epi16(static_cast<short>(0xDC00))));
+		if (low != high << 2)
+			return 0;
+		return 16 - static_cast<int>(high >> 31);
+	}
+
+	template<typename CharT>
+	static void Paired(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 32 && outEnd - out >= 16)
+		{
+			const __m256i units = Load(p);
+			const int taken = Taken(units);
+			if (!taken)
+				break;
+			if (sizeof(CharT) == 2)
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), units);
+			else
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(units)));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(units, 1)));
+			}
+			p += 2 * taken;
+			out += taken;
+		}
+		sse42::Utf16Kernels<BigEndian>::Paired(p, end, out, outEnd);
+	}
+
+	static void WellFormed(const char*& p, const char* end)
+	{
+		while (end - p >= 32)
+		{
+			const int taken = Taken(Load(p));
+			if (!taken)
+				break;
+			p += 2 * taken;
+		}
+		sse42::Utf16Kernels<BigEndian>::WellFormed(p, end);
+	}
+
+	// 32 units below 0x80 become 32 bytes
+	static void Ascii(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		while (end - p >= 64 && outEnd - out >= 32)
+		{
+			const __m256i a = Load(p);
+			const __m256i b = Load(p + 32);
+			if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_set1_epi16(static_cast<short>(0xFF80))))
+				break;
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+			p += 64;
+			out += 32;
+		}
+		sse42::Utf16Kernels<BigEndian>::Ascii(p, end, out, outEnd);
+	}
+};
+
+// 16 bytes per step: the units of the upper half come from two masked
+// gathers of 32 bits (the last one reads the padding unit of the table),
+// ASCII lanes keep their byte
+struct SingleByteKernels : Utf8Kernels
+{
+	template<typename CharT>
+	static void Mapped(const char16_t* high, const char*& p, const char* end, CharT*& out)
+	{
+		const int* table = reinterpret_cast<const int*>(high);
+		const __m256i ascii = _mm256_set1_epi32(0x7F);
+		const __m256i upper = _mm256_set1_epi32(0x80);
+		const __m256i unit = _mm256_set1_epi32(0xFFFF);
+		while (end - p >= 16)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const __m256i a = _mm256_cvtepu8_epi32(v);
+			const __m256i b = _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8));
+			// masked off lanes are not read, their index is negative
+			const __m256i ua = _mm256_and_si256(_mm256_mask_i32gather_epi32(a, table, _mm256_sub_epi32(a, upper), _mm256_cmpgt_epi32(a, ascii), 2), unit);
+			const __m256i ub = _mm256_and_si256(_mm256_mask_i32gather_epi32(b, table, _mm256_sub_epi32(b, upper), _mm256_cmpgt_epi32(b, ascii), 2), unit);
+			if (sizeof(CharT) == 2)
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute4x64_epi64(_mm256_packus_epi32(ua, ub), 0xD8));
+			else
+			{
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), ua);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), ub);
+			}
+			p += 16;
+			out += 16;
+		}
+	}
+};
+
+SIMD_TRANSCODE_ENTRY_POINTS
+
+} // namespace avx2
+SIMD_TARGET_END
+#endif
+
+#if SIMD_KERNELS_AVX512
+SIMD_TARGET_AVX512
+namespace avx512
+{
+
+struct Utf8Kernels : avx2::Utf8Kernels
+{
+	template<typename CharT>
+	static void Ascii(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 64 && outEnd - out >= 64)
+		{
+			const __m512i v = _mm512_loadu_si512(p);
+			if (_mm512_movepi8_mask(v))
+				break;
+			// the parts are loaded again rather than extracted, the loads are in L1
+			if (sizeof(CharT) == 2)
+			{
+				_mm512_storeu_si512(out, _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))));
+				_mm512_storeu_si512(out + 32, _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32))));
+			}
+			else
+			{
+				for (int i = 0; i < 64; i += 16)
+					_mm512_storeu_si512(out + i, _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i))));
+			}
+			p += 64;
+			out += 64;
+		}
+		avx2::Utf8Kernels::Ascii(p, end, out, outEnd);
+	}
+};
+
+// 32 code points per step, like the AVX2 kernels with twice the width
+template<bool BigEndian>
+struct Utf32Kernels : avx2::Utf32Kernels<BigEndian>
+{
+	static __m512i Load(const char* p)
+	{
+		const __m512i v = _mm512_loadu_si512(p);
+		return BigEndian ? _mm512_shuffle_epi8(v, _mm512_set4_epi32(0x0C0D0E0F, 0x08090A0B, 0x04050607, 0x00010203)) : v;
+	}
+
+	template<typename CharT>
+	static void Bmp(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		const __m512i high = _mm512_set1_epi32(static_cast<int>(0xFFFF0000));
+		const __m512i surrogateMask = _mm512_set1_epi32(0xF800);
+		const __m512i surrogate = _mm512_set1_epi32(0xD800);
+		while (end - p >= 128 && outEnd - out >= 32)
+		{
+			const __m512i a = Load(p);
+			const __m512i b = Load(p + 64);
+			if (_mm512_test_epi32_mask(_mm512_or_si512(a, b), high))
+				break;
+			if (_mm512_cmpeq_epi32_mask(_mm512_and_si512(a, surrogateMask), surrogate)
+				| _mm512_cmpeq_epi32_mask(_mm512_and_si512(b, surrogateMask), surrogate))
+				break;
+			// pack works per 128 bit lane, the permute puts the 64 bit groups back in order
+			if (sizeof(CharT) == 2)
+				_mm512_storeu_si512(out, _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), _mm512_packus_epi32(a, b)));
+			else
+			{
+				_mm512_storeu_si512(out, a);
+				_mm512_storeu_si512(out + 16, b);
+			}
+			p += 128;
+			out += 32;
+		}
+		avx2::Utf32Kernels<BigEndian>::Bmp(p, end, out, outEnd);
+	}
+
+	// 64 code points below 0x80 become 64 bytes
+	static void Ascii(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		const __m512i nonAscii = _mm512_set1_epi32(static_cast<int>(0xFFFFFF80));
+		const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+		while (end - p >= 256 && outEnd - out >= 64)
+		{
+			const __m512i a = Load(p);
+			const __m512i b = Load(p + 64);
+			const __m512i c = Load(p + 128);
+			const __m512i d = Load(p + 192);
+			if (_mm512_test_epi32_mask(_mm512_or_si512(_mm512_or_si512(a, b), _mm512_or_si512(c, d)), nonAscii))
+				break;
+			const __m512i bytes = _mm512_packus_epi16(_mm512_packus_epi32(a, b), _mm512_packus_epi32(c, d));
+			_mm512_storeu_si512(out, _mm512_permutexvar_epi32(order, bytes));
+			p += 256;
+			out += 64;
+		}
+		avx2::Utf32Kernels<BigEndian>::Ascii(p, end, out, outEnd);
+	}
+};
+
+// 32 units per step, like the AVX2 kernels with twice the width
+template<bool BigEndian>
+struct Utf16Kernels : avx2::Utf16Kernels<BigEndian>
+{
+	static __m512i Load(const char* p)
+	{
+		const __m512i v = _mm512_loadu_si512(p);
+		return BigEndian ? _mm512_shuffle_epi8(v, _mm512_set4_epi32(0x0E0F0C0D, 0x0A0B0809, 0x06070405, 0x02030001)) : v;
+	}
+
+	static int Taken(__m512i units)
+	{
+		const __m512i top = _mm512_and_si512(units, _mm512_set1_epi16(static_cast<short>(0xFC00)));
+		const uint32_t high = _mm512_cmpeq_epi16_mask(top, _mm512_set1_epi16(static_cast<short>(0xD800)));
+		const uint32_t low = _mm512_cmpeq_epi16_mask(top, _mm512_set1_epi16(static_cast<short>(0xDC00)));
+		if (low != high << 1)
+			return 0;
+		return 32 - static_cast<int>(high >> 31);
+	}
+
+	template<typename CharT>
+	static void Paired(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 64 && outEnd - out >= 32)
+		{
+			const __m512i units = Load(p);
+			const int taken = Taken(units);
+			if (!taken)
+				break;
+			if (sizeof(CharT) == 2)
+				_mm512_storeu_si512(out, units);
+			else
+			{
+				_mm512_storeu_si512(out, _mm512_cvtepu16_epi32(_mm512_castsi512_si256(units)));
+				_mm512_storeu_si512(out + 16, _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(units, 1)));
+			}
+			p += 2 * taken;
+			out += taken;
+		}
+		avx2::Utf16Kernels<BigEndian>::Paired(p, end, out, outEnd);
+	}
+
+	static void WellFormed(const char*& p, const char* end)
+	{
+		while (end - p >= 64)
+		{
+			const int taken = Taken(Load(p));
+			if (!taken)
+				break;
+			p += 2 * taken;
+		}
+		avx2::Utf16Kernels<BigEndian>::WellFormed(p, end);
+	}
+
+	// 64 units below 0x80 become 64 bytes
+	static void Ascii(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		const __m512i nonAscii = _mm512_set1_epi16(static_cast<short>(0xFF80));
+		const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+		while (end - p >= 128 && outEnd - out >= 64)
+		{
+			const __m512i a = Load(p);
+			const __m512i b = Load(p + 64);
+			if (_mm512_test_epi16_mask(_mm512_or_si512(a, b), nonAscii))
+				break;
+			_mm512_storeu_si512(out, _mm512_permutexvar_epi64(order, _mm512_packus_epi16(a, b)));
+			p += 128;
+			out += 64;
+		}
+		avx2::Utf16Kernels<BigEndian>::Ascii(p, end, out, outEnd);
+	}
+};
+
+// 32 bytes per step whatever their mix: the 128 units of the upper half are
+// four registers, two word permutes over 64 of them each and bit 6 of the
+// byte picks the result, bit 7 whether it replaces the byte
+struct SingleByteKernels : Utf8Kernels
+{
+	template<typename CharT>
+	static void Mapped(const char16_t* high, const char*& p, const char* end, CharT*& out)
+	{
+		if (end - p < 32)
+			return;
+		const __m512i t0 = _mm512_loadu_si512(high);
+		const __m512i t1 = _mm512_loadu_si512(high + 32);
+		const __m512i t2 = _mm512_loadu_si512(high + 64);
+		const __m512i t3 = _mm512_loadu_si512(high + 96);
+		const __m512i upper = _mm512_set1_epi16(0x40);
+		const __m512i nonAscii = _mm512_set1_epi16(0x80);
+		while (end - p >= 32)
+		{
+			const __m512i bytes = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+			const __m512i low = _mm512_permutex2var_epi16(t0, bytes, t1);
+			const __m512i top = _mm512_permutex2var_epi16(t2, bytes, t3);
+			const __m512i mapped = _mm512_mask_blend_epi16(_mm512_test_epi16_mask(bytes, upper), low, top);
+			const __m512i units = _mm512_mask_blend_epi16(_mm512_test_epi16_mask(bytes, nonAscii), bytes, mapped);
+			if (sizeof(CharT) == 2)
+				_mm512_storeu_si512(out, units);
+			else
+			{
+				_mm512_storeu_si512(out, _mm512_cvtepu16_epi32(_mm512_castsi512_si256(units)));
+				_mm512_storeu_si512(out + 16, _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(units, 1)));
+			}
+			p += 32;
+			out += 32;
+		}
+	}
+};
+
+SIMD_TRANSCODE_ENTRY_POINTS
+
+} // namespace avx512
+SIMD_TARGET_END
+#endif
+
+#if SIMD_KERNELS_NEON
+namespace neon
+{
+
+inline void Store16(char16_t* out, uint16x8_t low, uint16x8_t high)
+{
+	vst1q_u16(reinterpret_cast<uint16_t*>(out), low);
+	vst1q_u16(reinterpret_cast<uint16_t*>(out) + 8, high);
+}
+
+inline void Store16(char32_t* out, uint16x8_t low, uint16x8_t high)
+{
+	uint32_t* o = reinterpret_cast<uint32_t*>(out);
+	vst1q_u32(o, vmovl_u16(vget_low_u16(low)));
+	vst1q_u32(o + 4, vmovl_u16(vget_high_u16(low)));
+	vst1q_u32(o + 8, vmovl_u16(vget_low_u16(high)));
+	vst1q_u32(o + 12, vmovl_u16(vget_high_u16(high)));
+}
+
+inline void Store8(char16_t* out, uint16x8_t units) { vst1q_u16(reinterpret_cast<uint16_t*>(out), units); }
+
+inline void Store8(char32_t* out, uint16x8_t units)
+{
+	uint32_t* o = reinterpret_cast<uint32_t*>(out);
+	vst1q_u32(o, vmovl_u16(vget_low_u16(units)));
+	vst1q_u32(o + 4, vmovl_u16(vget_high_u16(units)));
+}
+
+struct Utf8Kernels
+{
+	template<typename CharT>
+	static void Ascii(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 16 && outEnd - out >= 16)
+		{
+			const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+			if (vmaxvq_u8(v) >= 0x80)
+				return;
+			Store16(AsUnits(out), vmovl_u8(vget_low_u8(v)), vmovl_u8(vget_high_u8(v)));
+			p += 16;
+			out += 16;
+		}
+	}
+
+	// vld3 / vld2 de-interleave the sequence bytes into separate registers
+	template<typename CharT>
+	static bool MultiByte(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		if (end - p >= 48 && outEnd - out >= 16)
+		{
+			const uint8x16x3_t b = vld3q_u8(reinterpret_cast<const uint8_t*>(p));
+			const uint8x16_t ok = vandq_u8(vceqq_u8(vandq_u8(b.val[0], vdupq_n_u8(0xF0)), vdupq_n_u8(0xE0)),
+				vandq_u8(vceqq_u8(vandq_u8(b.val[1], vdupq_n_u8(0xC0)), vdupq_n_u8(0x80)),
+					vceqq_u8(vandq_u8(b.val[2], vdupq_n_u8(0xC0)), vdupq_n_u8(0x80))));
+			if (vminvq_u8(ok) == 0xFF)
+			{
+				uint16x8_t units[2];
+				bool valid = true;
+				for (int half = 0; half < 2; ++half)
+				{
+					const uint8x8_t b0 = half ? vget_high_u8(b.val[0]) : vget_low_u8(b.val[0]);
+					const uint8x8_t b1 = half ? vget_high_u8(b.val[1]) : vget_low_u8(b.val[1]);
+					const uint8x8_t b2 = half ? vget_high_u8(b.val[2]) : vget_low_u8(b.val[2]);
+					const uint16x8_t cp = vorrq_u16(vshlq_n_u16(vmovl_u8(vand_u8(b0, vdup_n_u8(0x0F))), 12),
+						vorrq_u16(vshlq_n_u16(vmovl_u8(vand_u8(b1, vdup_n_u8(0x3F))), 6), vmovl_u8(vand_u8(b2, vdup_n_u8(0x3F)))));
+					const uint16x8_t bad = vorrq_u16(vcltq_u16(cp, vdupq_n_u16(0x800)),
+						vceqq_u16(vandq_u16(cp, vdupq_n_u16(0xF800)), vdupq_n_u16(0xD800)));
+					valid = valid && !vmaxvq_u16(bad);
+					units[half] = cp;
+				}
+				if (valid)
+				{
+					Store16(AsUnits(out), units[0], units[1]);
+					p += 48;
+					out += 16;
+					return true;
+				}
+				return false;
+			}
+		}
+
+		if (end - p >= 32 && outEnd - out >= 16)
+		{
+			const uint8x16x2_t b = vld2q_u8(reinterpret_cast<const uint8_t*>(p));
+			const uint8x16_t ok = vandq_u8(vceqq_u8(vandq_u8(b.val[0], vdupq_n_u8(0xE0)), vdupq_n_u8(0xC0)),
+				vceqq_u8(vandq_u8(b.val[1], vdupq_n_u8(0xC0)), vdupq_n_u8(0x80)));
+			// C0 / C1 leads are overlong
+			if (vminvq_u8(ok) == 0xFF && vminvq_u8(b.val[0]) >= 0xC2)
+			{
+				const uint8x16_t lead = vandq_u8(b.val[0], vdupq_n_u8(0x1F));
+				const uint8x16_t trail = vandq_u8(b.val[1], vdupq_n_u8(0x3F));
+				Store16(AsUnits(out),
+					vorrq_u16(vshlq_n_u16(vmovl_u8(vget_low_u8(lead)), 6), vmovl_u8(vget_low_u8(trail))),
+					vorrq_u16(vshlq_n_u16(vmovl_u8(vget_high_u8(lead)), 6), vmovl_u8(vget_high_u8(trail))));
+				p += 32;
+				out += 16;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+template<bool BigEndian>
+struct Utf32Kernels
+{
+	static uint32x4_t Load(const char* p)
+	{
+		const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+		return vreinterpretq_u32_u8(BigEndian ? vrev32q_u8(v) : v);
+	}
+
+	template<typename CharT>
+	static void Bmp(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 64 && outEnd - out >= 16)
+		{
+			const uint32x4_t a = Load(p), b = Load(p + 16), c = Load(p + 32), d = Load(p + 48);
+			if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) > 0xFFFF)
+				return;
+			const uint16x8_t low = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+			const uint16x8_t high = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+			const uint16x8_t mask = vdupq_n_u16(0xF800);
+			const uint16x8_t surrogate = vorrq_u16(vceqq_u16(vandq_u16(low, mask), vdupq_n_u16(0xD800)),
+				vceqq_u16(vandq_u16(high, mask), vdupq_n_u16(0xD800)));
+			if (vmaxvq_u16(surrogate))
+				return;
+			Store16(AsUnits(out), low, high);
+			p += 64;
+			out += 16;
+		}
+	}
+
+	static void Ascii(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		while (end - p >= 64 && outEnd - out >= 16)
+		{
+			const uint32x4_t a = Load(p), b = Load(p + 16), c = Load(p + 32), d = Load(p + 48);
+			if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) >= 0x80)
+				return;
+			const uint16x8_t low = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+			const uint16x8_t high = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+			vst1q_u8(reinterpret_cast<uint8_t*>(out), vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+			p += 64;
+			out += 16;
+		}
+	}
+};
+
+// 8 units per step, the pairing test of the SSE4.2 kernels: the high lanes
+// shifted up by one must be the low lanes
+template<bool BigEndian>
+struct Utf16Kernels
+{
+	static uint16x8_t Load(const char* p)
+	{
+		const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+		return vreinterpretq_u16_u8(BigEndian ? vrev16q_u8(v) : v);
+	}
+
+	static int Taken(uint16x8_t units)
+	{
+		const uint16x8_t top = vandq_u16(units, vdupq_n_u16(0xFC00));
+		const uint16x8_t high = vceqq_u16(top, vdupq_n_u16(0xD800));
+		const uint16x8_t low = vceqq_u16(top, vdupq_n_u16(0xDC00));
+		if (vmaxvq_u16(veorq_u16(low, vextq_u16(vdupq_n_u16(0), high, 7))))
+			return 0;
+		return vgetq_lane_u16(high, 7) ? 7 : 8;
+	}
+
+	template<typename CharT>
+	static void Paired(const char*& p, const char* end, CharT*& out, CharT* outEnd)
+	{
+		while (end - p >= 16 && outEnd - out >= 8)
+		{
+			const uint16x8_t units = Load(p);
+			const int taken = Taken(units);
+			if (!taken)
+				return;
+			Store8(AsUnits(out), units);
+			p += 2 * taken;
+			out += taken;
+		}
+	}
+
+	static void WellFormed(const char*& p, const char* end)
+	{
+		while (end - p >= 16)
+		{
+			const int taken = Taken(Load(p));
+			if (!taken)
+				return;
+			p += 2 * taken;
+		}
+	}
+
+	static void Ascii(const char*& p, const char* end, char*& out, char* outEnd)
+	{
+		while (end - p >= 32 && outEnd - out >= 16)
+		{
+			const uint16x8_t a = Load(p), b = Load(p + 16);
+			if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80)
+				return;
+			vst1q_u8(reinterpret_cast<uint8_t*>(out), vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+			p += 32;
+			out += 16;
+		}
+	}
+
+	// the rest of UTF-8 output is left to the driver
+	static bool MultiByte(const char*&, const char*, char*&, char*) { return false; }
+};
+
+// the ASCII step of UTF-8, table lookups are left to the driver
+struct SingleByteKernels : Utf8Kernels
+{
+	template<typename CharT>
+	static void Mapped(const char16_t*, const char*&, const char*, CharT*&) {}
+};
+
+SIMD_TRANSCODE_ENTRY_POINTS
+
+} // namespace neon
+#endif
+
+} // namespace simd
+
+#undef SIMD_TRANSCODE_ENTRY_POINTS
+
+#endif
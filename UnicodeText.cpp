@@ -0,0 +1,147 @@
+/**
+ * Library target: detection and conversion behind UnicodeText.h
+ *
+ * @file UnicodeText.cpp
+ * @section LICENSE
+
+    This code is under MIT License, http://opensource.org/licenses/MIT
+ */
+
+#include "UnicodeText.h"
+#include "Decoder.h"
+#include "Pipeline.h"
+#include "StreamingDecoder.h"
+
+namespace unicode_text
+{
+
+DetectionResult Detect(Bytes input)
+{
+	static const char none = 0;
+	const char* begin = input.empty() ? &none : input.begin();
+	return DetectEncoding(begin, begin + input.size());
+}
+
+size_t DetectCandidates(Bytes input, Span<EncodingCandidate> candidates)
+{
+	static const char none = 0;
+	if (candidates.empty())
+		return 0;
+	const char* begin = input.empty() ? &none : input.begin();
+	return RankEncodings(begin, begin + input.size(), candidates.begin(), candidates.size());
+}
+
+TranscodeSummary Transcode(TextEncoding from, Bytes input, Span<char16_t> output, ErrorPolicy policy)
+{
+	const DynamicDecoder<char16_t> decoder(from);
+	TranscodeSummary summary = { 0, 0, TranscodeState::Ok, 0, {} };
+	const char* const begin = input.begin();
+	const char* const end = input.end();
+	const char* p = begin;
+	char16_t* out = output.begin();
+	char16_t* const outEnd = output.end();
+
+	while (p != end)
+	{
+		const TranscodeResult result = decoder.Decode(p, end, out, outEnd);
+		p += result.consumed;
+		out += result.produced;
+		if (result.status == TranscodeStatus::Ok)
+			break;
+		if (result.status == TranscodeStatus::OutputFull)
+		{
+			summary.state = TranscodeState::OutputFull;
+			break;
+		}
+
+		// the input is complete, a character waiting for more bytes is cut off
+		MalformedSequence bad = ClassifyMalformed(from, p, end);
+		if (result.status == TranscodeStatus::Incomplete)
+			bad = { DecodeErrorKind::Truncated, static_cast<size_t>(end - p) };
+		if (policy == ErrorPolicy::Replace && out == outEnd)
+		{
+			summary.state = TranscodeState::OutputFull;
+			break;
+		}
+		if (!summary.errorCount)
+			summary.firstError = { static_cast<uint64_t>(p - begin), bad.kind };
+		++summary.errorCount;
+		if (policy == ErrorPolicy::Stop)
+		{
+			summary.state = TranscodeState::Invalid;
+			break;
+		}
+		if (policy == ErrorPolicy::Replace)
+			*out++ = 0xFFFD;
+		p += bad.length;
+	}
+
+	summary.consumed = p - begin;
+	summary.produced = out - output.begin();
+	return summary;
+}
+
+std::u16string Transcode(TextEncoding from, Bytes input, ErrorPolicy policy, TranscodeSummary* summary)
+{
+	std::u16string text(MaxUtf16Units(input.size()), u'\0');
+	const TranscodeSummary result = Transcode(from, input, Span<char16_t>(&text[0], text.size()), policy);
+	assert(result.state != TranscodeState::OutputFull);
+	text.resize(result.produced);
+	if (summary)
+		*summary = result;
+	return text;
+}
+
+struct StreamDecoder::State
+{
+	explicit State(TextEncoding encoding) : decoder(encoding) {}
+
+	StreamingDecoder<char16_t> decoder;
+};
+
+StreamDecoder::StreamDecoder(TextEncoding encoding, ErrorPolicy policy)
+	: state(new State(encoding))
+{
+	state->decoder.SetErrorPolicy(policy);
+}
+
+StreamDecoder::StreamDecoder(StreamDecoder&& other) = default;
+StreamDecoder& StreamDecoder::operator=(StreamDecoder&& other) = default;
+StreamDecoder::~StreamDecoder() = default;
+
+void StreamDecoder::Reset(TextEncoding encoding)
+{
+	state->decoder.Reset(encoding);
+}
+
+TextEncoding StreamDecoder::Encoding() const
+{
+	return state->decoder.Encoding();
+}
+
+bool StreamDecoder::Feed(Bytes chunk, const Sink& sink)
+{
+	return state->decoder.Feed(chunk.begin(), chunk.end(), sink);
+}
+
+bool StreamDecoder::Finish(const Sink& sink)
+{
+	return state->decoder.Finish(sink);
+}
+
+uint64_t StreamDecoder::Consumed() const
+{
+	return state->decoder.Consumed();
+}
+
+uint64_t StreamDecoder::ErrorCount() const
+{
+	return state->decoder.ErrorCount();
+}
+
+std::vector<DecodeError> StreamDecoder::Errors() const
+{
+	return state->decoder.Errors();
+}
+
+} // namespace unicode_text
@@ -0,0 +1,115 @@
+#ifndef _12FFA3AA_0639_4DAA_BB78_E8E457E9749C_
+#define  _12FFA3AA_0639_4DAA_BB78_E8E457E9749C_
+
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "DecodeError.h"
+#include "EncodingCandidate.h"
+#include "TextEncoding.h"
+
+// In-process API of the library target (UnicodeText.cpp): detection and
+// conversion to UTF-16 for services that link the code instead of running the
+// tool once per file. The SIMD kernels, the dispatch and the detector
+// backends stay behind it; this header only needs TextEncoding.h,
+// EncodingCandidate.h and DecodeError.h.
+namespace unicode_text
+{
+
+// view of contiguous elements, until std::span is available
+template<typename T>
+class Span
+{
+public:
+	Span() = default;
+	Span(T* data, size_t size) : first(data), count(size) {}
+	Span(T* begin, T* end) : first(begin), count(end - begin) { assert(begin <= end); }
+	template<typename Container>
+	Span(Container& container) : first(container.data()), count(container.size()) {}
+
+	T* data() const { return first; }
+	size_t size() const { return count; }
+	bool empty() const { return !count; }
+	T* begin() const { return first; }
+	T* end() const { return first + count; }
+
+private:
+	T* first = nullptr;
+	size_t count = 0;
+};
+
+typedef Span<const char> Bytes;
+
+// BOM, the native detector on a growing window, the selected detector
+// backend for what stays ambiguous; pass all bytes at hand
+DetectionResult Detect(Bytes input);
+
+// the readings Detect chooses from, best first, as many as fit into
+// candidates; the backend is only asked about ambiguous input
+size_t DetectCandidates(Bytes input, Span<EncodingCandidate> candidates);
+
+enum class TranscodeState
+{
+	Ok,         // all input converted
+	OutputFull, // stopped because the output span is full, call again with the rest
+	Invalid     // malformed input and ErrorPolicy::Stop, see firstError
+};
+
+struct TranscodeSummary
+{
+	size_t consumed;     // input bytes
+	size_t produced;     // UTF-16 code units
+	TranscodeState state;
+	uint64_t errorCount; // malformed sequences replaced, skipped or stopped at
+	DecodeError firstError;
+};
+
+// output units that input of `bytes` bytes can take at most, whatever the
+// encoding and policy
+inline size_t MaxUtf16Units(size_t bytes) { return bytes; }
+
+// converts a complete input, the text after the BOM (bomLength of Detect); a
+// character cut off at its end is Truncated, error offsets count from input
+TranscodeSummary Transcode(TextEncoding from, Bytes input, Span<char16_t> output, ErrorPolicy policy = ErrorPolicy::Stop);
+
+// the same into a string; on Invalid it holds the text in front of the error
+std::u16string Transcode(TextEncoding from, Bytes input, ErrorPolicy policy = ErrorPolicy::Stop, TranscodeSummary* summary = nullptr);
+
+// Chunk by chunk conversion, see StreamingDecoder.h; the sink gets UTF-16
+// code units, valid during the call
+class StreamDecoder
+{
+public:
+	typedef std::function<void(const char16_t* begin, const char16_t* end)> Sink;
+
+	explicit StreamDecoder(TextEncoding encoding, ErrorPolicy policy = ErrorPolicy::Stop);
+	StreamDecoder(StreamDecoder&& other);
+	StreamDecoder& operator=(StreamDecoder&& other);
+	~StreamDecoder();
+
+	// start over, with another encoding
+	void Reset(TextEncoding encoding);
+	TextEncoding Encoding() const;
+
+	// false once the input turned out to be malformed and the policy is Stop
+	bool Feed(Bytes chunk, const Sink& sink);
+	// end of input: a character still waiting for its other bytes is an error
+	bool Finish(const Sink& sink);
+
+	uint64_t Consumed() const;
+	uint64_t ErrorCount() const;
+	// the first StreamingDecoder::MaxRecordedErrors of them
+	std::vector<DecodeError> Errors() const;
+
+private:
+	struct State;
+	std::unique_ptr<State> state;
+};
+
+} // namespace unicode_text
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef _8D4F2A16_7B3E_4C59_9E81_2A6C0F5B3D47_
+#define  _8D4F2A16_7B3E_4C59_9E81_2A6C0F5B3D47_
+
+#include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for index based jobs. ForEach deals the index
+// range out in equal contiguous parts, a worker takes indices from the back of
+// its own part and, once that is empty, steals the front half of another
+// worker's remainder. Uneven items (one huge file among many small ones) so
+// end up spread over all threads, and a busy worker never waits on a shared
+// queue. A worker that finds nothing left sleeps until the job is done or a
+// steal put items where it had looked already.
+//
+// task(index, worker) gets the worker number in [0, Size()) to pick its own
+// reusable state. ForEach must not be called from inside a task.
+class WorkStealingPool
+{
+public:
+	typedef std::function<void(size_t index, size_t worker)> Task;
+
+	// threads == 0: one per hardware thread
+	inline explicit WorkStealingPool(size_t threads = 0);
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+	inline ~WorkStealingPool();
+
+	size_t Size() const { return threads.size(); }
+
+	// runs task for every index in [0, count) and returns when all are done
+	inline void ForEach(size_t count, const Task& task);
+
+private:
+	// the not yet started part of a worker's share, padded to keep the
+	// ranges of different workers off one cache line
+	struct Range
+	{
+		std::mutex lock;
+		size_t begin = 0;
+		size_t end = 0;
+		char padding[64];
+	};
+
+	inline void Run(size_t self);
+	inline void Work(size_t self, size_t current);
+	inline bool Pop(size_t self, size_t& index);
+	inline bool Steal(size_t self, size_t& index);
+	inline void Stolen();
+
+	std::vector<std::thread> threads;
+	std::unique_ptr<Range[]> ranges;
+	const Task* task = nullptr;
+	std::atomic<size_t> pending;
+	std::atomic<size_t> steals; // that left items in the thief's range
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	size_t job = 0;
+	bool stop = false;
+};
+
+
+WorkStealingPool::WorkStealingPool(size_t count)
+	: pending(0), steals(0)
+{
+	if (!count)
+		count = std::thread::hardware_concurrency();
+	if (!count)
+		count = 1;
+	ranges.reset(new Range[count]);
+	for (size_t i = 0; i < count; ++i)
+		threads.emplace_back(&WorkStealingPool::Run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	wake.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void WorkStealingPool::ForEach(size_t count, const Task& job)
+{
+	if (!count)
+		return;
+
+	// pending and task first: a worker may start on its range right away
+	pending = count;
+	task = &job;
+	const size_t share = count / Size();
+	const size_t rest = count % Size();
+	size_t begin = 0;
+	for (size_t i = 0; i < Size(); ++i)
+	{
+		const size_t end = begin + share + (i < rest ? 1 : 0);
+		std::lock_guard<std::mutex> guard(ranges[i].lock);
+		ranges[i].begin = begin;
+		ranges[i].end = end;
+		begin = end;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	++this->job;
+	wake.notify_all();
+	done.wait(guard, [this] { return pending == 0; });
+	task = nullptr;
+}
+
+void WorkStealingPool::Run(size_t self)
+{
+	size_t seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this, seen] { return stop || job != seen; });
+			if (stop)
+				return;
+			seen = job;
+		}
+		Work(self, seen);
+	}
+}
+
+void WorkStealingPool::Work(size_t self, size_t current)
+{
+	for (;;)
+	{
+		const size_t seen = steals;
+		size_t index;
+		if (Pop(self, index) || Steal(self, index))
+		{
+			(*task)(index, self);
+			if (pending.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				done.notify_all();
+			}
+			continue;
+		}
+		// everything is handed out, the last items are still running elsewhere
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [this, seen, current] { return pending == 0 || steals != seen || job != current; });
+		if (pending == 0 || job != current)
+			return;
+	}
+}
+
+bool WorkStealingPool::Pop(size_t self, size_t& index)
+{
+	Range& own = ranges[self];
+	std::lock_guard<std::mutex> guard(own.lock);
+	if (own.begin == own.end)
+		return false;
+	index = --own.end;
+	return true;
+}
+
+// takes the front half of the first non-empty range after self; both locks
+// are held, a new job may just be filling the own range
+bool WorkStealingPool::Steal(size_t self, size_t& index)
+{
+	Range& own = ranges[self];
+	for (size_t i = 1; i < Size(); ++i)
+	{
+		Range& victim = ranges[(self + i) % Size()];
+		std::unique_lock<std::mutex> ownGuard(own.lock, std::defer_lock);
+		std::unique_lock<std::mutex> victimGuard(victim.lock, std::defer_lock);
+		std::lock(ownGuard, victimGuard);
+		if (own.begin != own.end)
+			return false; // Pop takes it next
+		if (victim.begin == victim.end)
+			continue;
+
+		const size_t end = victim.begin + (victim.end - victim.begin + 1) / 2;
+		own.begin = victim.begin;
+		own.end = end - 1;
+		victim.begin = end;
+		index = end - 1;
+		if (own.begin != own.end)
+		{
+			ownGuard.unlock();
+			victimGuard.unlock();
+			Stolen();
+		}
+		return true;
+	}
+	return false;
+}
+
+// wakes the idle workers, items moved to a range they may have passed
+void WorkStealingPool::Stolen()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		++steals;
+	}
+	done.notify_all();
+}
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * Per-file detection cost: fresh COM setup per call vs reused DetectorContext
+ *
+ * @file detect_bench.cpp
+ * @section LICENSE
+
+    This code is under MIT License, http://opensource.org/licenses/MIT
+ */
+
+#include <iostream>
+#include <locale>
+#include <codecvt>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include "../EncodingDetect.h"
+#include "../DetectorContext.h"
+#include "../FastEncodingDetect.h"
+
+// COM setup is what this measures; elsewhere there is nothing to compare
+#ifdef _WIN32
+
+namespace
+{
+
+// 1 KB samples, the same window main.cpp passes to the detector
+std::vector<std::string> MakeSamples()
+{
+	std::vector<std::string> samples;
+	std::string ascii, ansi, cjk, utf16;
+	while (ascii.size() < 1024)
+		ascii += "The quick brown fox jumps over the lazy dog. ";
+	while (ansi.size() < 1024)
+		ansi += "Gr\xFC\xDF" "e aus K\xF6ln, \xE0 bient\xF4t. ";
+	while (cjk.size() < 1024)
+		cjk += "\xE4\xB8\xAD\xE6\x96\x87\xE6\xB5\x8B\xE8\xAF\x95 text ";
+	for (char c : ascii)
+	{
+		utf16 += c;
+		utf16 += '\0';
+	}
+	samples.push_back(ascii.substr(0, 1024));
+	samples.push_back(ansi.substr(0, 1024));
+	samples.push_back(cjk.substr(0, 1024));
+	samples.push_back(utf16.substr(0, 1024));
+	return samples;
+}
+
+// what DetectLocale did for every file before DetectorContext
+TextEncoding DetectFresh(const std::string& sample)
+{
+	TextEncoding result = TextEncoding::Ansi;
+	if (SUCCEEDED(::CoInitialize(nullptr)))
+	{
+		{
+			EncodeDetector detector;
+			result = detector.Detect(sample.data(), sample.data() + sample.size());
+		}
+		::CoUninitialize();
+	}
+	return result;
+}
+
+TextEncoding DetectReused(const std::string& sample)
+{
+	return DetectorContext::ForCurrentThread().Detect(sample.data(), sample.data() + sample.size());
+}
+
+TextEncoding DetectNative(const std::string& sample)
+{
+	return FastEncodeDetector().Detect(sample.data(), sample.data() + sample.size()).encoding;
+}
+
+template<typename Detect>
+void Run(const char* name, Detect detect, const std::vector<std::string>& samples, int files, int threads)
+{
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; ++t)
+	{
+		workers.emplace_back([&]
+		{
+			volatile int sink = 0;
+			for (int i = 0; i < files; ++i)
+				sink += static_cast<int>(detect(samples[i % samples.size()]));
+		});
+	}
+	for (auto& worker : workers)
+		worker.join();
+
+	const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	const double total = static_cast<double>(files) * threads;
+	std::cout << name << ": " << elapsed / total << " ns/file, "
+		<< total * 1e9 / elapsed << " files/s (" << threads << " threads)\n";
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	const int files = argc > 1 ? std::atoi(argv[1]) : 2000;
+	const int threads = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+	const auto samples = MakeSamples();
+
+	Run("fresh COM per file ", DetectFresh, samples, files, threads);
+	Run("reused context     ", DetectReused, samples, files, threads);
+	Run("native detector    ", DetectNative, samples, files, threads);
+	return 0;
+}
+
+#else
+
+int main()
+{
+	std::cout << "detect_bench compares MLang setups and needs Windows, see pipeline_bench\n";
+	return 0;
+}
+
+#endif
@@ -0,0 +1,400 @@
+/**
+ * Throughput of detection, decoding, conversion to UTF-8, normalization, line
+ * splitting, the --stats counters and the whole dump pipeline over a generated
+ * corpus, on Google Benchmark
+ *
+ * @file pipeline_bench.cpp
+ * @section LICENSE
+
+    This code is under MIT License, http://opensource.org/licenses/MIT
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "../Converter.h"
+#include "../Decoder.h"
+#include "../DetectorBackend.h"
+#include "../HexWriter.h"
+#include "../LineSplitter.h"
+#include "../Normalizer.h"
+#include "../Pipeline.h"
+#include "../StreamingDecoder.h"
+#include "../TextStatistics.h"
+#include "../Transcode.h"
+
+namespace
+{
+
+const size_t CorpusSize = 1024 * 1024;
+
+struct Corpus
+{
+	std::string name;
+	std::string bytes;
+	uint64_t lines;
+	TextEncoding codePage; // of ANSI input, as --ansi
+};
+
+enum class Form { Utf8, Latin1, Windows1251, Utf16LE, Utf16BE };
+
+// lines of up to ~70 characters drawn from one pool of words
+std::vector<std::u32string> MakeLines(const std::vector<std::u32string>& words)
+{
+	std::vector<std::u32string> lines;
+	size_t size = 0;
+	unsigned seed = 1;
+	while (size < CorpusSize)
+	{
+		std::u32string line;
+		while (line.size() < 70)
+		{
+			seed = seed * 1103515245 + 12345;
+			line += words[(seed >> 16) % words.size()];
+			line += U' ';
+		}
+		line.pop_back();
+		size += line.size();
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+Corpus Encode(const char* name, const std::vector<std::u32string>& lines, Form form, bool bom, const char* lineEnd)
+{
+	Corpus corpus = { name, std::string(), lines.size(), form == Form::Windows1251 ? TextEncoding::Windows1251 : TextEncoding::Ansi };
+	std::string& out = corpus.bytes;
+	auto put = [&out, form](uint32_t cp)
+	{
+		if (form == Form::Latin1)
+		{
+			out += static_cast<char>(cp);
+			return;
+		}
+		if (form == Form::Windows1251)
+		{
+			// ASCII and the basic Cyrillic letters, the words have nothing else
+			out += static_cast<char>(cp >= 0x410 && cp <= 0x44F ? 0xC0 + (cp - 0x410) : cp);
+			return;
+		}
+		if (form == Form::Utf8)
+		{
+			char bytes[4];
+			char* o = bytes;
+			simd::scalar::EncodeUtf8(cp, o, bytes + 4);
+			out.append(bytes, o);
+			return;
+		}
+		char16_t units[2];
+		char16_t* o = units;
+		simd::scalar::EncodeUtf16(cp, o, units + 2);
+		for (const char16_t* u = units; u != o; ++u)
+		{
+			const char low = static_cast<char>(*u & 0xFF), high = static_cast<char>(*u >> 8);
+			out += form == Form::Utf16LE ? low : high;
+			out += form == Form::Utf16LE ? high : low;
+		}
+	};
+
+	if (bom)
+		put(0xFEFF);
+	for (const auto& line : lines)
+	{
+		for (const char32_t c : line)
+			put(c);
+		for (const char* e = lineEnd; *e; ++e)
+			put(static_cast<unsigned char>(*e));
+	}
+	return corpus;
+}
+
+const std::vector<Corpus>& Corpora()
+{
+	static const std::vector<Corpus> corpora = []
+	{
+		const auto ascii = MakeLines({ U"The", U"quick", U"brown", U"fox", U"jumps", U"over", U"the", U"lazy", U"dog." });
+		const auto latin = MakeLines({ U"Gr\u00FC\u00DFe", U"aus", U"K\u00F6ln,", U"\u00E0", U"bient\u00F4t,", U"se\u00F1or", U"na\u00EFve" });
+		const auto cyrillic = MakeLines({ U"\u041F\u0440\u0438\u0432\u0435\u0442,", U"\u043C\u0438\u0440", U"\u0442\u0435\u043A\u0441\u0442", U"OK", U"\u0434\u0430" });
+		const auto cjk = MakeLines({ U"\u4E2D\u6587", U"\u6D4B\u8BD5", U"\u6C49\u5B57\u7F16\u7801", U"\u65E5\u672C\u8A9E", U"\uD55C\uAD6D\uC5B4" });
+		const auto emoji = MakeLines({ U"\U0001F600", U"\U0001F389\U0001F680", U"ok", U"\U0001F44D", U"\U0001F30D\U0001F525", U"see" });
+
+		std::vector<Corpus> all;
+		all.push_back(Encode("ascii_lf", ascii, Form::Utf8, false, "\n"));
+		all.push_back(Encode("ascii_crlf", ascii, Form::Utf8, false, "\r\n"));
+		all.push_back(Encode("latin1", latin, Form::Latin1, false, "\r\n"));
+		all.push_back(Encode("cyrillic_1251", cyrillic, Form::Windows1251, false, "\r\n"));
+		all.push_back(Encode("cjk_utf8", cjk, Form::Utf8, false, "\n"));
+		all.push_back(Encode("emoji_utf8", emoji, Form::Utf8, false, "\n"));
+		all.push_back(Encode("utf16le_bom", ascii, Form::Utf16LE, true, "\r\n"));
+		all.push_back(Encode("utf16le", ascii, Form::Utf16LE, false, "\r\n"));
+		all.push_back(Encode("utf16be_bom", ascii, Form::Utf16BE, true, "\n"));
+		all.push_back(Encode("utf16be", ascii, Form::Utf16BE, false, "\n"));
+		all.push_back(Encode("emoji_utf16le", emoji, Form::Utf16LE, true, "\n"));
+		all.push_back(Encode("cyrillic_utf16le", cyrillic, Form::Utf16LE, true, "\r\n"));
+		all.push_back(Encode("cjk_utf16be", cjk, Form::Utf16BE, true, "\n"));
+		return all;
+	}();
+	return corpora;
+}
+
+// what the dump writes to a terminal, without paying for the terminal
+class NullBuffer : public std::streambuf
+{
+protected:
+	int_type overflow(int_type c) override { return c; }
+	std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+void SetThroughput(benchmark::State& state, const Corpus& corpus, uint64_t bytes)
+{
+	state.SetBytesProcessed(static_cast<int64_t>(bytes * state.iterations()));
+	// seconds per line, shown as ns
+	state.counters["per_line"] = benchmark::Counter(static_cast<double>(corpus.lines),
+		benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+// BOM check, progressive native detector and the default backend for the
+// rest; the throughput is of the bytes the detector actually examined
+void Detect(benchmark::State& state, const Corpus* corpus)
+{
+	const char* begin = corpus->bytes.data();
+	const char* end = begin + corpus->bytes.size();
+	for (auto _ : state)
+		benchmark::DoNotOptimize(DetectEncoding(begin, end));
+	ProgressiveDetector detector;
+	detector.Detect(begin, end);
+	state.SetBytesProcessed(static_cast<int64_t>(detector.Examined() * state.iterations()));
+	state.counters["examined"] = static_cast<double>(detector.Examined());
+}
+
+// all candidates through the selected backend (UNICODE_TEST_DETECTOR); input
+// the native detector is sure about never reaches it
+void Rank(benchmark::State& state, const Corpus* corpus)
+{
+	const char* begin = corpus->bytes.data();
+	const char* end = begin + corpus->bytes.size();
+	EncodingCandidate candidates[DetectorBackend::MaxCandidates];
+	for (auto _ : state)
+		benchmark::DoNotOptimize(RankEncodings(begin, end, candidates, DetectorBackend::MaxCandidates));
+	state.counters["candidates"] = static_cast<double>(RankEncodings(begin, end, candidates, DetectorBackend::MaxCandidates));
+}
+
+// one backend alone on the sniff window, what DetectLocale did with MLang
+// before the native detector
+void DetectBackend(benchmark::State& state, const Corpus* corpus, const char* name)
+{
+	const size_t size = std::min(SniffSize, corpus->bytes.size());
+	std::unique_ptr<DetectorBackend> backend = CreateDetectorBackend(name);
+	for (auto _ : state)
+	{
+		DetectionResult detected = { TextEncoding::Ansi, 0, 0 };
+		backend->Refine(corpus->bytes.data(), corpus->bytes.data() + size, detected);
+		benchmark::DoNotOptimize(detected);
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(size * state.iterations()));
+}
+
+TextEncoding EncodingOf(const Corpus& corpus)
+{
+	const std::string& bytes = corpus.bytes;
+	const TextEncoding encoding = DetectEncoding(bytes.data(), bytes.data() + bytes.size()).encoding;
+	return encoding == TextEncoding::Ansi ? corpus.codePage : encoding;
+}
+
+void Decode(benchmark::State& state, const Corpus* corpus)
+{
+	const TextEncoding encoding = EncodingOf(*corpus);
+	const char* begin = corpus->bytes.data();
+	const char* end = begin + corpus->bytes.size();
+	for (auto _ : state)
+	{
+		WithDecoder(encoding, [&](auto codec)
+		{
+			uint64_t units = 0;
+			auto count = [&units](const wchar_t* b, const wchar_t* e) { units += e - b; };
+			StreamingDecoder<wchar_t, decltype(codec)> decoder(codec);
+			decoder.Feed(begin, end, count);
+			decoder.Finish(count);
+			benchmark::DoNotOptimize(units);
+			return 0;
+		});
+	}
+	SetThroughput(state, *corpus, corpus->bytes.size());
+}
+
+// --to=utf-8: straight to UTF-8 bytes, a validated copy for UTF-8 input
+void ToUtf8(benchmark::State& state, const Corpus* corpus)
+{
+	const TextEncoding encoding = EncodingOf(*corpus);
+	const char* begin = corpus->bytes.data();
+	const char* end = begin + corpus->bytes.size();
+	for (auto _ : state)
+	{
+		WithConverter(encoding, TextEncoding::UTF8, [&](auto converter)
+		{
+			uint64_t bytes = 0;
+			auto count = [&bytes](const char* b, const char* e) { bytes += e - b; };
+			StreamingDecoder<char, decltype(converter)> decoder(converter);
+			decoder.Feed(begin, end, count);
+			decoder.Finish(count);
+			benchmark::DoNotOptimize(bytes);
+			return 0;
+		});
+	}
+	SetThroughput(state, *corpus, corpus->bytes.size());
+}
+
+// LineSplitter on text decoded up front, the successor of SafeGetLine
+void SplitLines(benchmark::State& state, const Corpus* corpus)
+{
+	std::vector<wchar_t> text;
+	StreamingDecoder<wchar_t> decoder(EncodingOf(*corpus));
+	auto append = [&text](const wchar_t* b, const wchar_t* e) { text.insert(text.end(), b, e); };
+	decoder.Feed(corpus->bytes.data(), corpus->bytes.data() + corpus->bytes.size(), append);
+	decoder.Finish(append);
+
+	// blocks of the size StreamingDecoder hands out
+	const size_t block = StreamingDecoder<wchar_t>::DefaultCapacity;
+	LineSplitter<wchar_t> splitter;
+	for (auto _ : state)
+	{
+		uint64_t lines = 0;
+		auto onLine = [&lines](const wchar_t*, const wchar_t*) { ++lines; };
+		for (size_t i = 0; i < text.size(); i += block)
+			splitter.Push(text.data() + i, text.data() + std::min(text.size(), i + block), onLine);
+		splitter.Finish(onLine);
+		benchmark::DoNotOptimize(lines);
+	}
+	SetThroughput(state, *corpus, text.size() * sizeof(wchar_t));
+}
+
+// TextNormalizer on text decoded up front, in the decoder's blocks; the
+// corpora are in NFC, NFD decomposes every accented letter
+void Normalize(benchmark::State& state, const Corpus* corpus, NormalForm form, bool fold)
+{
+	std::vector<wchar_t> text;
+	StreamingDecoder<wchar_t> decoder(EncodingOf(*corpus));
+	auto append = [&text](const wchar_t* b, const wchar_t* e) { text.insert(text.end(), b, e); };
+	decoder.Feed(corpus->bytes.data(), corpus->bytes.data() + corpus->bytes.size(), append);
+	decoder.Finish(append);
+
+	const size_t block = StreamingDecoder<wchar_t>::DefaultCapacity;
+	TextNormalizer<wchar_t> normalizer(form, fold);
+	uint64_t units = 0;
+	for (auto _ : state)
+	{
+		units = 0;
+		auto count = [&units](const wchar_t* b, const wchar_t* e) { units += e - b; };
+		for (size_t i = 0; i < text.size(); i += block)
+			normalizer.Push(text.data() + i, text.data() + std::min(text.size(), i + block), count);
+		normalizer.Finish(count);
+		benchmark::DoNotOptimize(units);
+	}
+	SetThroughput(state, *corpus, text.size() * sizeof(wchar_t));
+	state.counters["grown"] = static_cast<double>(units) / text.size();
+}
+
+// TextStatistics on text decoded up front, in the decoder's blocks, with the
+// lines of a LineSplitter as --stats counts them
+void Statistics(benchmark::State& state, const Corpus* corpus)
+{
+	std::vector<wchar_t> text;
+	StreamingDecoder<wchar_t> decoder(EncodingOf(*corpus));
+	auto append = [&text](const wchar_t* b, const wchar_t* e) { text.insert(text.end(), b, e); };
+	decoder.Feed(corpus->bytes.data(), corpus->bytes.data() + corpus->bytes.size(), append);
+	decoder.Finish(append);
+
+	const size_t block = StreamingDecoder<wchar_t>::DefaultCapacity;
+	TextStatistics<wchar_t> statistics;
+	LineSplitter<wchar_t> splitter;
+	auto onLine = [&statistics](const wchar_t* b, const wchar_t* e) { statistics.Line(b, e); };
+	for (auto _ : state)
+	{
+		statistics.Reset();
+		for (size_t i = 0; i < text.size(); i += block)
+		{
+			const wchar_t* b = text.data() + i;
+			const wchar_t* e = text.data() + std::min(text.size(), i + block);
+			statistics.Count(b, e);
+			splitter.Push(b, e, onLine);
+		}
+		splitter.Finish(onLine);
+		statistics.Finish();
+		benchmark::ClobberMemory();
+	}
+	SetThroughput(state, *corpus, text.size() * sizeof(wchar_t));
+}
+
+// the single file dump of main.cpp for a mapped file, output discarded
+void Pipeline(benchmark::State& state, const Corpus* corpus)
+{
+	NullBuffer null;
+	std::ostream out(&null);
+	const char* begin = corpus->bytes.data();
+	const char* end = begin + corpus->bytes.size();
+	for (auto _ : state)
+	{
+		const char* sniffEnd = begin + std::min<size_t>(SniffSize, end - begin);
+		HexWriter writer(out);
+		writer.Text("bytes before convert:\n");
+		writer.Bytes(begin, sniffEnd);
+		const DetectionResult detected = DetectEncoding(begin, end);
+		writer.Text("\nConverted to following UTF-16 by wifstream: \n");
+
+		auto print = [&writer](const wchar_t* b, const wchar_t* e)
+		{
+			writer.CodeUnits(b, e);
+			writer.EndLine();
+		};
+		WithDecoder(detected.encoding, [&](auto codec)
+		{
+			LineSplitter<wchar_t> splitter;
+			auto push = [&splitter, &print](const wchar_t* b, const wchar_t* e) { splitter.Push(b, e, print); };
+			StreamingDecoder<wchar_t, decltype(codec)> decoder(codec);
+			decoder.Feed(begin, end, push);
+			decoder.Finish(push);
+			splitter.Finish(print);
+			return 0;
+		});
+	}
+	SetThroughput(state, *corpus, corpus->bytes.size());
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	size_t backends;
+	const char* const* names = detector_backend::Names(backends);
+	for (const Corpus& corpus : Corpora())
+	{
+		benchmark::RegisterBenchmark(("detect/" + corpus.name).c_str(), Detect, &corpus);
+		benchmark::RegisterBenchmark(("rank/" + corpus.name).c_str(), Rank, &corpus);
+		for (size_t i = 0; i < backends; ++i)
+		{
+			if (std::strcmp(names[i], "native"))
+				benchmark::RegisterBenchmark(("detect_" + std::string(names[i]) + "/" + corpus.name).c_str(), DetectBackend, &corpus, names[i]);
+		}
+		benchmark::RegisterBenchmark(("decode/" + corpus.name).c_str(), Decode, &corpus);
+		benchmark::RegisterBenchmark(("to_utf8/" + corpus.name).c_str(), ToUtf8, &corpus);
+		benchmark::RegisterBenchmark(("split/" + corpus.name).c_str(), SplitLines, &corpus);
+		benchmark::RegisterBenchmark(("nfc/" + corpus.name).c_str(), Normalize, &corpus, NormalForm::NFC, false);
+		benchmark::RegisterBenchmark(("nfd/" + corpus.name).c_str(), Normalize, &corpus, NormalForm::NFD, false);
+		benchmark::RegisterBenchmark(("nfc_fold/" + corpus.name).c_str(), Normalize, &corpus, NormalForm::NFC, true);
+		benchmark::RegisterBenchmark(("stats/" + corpus.name).c_str(), Statistics, &corpus);
+		benchmark::RegisterBenchmark(("pipeline/" + corpus.name).c_str(), Pipeline, &corpus);
+	}
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,346 @@
+/**
+ * libFuzzer target: every SIMD level of the decoders and of the detector
+ * against the scalar kernels, UTF-8 against std::wstring_convert, chunked
+ * decoding against decoding in one piece
+ *
+ * @file decode_fuzz.cpp
+ * @section LICENSE
+
+    This code is under MIT License, http://opensource.org/licenses/MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <codecvt>
+#include <fstream>
+#include <iterator>
+#include <locale>
+#include <random>
+#include <string>
+#include <vector>
+#include "../CodePages.h"
+#include "../CpuFeatures.h"
+#include "../DecodeError.h"
+#include "../Decoder.h"
+#include "../Dispatch.h"
+#include "../EncodingCandidate.h"
+#include "../Pipeline.h"
+#include "../StreamingDecoder.h"
+#include "../TextEncoding.h"
+
+// The first ControlSize bytes of a fuzzer input pick what is tried, the rest
+// is the text:
+//  [0] the encoding of the streaming check, the code page of the single byte
+//      kernels
+//  [1] the ErrorPolicy, and whether the output room is cut short
+//  [2] the output room when it is, a fraction of what the text can need
+//  [3] where the text is split into two chunks, a fraction of its length
+//
+// A difference aborts with the check that failed, so that libFuzzer keeps the
+// input. Built with -fsanitize=fuzzer,address,undefined (CMakeLists.txt,
+// UNICODE_TEST_FUZZ); with UNICODE_TEST_FUZZ_MAIN it has a main of its own
+// that replays the files it is given, or random inputs without any.
+namespace
+{
+
+const size_t ControlSize = 4;
+
+const TextEncoding Encodings[] = { TextEncoding::UTF8, TextEncoding::UTF16LE, TextEncoding::UTF16BE, TextEncoding::UTF32LE,
+	TextEncoding::UTF32BE, TextEncoding::Ansi, TextEncoding::Windows1250, TextEncoding::Windows1251, TextEncoding::Windows1252 };
+
+void Check(bool condition, const char* what, SimdLevel level, const char* text)
+{
+	if (condition)
+		return;
+	std::fprintf(stderr, "decode_fuzz: %s at %s: %s\n", what, SimdLevelName(level), text);
+	std::abort();
+}
+
+#define FUZZ_CHECK(condition, what, level) Check(condition, what, level, #condition)
+
+// the levels of this build the CPU runs, Scalar left out
+const std::vector<SimdLevel>& VectorLevels()
+{
+	static const std::vector<SimdLevel> levels = []
+	{
+		std::vector<SimdLevel> found;
+		const SimdLevel all[] = { SimdLevel::Sse42, SimdLevel::Avx2, SimdLevel::Avx512, SimdLevel::Neon };
+		for (const SimdLevel level : all)
+		{
+			if (IsSupported(level) && simd::TableFor(level).level == level)
+				found.push_back(level);
+		}
+		return found;
+	}();
+	return levels;
+}
+
+bool Same(const TranscodeResult& a, const TranscodeResult& b)
+{
+	return a.consumed == b.consumed && a.produced == b.produced && a.status == b.status;
+}
+
+// what the run of the input is given to write into, in output elements
+struct Room
+{
+	bool cut;
+	uint8_t fraction; // of 256
+
+	size_t Of(size_t needed) const { return cut ? needed * fraction / 256 : needed; }
+};
+
+// one conversion at one level; out is sized to the room, so that the
+// sanitizer sees a write past it
+template<typename Unit, typename Kernel, typename... Extra>
+TranscodeResult Run(Kernel kernel, const char* begin, const char* end, size_t room, std::vector<Unit>& out, Extra... extra)
+{
+	out.assign(room, Unit());
+	return kernel(extra..., begin, end, out.data(), out.data() + out.size());
+}
+
+template<typename Unit, typename Kernel, typename... Extra>
+void CompareTranscoder(const char* what, Kernel reference, Kernel kernel, SimdLevel level, const char* begin, const char* end, size_t room, Extra... extra)
+{
+	std::vector<Unit> expected, actual;
+	const TranscodeResult a = Run(reference, begin, end, room, expected, extra...);
+	const TranscodeResult b = Run(kernel, begin, end, room, actual, extra...);
+	FUZZ_CHECK(Same(a, b), what, level);
+	FUZZ_CHECK(std::equal(expected.begin(), expected.begin() + a.produced, actual.begin()), what, level);
+}
+
+// the kernels of one code unit type, UTF-16 units whatever the input
+template<typename Unit>
+void CompareUnitKernels(const simd::UnitKernels<Unit>& reference, const simd::UnitKernels<Unit>& kernels, SimdLevel level,
+	const char* begin, const char* end, TextEncoding codePage, Room room)
+{
+	typedef TranscodeResult (*Transcoder)(const char*, const char*, Unit*, Unit*);
+	const struct
+	{
+		const char* what;
+		Transcoder simd::UnitKernels<Unit>::* kernel;
+	} transcoders[] =
+	{
+		{ "utf8ToUtf16", &simd::UnitKernels<Unit>::utf8ToUtf16 },
+		{ "utf16LEToUtf16", &simd::UnitKernels<Unit>::utf16LEToUtf16 },
+		{ "utf16BEToUtf16", &simd::UnitKernels<Unit>::utf16BEToUtf16 },
+		{ "utf32LEToUtf16", &simd::UnitKernels<Unit>::utf32LEToUtf16 },
+		{ "utf32BEToUtf16", &simd::UnitKernels<Unit>::utf32BEToUtf16 },
+	};
+	// no input byte gives more than one unit
+	const size_t room16 = room.Of(end - begin);
+	for (const auto& transcoder : transcoders)
+		CompareTranscoder<Unit>(transcoder.what, reference.*transcoder.kernel, kernels.*transcoder.kernel, level, begin, end, room16);
+	CompareTranscoder<Unit>("singleByteToUtf16", reference.singleByteToUtf16, kernels.singleByteToUtf16, level, begin, end, room16,
+		HighHalfTable(codePage));
+}
+
+void CompareKernels(SimdLevel level, const char* begin, const char* end, TextEncoding codePage, Room room)
+{
+	const simd::KernelTable& reference = simd::TableFor(SimdLevel::Scalar);
+	const simd::KernelTable& kernels = simd::TableFor(level);
+
+	FUZZ_CHECK(reference.skipAscii(begin, end) == kernels.skipAscii(begin, end), "skipAscii", level);
+	size_t zeros[4] = {}, vectorZeros[4] = {};
+	reference.countZeroBytes(begin, end, zeros);
+	kernels.countZeroBytes(begin, end, vectorZeros);
+	FUZZ_CHECK(std::equal(std::begin(zeros), std::end(zeros), std::begin(vectorZeros)), "countZeroBytes", level);
+	FUZZ_CHECK(reference.validateUtf8(begin, end) == kernels.validateUtf8(begin, end), "validateUtf8", level);
+	FUZZ_CHECK(reference.validateUtf16LE(begin, end) == kernels.validateUtf16LE(begin, end), "validateUtf16LE", level);
+	FUZZ_CHECK(reference.validateUtf16BE(begin, end) == kernels.validateUtf16BE(begin, end), "validateUtf16BE", level);
+
+	// to UTF-8: 3 bytes per UTF-16 unit at most, 4 per UTF-32 code point
+	const size_t room16 = room.Of((end - begin) / 2 * 3);
+	const size_t room32 = room.Of(end - begin);
+	CompareTranscoder<char>("utf16LEToUtf8", reference.utf16LEToUtf8, kernels.utf16LEToUtf8, level, begin, end, room16);
+	CompareTranscoder<char>("utf16BEToUtf8", reference.utf16BEToUtf8, kernels.utf16BEToUtf8, level, begin, end, room16);
+	CompareTranscoder<char>("utf32LEToUtf8", reference.utf32LEToUtf8, kernels.utf32LEToUtf8, level, begin, end, room32);
+	CompareTranscoder<char>("utf32BEToUtf8", reference.utf32BEToUtf8, kernels.utf32BEToUtf8, level, begin, end, room32);
+
+	CompareUnitKernels(reference.units16, kernels.units16, level, begin, end, codePage, room);
+	CompareUnitKernels(reference.units32, kernels.units32, level, begin, end, codePage, room);
+}
+
+template<typename F>
+struct DeletableFacet : F
+{
+	template<typename... Args>
+	DeletableFacet(Args&&... args) : F(std::forward<Args>(args)...) {}
+	~DeletableFacet() {}
+};
+
+// The facet EncodeDetector::Detect falls back on. It takes two liberties the
+// kernels do not: surrogate code points encoded in UTF-8 (ED A0..ED BF), and
+// a sequence cut off at the end, which it drops. Where the kernels stop
+// there and the facet goes on, their text up to the stop must be the same.
+void CompareWithFacet(const char* begin, const char* end)
+{
+	std::vector<char16_t> units(end - begin);
+	const TranscodeResult result = simd::TableFor(SimdLevel::Scalar).units16.utf8ToUtf16(begin, end, units.data(), units.data() + units.size());
+	const std::u16string decoded(units.data(), units.data() + result.produced);
+
+	std::u16string converted;
+	bool accepted = true;
+	try
+	{
+		std::wstring_convert<DeletableFacet<std::codecvt_utf8_utf16<char16_t>>, char16_t> converter;
+		converted = converter.from_bytes(begin, end);
+	}
+	catch (std::exception&)
+	{
+		accepted = false;
+	}
+
+	if (result.status == TranscodeStatus::Ok)
+	{
+		FUZZ_CHECK(accepted && converted == decoded, "wstring_convert", SimdLevel::Scalar);
+		return;
+	}
+	if (!accepted)
+		return;
+	const auto bad = reinterpret_cast<const unsigned char*>(begin + result.consumed);
+	const bool surrogate = end - begin - result.consumed >= 2 && bad[0] == 0xED && bad[1] >= 0xA0;
+	const bool tail = end - begin - result.consumed < 4;
+	FUZZ_CHECK(surrogate || tail, "wstring_convert", SimdLevel::Scalar);
+	FUZZ_CHECK(converted.compare(0, decoded.size(), decoded) == 0, "wstring_convert", SimdLevel::Scalar);
+}
+
+struct Streamed
+{
+	bool ok;
+	std::u16string text;
+	uint64_t consumed;
+	uint64_t errorCount;
+	std::vector<DecodeError> errors;
+};
+
+// the chunks one after the other into a decoder of capacity output units
+Streamed Stream(TextEncoding encoding, ErrorPolicy policy, size_t capacity, const char* begin, const char* split, const char* end)
+{
+	Streamed streamed = { true, std::u16string(), 0, 0, std::vector<DecodeError>() };
+	auto sink = [&streamed](const char16_t* b, const char16_t* e) { streamed.text.append(b, e); };
+	StreamingDecoder<char16_t> decoder(encoding, capacity);
+	decoder.SetErrorPolicy(policy);
+	streamed.ok = decoder.Feed(begin, split, sink) && decoder.Feed(split, end, sink) && decoder.Finish(sink);
+	streamed.consumed = decoder.Consumed();
+	streamed.errorCount = decoder.ErrorCount();
+	streamed.errors = decoder.Errors();
+	return streamed;
+}
+
+// a character split between chunks, or output handed over in small pieces,
+// must not change the text or the errors
+void CompareChunks(TextEncoding encoding, ErrorPolicy policy, const char* begin, const char* split, const char* end)
+{
+	const Streamed whole = Stream(encoding, policy, StreamingDecoder<char16_t>::DefaultCapacity, begin, end, end);
+	const Streamed chunked = Stream(encoding, policy, 8 + (split - begin) % 64, begin, split, end);
+	const SimdLevel level = simd::ActiveSimdLevel();
+	FUZZ_CHECK(whole.ok == chunked.ok && whole.text == chunked.text, "StreamingDecoder", level);
+	FUZZ_CHECK(whole.consumed == chunked.consumed && whole.errorCount == chunked.errorCount, "StreamingDecoder", level);
+	FUZZ_CHECK(whole.errors.size() == chunked.errors.size(), "StreamingDecoder", level);
+	for (size_t i = 0; i < whole.errors.size(); ++i)
+		FUZZ_CHECK(whole.errors[i].offset == chunked.errors[i].offset && whole.errors[i].kind == chunked.errors[i].kind, "StreamingDecoder", level);
+}
+
+struct Detected
+{
+	DetectionResult result;
+	size_t count;
+	EncodingCandidate candidates[8];
+};
+
+Detected Detect(const char* begin, const char* end)
+{
+	Detected detected;
+	detected.result = DetectEncoding(begin, end);
+	detected.count = RankEncodings(begin, end, detected.candidates, 8);
+	return detected;
+}
+
+// the detector runs on the kernels of the active level; it must come to the
+// same reading on every level
+void CompareDetection(const Detected& reference, SimdLevel level, const char* begin, const char* end)
+{
+	const Detected detected = Detect(begin, end);
+	FUZZ_CHECK(detected.result.encoding == reference.result.encoding && detected.result.confidence == reference.result.confidence
+		&& detected.result.bomLength == reference.result.bomLength, "DetectEncoding", level);
+	FUZZ_CHECK(detected.count == reference.count, "RankEncodings", level);
+	for (size_t i = 0; i < detected.count; ++i)
+	{
+		FUZZ_CHECK(detected.candidates[i].encoding == reference.candidates[i].encoding
+			&& detected.candidates[i].confidence == reference.candidates[i].confidence, "RankEncodings", level);
+	}
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	if (size < ControlSize)
+		return 0;
+	const char* begin = reinterpret_cast<const char*>(data) + ControlSize;
+	const char* end = reinterpret_cast<const char*>(data) + size;
+	const TextEncoding encoding = Encodings[data[0] % (sizeof(Encodings) / sizeof(Encodings[0]))];
+	const TextEncoding codePage = IsSingleByte(encoding) ? encoding : TextEncoding::Ansi;
+	const ErrorPolicy policy = static_cast<ErrorPolicy>(data[1] % 3);
+	const Room room = { (data[1] & 0x80) != 0, data[2] };
+	const char* split = begin + (end - begin) * data[3] / 256;
+
+	CompareWithFacet(begin, end);
+
+	const SimdLevel best = simd::ActiveSimdLevel();
+	simd::SelectSimdLevel(SimdLevel::Scalar);
+	const Detected reference = Detect(begin, end);
+	CompareChunks(encoding, policy, begin, split, end);
+	for (const SimdLevel level : VectorLevels())
+	{
+		CompareKernels(level, begin, end, codePage, room);
+		simd::SelectSimdLevel(level);
+		CompareDetection(reference, level, begin, end);
+		CompareChunks(encoding, policy, begin, split, end);
+	}
+	simd::SelectSimdLevel(best);
+	return 0;
+}
+
+#if UNICODE_TEST_FUZZ_MAIN
+// replays the files named, or without any runs on random inputs of mixed
+// ASCII, UTF-8, UTF-16 and UTF-32 pieces and stray bytes
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::ifstream in(argv[i], std::ios::binary);
+		const std::string input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+	}
+	if (argc > 1)
+		return 0;
+
+	std::mt19937 random(1);
+	const char* pieces[] = { "a", " ", "\n", "\r\n", "\xD0\xB6", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80", "\xED\xA0\x80", "\xC0\xAF",
+		"a\0", "\0a", "\x36\x04", "\x3D\xD8\x00\xDE", "\xD8\x3D\xDE\x00", "\x00\xDC", "\x00\xD8", "a\0\0\0", "\0\0\0a",
+		"\x00\xF6\x01\x00", "\x00\xD8\x00\x00", "\xFF\xFE", "\xFE\xFF", "\xEF\xBB\xBF", "\x80", "\xFF", "\xE9" };
+	const size_t lengths[] = { 1, 1, 1, 2, 2, 3, 4, 3, 2, 2, 2, 2, 4, 4, 2, 2, 4, 4, 4, 4, 2, 2, 3, 1, 1, 1 };
+	std::string input;
+	for (int run = 0; run < 20000; ++run)
+	{
+		input.assign(ControlSize, '\0');
+		for (char& control : input)
+			control = static_cast<char>(random());
+		const size_t count = random() % 200;
+		const size_t kinds = sizeof(pieces) / sizeof(pieces[0]);
+		const size_t mix[3] = { random() % kinds, random() % kinds, random() % kinds };
+		for (size_t i = 0; i < count; ++i)
+		{
+			// mostly three kinds of piece, as text in one encoding would be
+			const size_t piece = random() % 8 ? mix[random() % 3] : random() % kinds;
+			input.append(pieces[piece], lengths[piece]);
+		}
+		LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+	}
+	std::printf("decode_fuzz: %d random inputs, %zu vector levels\n", 20000, VectorLevels().size());
+	return 0;
+}
+#endif
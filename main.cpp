@@ -8,185 +8,633 @@
  */
 
 #include <iostream>
-#include <locale>
-#include <codecvt>
-#include <fstream>
 #include <vector>
 #include <algorithm>
-#include <iomanip>
 #include <cstdint>
 #include <ios>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
 #include <assert.h>
-#include "EncodingDetect.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+#include "AsyncIo.h"
+#include "Batch.h"
+#include "CodePages.h"
+#include "Converter.h"
+#include "DecodeError.h"
+#include "DetectionCache.h"
+#include "DetectorBackend.h"
+#include "Dispatch.h"
+#include "HexWriter.h"
+#include "LineIndex.h"
+#include "LineSplitter.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include "Normalizer.h"
+#include "ParallelDecoder.h"
+#include "Pipeline.h"
+#include "StreamingDecoder.h"
+#include "TextStatistics.h"
 
 namespace
 {
 
+// read size for input that cannot be mapped, also the decoder memory bound
+const size_t ChunkSize = 64 * 1024;
 
-std::locale DetectLocale(const char* begin, const char* end, const std::locale& defaultLocale)
+// stdin is read as it arrives instead of being collected first
+std::istream& BinaryStdin()
 {
-	static const char UTF_8_BOM[] = "\xEF\xBB\xBF";
-	static const char UTF_16_LE_BOM[] = "\xFF\xFE";
-	static const char UTF_16_BE_BOM[] = "\xFE\xFF";
+#ifdef _WIN32
+	// text mode would translate CR LF and stop at ^Z
+	::_setmode(::_fileno(stdin), _O_BINARY);
+#endif
+	return std::cin;
+}
 
-	assert(begin != nullptr);
-	assert(end != nullptr);
-	assert(begin <= end);
-	const size_t size = std::distance(begin, end);
+// both names are one existing file, whatever the path
+bool SameFile(const char* a, const char* b)
+{
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION info[2];
+	const char* names[2] = { a, b };
+	for (int i = 0; i < 2; ++i)
+	{
+		const HANDLE file = ::CreateFileA(names[i], 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+			OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		const bool known = ::GetFileInformationByHandle(file, &info[i]) != 0;
+		::CloseHandle(file);
+		if (!known)
+			return false;
+	}
+	return info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber
+		&& info[0].nFileIndexHigh == info[1].nFileIndexHigh && info[0].nFileIndexLow == info[1].nFileIndexLow;
+#else
+	struct stat first, second;
+	return ::stat(a, &first) == 0 && ::stat(b, &second) == 0 && first.st_dev == second.st_dev && first.st_ino == second.st_ino;
+#endif
+}
 
-	if (size >= 3 && std::equal(UTF_8_BOM, UTF_8_BOM + 3, begin)) // danger but use memcmp
-		return std::locale(defaultLocale, new std::codecvt_utf8_utf16<wchar_t, 0x10ffff, std::consume_header>); //UnicodeType::Utf8_BOM;
+// what the decoder found wrong with the input, on stderr; offsets from the
+// start of the file, the decoder started skipped bytes into it
+template<typename Decoder>
+void ReportErrors(const Decoder& decoder, TextEncoding encoding, size_t skipped)
+{
+	metrics::Add(metrics::Counter::Malformed, decoder.ErrorCount());
+	for (const DecodeError& error : decoder.Errors())
+		std::cerr << "malformed " << EncodingName(encoding) << " at byte " << skipped + error.offset << ": " << DecodeErrorName(error.kind) << "\n";
+	if (decoder.ErrorCount() > decoder.Errors().size())
+		std::cerr << "... " << decoder.ErrorCount() - decoder.Errors().size() << " more\n";
+}
 
-	if (size >= 2) {
-		if (std::equal(UTF_16_LE_BOM, UTF_16_LE_BOM + 2, begin)) // danger but use memcmp
-			return std::locale(defaultLocale, new std::codecvt_utf16<wchar_t, 0x10ffff, std::consume_header>); // UnicodeType::Utf16_LE_BOM;
+// the bytes to decode: a whole mapped file, or the first chunk of a stream
+// with the rest still in std::cin or the reader of --pipeline
+struct Input
+{
+	const char* begin;
+	const char* end;
+	size_t skipped; // in front of begin, a BOM that is not converted
+	bool streamed;
+	AsyncReader* reader;
+	bool parallel;  // large enough for ParallelDecoder
+	const bool* enough; // set by the sink once the rest is not needed (--lines)
+};
 
-		if (std::equal(UTF_16_BE_BOM, UTF_16_BE_BOM + 2, begin)) // danger but use memcmp
-			return std::locale(defaultLocale, new std::codecvt_utf16<wchar_t, 0x10ffff, std::consume_header>); // UnicodeType::Utf16_BE_BOM;
+// runs the input through a decoder with codec, the output units to sink;
+// returns the input bytes decoded
+template<typename CharT, typename Codec, typename Sink>
+uint64_t DecodeInput(const Codec& codec, const Input& input, ErrorPolicy policy, Sink& sink)
+{
+	if (input.parallel)
+	{
+		ParallelDecoder<CharT, Codec> decoder(codec);
+		decoder.SetErrorPolicy(policy);
+		decoder.Decode(input.begin, input.end, sink);
+		ReportErrors(decoder, codec.Encoding(), input.skipped);
+		return decoder.Consumed();
 	}
 
-	if (SUCCEEDED(::CoInitialize(nullptr)))
+	std::vector<char> chunk;
+	auto readChunk = [&chunk, &input](const char*& begin, const char*& end) -> bool
+	{
+		// with the reader the time waiting for it
+		const metrics::ScopedStage stage(metrics::Stage::Read);
+		if (input.reader)
+			return input.reader->Next(begin, end);
+		if (!std::cin.read(chunk.data(), chunk.size()) && !std::cin.gcount())
+			return false;
+		begin = chunk.data();
+		end = begin + std::cin.gcount();
+		return true;
+	};
+	StreamingDecoder<CharT, Codec> decoder(codec);
+	decoder.SetErrorPolicy(policy);
+	if (input.enough)
 	{
-		TextEncoding encodeId;
+		// a mapped input piece by piece, up to the last line asked for
+		for (const char* p = input.begin; p != input.end && !*input.enough;)
 		{
-			EncodeDetector detector;
-			encodeId = detector.Detect(begin, end);
+			const char* next = static_cast<size_t>(input.end - p) > ChunkSize ? p + ChunkSize : input.end;
+			if (!decoder.Feed(p, next, sink))
+				break;
+			p = next;
 		}
-		::CoUninitialize();
-
-		switch (encodeId)
-		{
-		case TextEncoding::UTF8: 
-			return std::locale(defaultLocale, new std::codecvt_utf8_utf16<wchar_t, 0x10ffff, std::consume_header>);;
-		case TextEncoding::UTF16LE: 
-			return std::locale(defaultLocale, new std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>);
-		case TextEncoding::UTF16BE:
-			return std::locale(defaultLocale, new std::codecvt_utf16<wchar_t>);
-		case TextEncoding::UTF32LE:
-		case TextEncoding::UTF32BE:
-			throw new std::runtime_error("not supported UTF-32!");
-		default:
-			return std::locale(defaultLocale, new std::codecvt<char16_t, char, mbstate_t>);
+	}
+	else if (decoder.Feed(input.begin, input.end, sink) && input.streamed)
+	{
+		chunk.resize(input.reader ? 0 : ChunkSize);
+		const char* begin;
+		const char* end;
+		while (readChunk(begin, end))
+		{
+			if (!decoder.Feed(begin, end, sink))
+				break;
 		}
 	}
-
-	return defaultLocale;
+	// a character cut off by a piece that went unused is no error
+	if (!input.enough || !*input.enough)
+		decoder.Finish(sink);
+	ReportErrors(decoder, codec.Encoding(), input.skipped);
+	return decoder.Consumed();
 }
 
-
-std::wifstream& SafeGetLine(std::wifstream& in, std::wstring& line)
+// --lines=FIRST-LAST, FIRST- or FIRST: numbered from 1, LAST included
+bool ParseLineRange(const char* text, uint64_t& first, uint64_t& last)
 {
-	line.clear();
-	std::wifstream::sentry se(in, true);
-	
-	auto* buf = in.rdbuf();
-	for (;;)
-	{
-		int c = buf->sbumpc();
-		switch(c) {
-		case 0xfeff:
-		case 0xfffe:
-			continue;
-		case L'\n':
-			return in;
-		case L'\r':
-		{
-			auto ch = buf->sgetc();
-			if (ch == L'\n' || ch == 0xa00)
-				buf->sbumpc();
-			return in;
-		}
-		case WEOF:
-			// Also handle the case when the last line has no line ending
-			if (line.empty())
-				in.setstate(std::ios::eofbit | std::ios::failbit | std::ios::badbit);
-			return in;
-		default:
-			line += static_cast<wchar_t>(c);
-		}
+	char* end;
+	first = std::strtoull(text, &end, 10);
+	if (end == text || !first)
+		return false;
+	last = first;
+	if (*end != '-')
+		return !*end;
+	text = end + 1;
+	if (!*text)
+	{
+		last = ~uint64_t(0);
+		return true;
 	}
+	last = std::strtoull(text, &end, 10);
+	return end != text && !*end && last >= first;
 }
 
-template<typename OutputIterator, size_t BytesCount = 1024>
-bool ReadFirstBytes(const char* fileName, OutputIterator out)
+// the counters of --cache on stderr at exit
+struct CacheReport
 {
-	assert(fileName);
+	const DetectionCache& cache;
 
-	std::ifstream inputFile(fileName, std::ios::in | std::ios_base::binary | std::ios::ate);
-	if (inputFile.bad())
+	~CacheReport()
 	{
-		std::cout << "file not found!\n";
-		return false;
+		if (cache.IsOpen())
+			std::cerr << "detection cache: " << cache.Hits() << " hits, " << cache.Misses() << " misses\n";
 	}
+};
 
-	size_t bufSize = min(BytesCount, inputFile.tellg());
-	inputFile.seekg(0, std::ios::beg);
-	if (!bufSize)
+// --batch [--threads=N] [--unordered] path...
+int RunBatch(int argc, char* argv[], ErrorPolicy policy, TextEncoding ansi, NormalForm form, bool fold, bool statistics, bool converting, bool pipelined, DetectionCache& cache)
+{
+	if (converting)
 	{
-		std::cout << "file is empty!\n";
-		return false;
+		std::cerr << "--to converts a single input, not --batch\n";
+		return -1;
 	}
-
-	std::cout << "bytes before convert:\n";
-	copy_n(std::istreambuf_iterator<char>(inputFile), bufSize, out);
-	return true;
+	if (pipelined)
+	{
+		// the batch overlaps files on its threads already
+		std::cerr << "--pipeline streams a single input, not --batch\n";
+		return -1;
+	}
+	BatchOptions options;
+	options.policy = policy;
+	options.ansi = ansi;
+	options.form = form;
+	options.fold = fold;
+	options.statistics = statistics;
+	options.cache = cache.IsOpen() ? &cache : nullptr;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (!std::strncmp(argv[i], "--threads=", 10))
+			options.threads = static_cast<size_t>(std::strtoul(argv[i] + 10, nullptr, 10));
+		else if (!std::strcmp(argv[i], "--unordered"))
+			options.ordered = false;
+		else
+			options.inputs.push_back(argv[i]);
+	}
+	if (options.inputs.empty())
+		return -1;
+	return BatchRunner(options).Run(std::cout);
 }
-
 }
 
 int main(int argc, char* argv[]) {
-	std::cout << "Test print unicode text file\n";
+	// in front of everything else:
+	//  --simd=scalar|sse42|avx2|avx512|neon forces the kernel level instead of
+	//  the best one of this CPU
+	//  --detector=native|mlang|icu picks the DetectorBackend for ambiguous input
+	//  --errors=stop|replace|skip is the ErrorPolicy for malformed input
+	//  --metrics=json|prometheus writes the Metrics.h counters to stderr at
+	//  exit, in builds with UNICODE_TEST_METRICS
+	//  --to=utf-8|utf-16le|utf-16be|utf-32le|utf-32be writes the text itself
+	//  in that encoding to stdout instead of the dump (Converter.h)
+	//  --cache=file keeps detection results there for files that do not
+	//  change between runs (DetectionCache.h)
+	//  --ansi=1250|1251|1252|28591 is the code page of single byte input that
+	//  the detector does not name itself (CodePages.h), ISO-8859-1 by default
+	//  --pipeline reads the input and writes the output on threads of their
+	//  own, overlapped with decoding (AsyncIo.h), instead of mapping the file
+	//  --normalize=nfc|nfd and --fold bring the decoded text into that normal
+	//  form and case fold it before it is split into lines (Normalizer.h)
+	//  --stats writes a JSON summary of the decoded text, its code points by
+	//  UTF-8 length, plane and block, and its lines by length, instead of the
+	//  dump (TextStatistics.h)
+	//  --index=file keeps sparse line checkpoints of the input there, made
+	//  again when missing or out of date (LineIndex.h); alone it only builds
+	//  them
+	//  --lines=first-last dumps only those lines, numbered from 1, decoded
+	//  from the checkpoint of --index in front of the first one
+	ErrorPolicy policy = ErrorPolicy::Stop;
+	metrics::Format metricsFormat = metrics::Format::None;
+	bool converting = false;
+	TextEncoding target = TextEncoding::UTF8;
+	DetectionCache cache;
+	const char* cacheFile = nullptr;
+	bool pipelined = false;
+	TextEncoding ansi = TextEncoding::Ansi;
+	NormalForm form = NormalForm::None;
+	bool fold = false;
+	bool statistics = false;
+	const char* indexFile = nullptr;
+	bool ranged = false;
+	uint64_t firstLine = 1;
+	uint64_t lastLine = ~uint64_t(0);
+	for (; argc > 1; --argc, ++argv)
+	{
+		if (!std::strncmp(argv[1], "--simd=", 7))
+		{
+			SimdLevel level;
+			if (!ParseSimdLevel(argv[1] + 7, level) || !simd::SelectSimdLevel(level))
+			{
+				std::cerr << "unsupported SIMD level " << argv[1] + 7 << "\n";
+				return -1;
+			}
+		}
+		else if (!std::strncmp(argv[1], "--detector=", 11))
+		{
+			if (!SelectDetectorBackend(argv[1] + 11))
+			{
+				std::cerr << "unsupported detector " << argv[1] + 11 << "\n";
+				return -1;
+			}
+		}
+		else if (!std::strncmp(argv[1], "--errors=", 9))
+		{
+			if (!ParseErrorPolicy(argv[1] + 9, policy))
+			{
+				std::cerr << "unsupported error policy " << argv[1] + 9 << "\n";
+				return -1;
+			}
+		}
+		else if (!std::strncmp(argv[1], "--to=", 5))
+		{
+			if (!ParseTargetEncoding(argv[1] + 5, target))
+			{
+				std::cerr << "unsupported target encoding " << argv[1] + 5 << "\n";
+				return -1;
+			}
+			converting = true;
+		}
+		else if (!std::strncmp(argv[1], "--cache=", 8))
+			cacheFile = argv[1] + 8;
+		else if (!std::strncmp(argv[1], "--ansi=", 7))
+		{
+			if (!ParseSingleByteEncoding(argv[1] + 7, ansi))
+			{
+				std::cerr << "unsupported code page " << argv[1] + 7 << "\n";
+				return -1;
+			}
+		}
+		else if (!std::strcmp(argv[1], "--pipeline"))
+			pipelined = true;
+		else if (!std::strncmp(argv[1], "--normalize=", 12))
+		{
+			if (!ParseNormalForm(argv[1] + 12, form))
+			{
+				std::cerr << "unsupported normal form " << argv[1] + 12 << "\n";
+				return -1;
+			}
+		}
+		else if (!std::strcmp(argv[1], "--fold"))
+			fold = true;
+		else if (!std::strcmp(argv[1], "--stats"))
+			statistics = true;
+		else if (!std::strncmp(argv[1], "--index=", 8))
+			indexFile = argv[1] + 8;
+		else if (!std::strncmp(argv[1], "--lines=", 8))
+		{
+			if (!ParseLineRange(argv[1] + 8, firstLine, lastLine))
+			{
+				std::cerr << "unsupported line range " << argv[1] + 8 << "\n";
+				return -1;
+			}
+			ranged = true;
+		}
+		else if (!std::strncmp(argv[1], "--metrics=", 10))
+		{
+			if (!metrics::Enabled || !metrics::ParseFormat(argv[1] + 10, metricsFormat))
+			{
+				std::cerr << "unsupported metrics format " << argv[1] + 10 << (metrics::Enabled ? "" : " (built without UNICODE_TEST_METRICS)") << "\n";
+				return -1;
+			}
+		}
+		else
+			break;
+	}
+
+	// after --detector=, the cache belongs to the backend
+	if (cacheFile && !cache.Open(cacheFile))
+	{
+		if (DetectionCache::Foreign(cacheFile))
+			std::cerr << cacheFile << " is not a detection cache\n";
+		else
+			std::cerr << "cannot open detection cache " << cacheFile << "\n";
+		return -1;
+	}
+	const CacheReport cacheReport = { cache };
+	if (converting && (form != NormalForm::None || fold))
+	{
+		// the converters write bytes, the normalizer works on UTF-16
+		std::cerr << "--normalize and --fold apply to the UTF-16 dump, not --to\n";
+		return -1;
+	}
+	if (converting && statistics)
+	{
+		std::cerr << "--stats summarizes the decoded text instead of writing it, not with --to\n";
+		return -1;
+	}
+
+	if ((ranged || indexFile) && (converting || statistics))
+	{
+		std::cerr << "--lines and --index pick lines of the dump, not --to or --stats\n";
+		return -1;
+	}
+
+	const metrics::Report report(metricsFormat, std::cerr);
+	if (argc > 1 && !std::strcmp(argv[1], "--batch"))
+	{
+		if (ranged || indexFile)
+		{
+			std::cerr << "--lines and --index seek in a single file, not --batch\n";
+			return -1;
+		}
+		return RunBatch(argc, argv, policy, ansi, form, fold, statistics, converting, pipelined, cache);
+	}
+
+	// converted text or the summary goes to stdout alone, everything else to
+	// stderr
+	const bool dumping = !converting && !statistics && !ranged && !indexFile;
+	std::ostream& notes = dumping ? std::cout : std::cerr;
+	if (dumping)
+		std::cout << "Test print unicode text file\n";
 
 	if (argc < 2)
 		return -1;
 
-	std::vector<char> buf;
-	buf.reserve(1024);
-	if (!ReadFirstBytes(argv[1], std::back_inserter(buf)))
+	// a file is mapped and decoded in one go; a pipe, or any input with
+	// --pipeline, goes through the decoder chunk by chunk, only the first chunk
+	// is kept for detection and a retry
+	const bool fromStdin = !std::strcmp(argv[1], "-");
+	const bool streamed = fromStdin || pipelined;
+	if ((ranged || indexFile) && streamed)
+	{
+		std::cerr << "--lines and --index seek in a mapped file, not stdin or --pipeline\n";
+		return -1;
+	}
+	// the index file is replaced when it is stale, so it must be one
+	if (indexFile && SameFile(indexFile, argv[1]))
+	{
+		std::cerr << "--index names the input itself\n";
+		return -1;
+	}
+	if (indexFile && LineIndex::Foreign(indexFile))
+	{
+		std::cerr << indexFile << " is not a line index\n";
+		return -1;
+	}
+	MappedFile input;
+	std::vector<char> head;
+	AsyncReader reader(ChunkSize);
+	bool opened;
+	{
+		const metrics::ScopedStage stage(metrics::Stage::Read);
+		const char* begin;
+		const char* end;
+		if (pipelined)
+		{
+			opened = reader.Open(argv[1]);
+			if (opened && reader.Next(begin, end))
+				head.assign(begin, end);
+			opened = opened && !reader.Failed();
+		}
+		else if (fromStdin)
+		{
+			head.resize(ChunkSize);
+			std::istream& in = BinaryStdin();
+			in.read(head.data(), head.size());
+			head.resize(static_cast<size_t>(in.gcount()));
+			opened = !in.bad();
+		}
+		else
+			opened = input.Open(argv[1]);
+	}
+
+	const char* headBegin = streamed ? head.data() : input.begin();
+	const char* headEnd = streamed ? head.data() + head.size() : input.end();
+	if (!opened)
+	{
+		notes << "file not found!\n";
 		return -1;
-	
-	if (buf.empty())
+	}
+	if (headBegin == headEnd)
+	{
+		notes << "file is empty!\n";
 		return -1;
+	}
 
-	std::for_each(cbegin(buf), cend(buf), [](char c)
+	// sniff and decode from the same pages, the file is never read twice
+	const char* sniffEnd = headBegin + std::min<size_t>(SniffSize, headEnd - headBegin);
+	// with --pipeline the writer's blocks go to stdout from another thread;
+	// what was printed in front is out of the way first
+	std::cout.flush();
+	std::unique_ptr<AsyncWriter> pipelinedOut(pipelined ? new AsyncWriter(std::cout.rdbuf(), HexWriter::DefaultCapacity) : nullptr);
+	std::ostream output(pipelined ? pipelinedOut.get() : std::cout.rdbuf());
+	HexWriter writer(output);
+	if (dumping)
 	{
-		std::cout << std::hex << std::showbase << c;
-	});
+		writer.Text("bytes before convert:\n");
+		writer.Bytes(headBegin, sniffEnd);
+	}
 
-	std::wifstream in(argv[1], std::ios::binary | std::ios::ate);
-	int64_t fsize = in.tellg();
+	// an index of this file names the encoding, the detector is not asked
+	LineIndex index;
+	const bool indexed = indexFile && index.Load(indexFile) && index.Describes(input, policy, ansi);
+	const DetectionResult detected = [&]
+	{
+		if (indexed)
+			return DetectionResult{ index.Encoding(), 100, 0 };
+		const metrics::ScopedStage stage(metrics::Stage::Detect);
+		DetectionResult result = cache.IsOpen() && !streamed ? cache.Detect(argv[1], input) : DetectEncoding(headBegin, headEnd);
+		if (result.encoding == TextEncoding::Ansi)
+			result.encoding = ansi;
+		return result;
+	}();
+	if (!indexed)
+		metrics::Detected(detected);
 
-	in.seekg(0, std::ios::beg);
-	in.imbue(DetectLocale(buf.data(), buf.data() + buf.size(), in.getloc()));
+	if (indexFile && !indexed)
+	{
+		const metrics::ScopedStage stage(metrics::Stage::Decode);
+		auto build = [&](auto codec) { return index.Build<wchar_t>(codec, input, policy, ansi); };
+		// nothing decodable in front of the first line: the single byte
+		// conversion, as below
+		if (!WithDecoder(detected.encoding, build) && !index.Lines() && detected.encoding != ansi)
+			WithDecoder(ansi, build);
+		if (!index.Save(indexFile))
+		{
+			std::cerr << "cannot write line index " << indexFile << "\n";
+			return -1;
+		}
+		metrics::Add(metrics::Counter::BytesIn, index.Consumed());
+	}
+	if (indexFile && !ranged)
+	{
+		std::cout << "line index " << indexFile << ": " << EncodingName(index.Encoding()) << ", " << index.Lines() << " lines, "
+			<< index.CodePoints() << " code points, " << index.Checkpoints().size() << " checkpoints";
+		if (!index.Complete())
+			std::cout << ", malformed at byte " << index.Consumed();
+		std::cout << "\n";
+		metrics::Add(metrics::Counter::Files, 1);
+		return 0;
+	}
 
-	std::cout << "\nConverted to following UTF-16 by wifstream: \n";
-	std::wstring line;
-	for (bool first = true; fsize && in.good(); first = false)
+	if (dumping)
+		writer.Text("\nConverted to following UTF-16 by wifstream: \n");
+	size_t lines = 0;
+	uint64_t units = 0;
+	TextStatistics<wchar_t> summary;
+	// --lines starts at the checkpoint in front of its first line; without
+	// --index that is the one at byte 0
+	const LineIndex::Checkpoint start = index.SeekLine(firstLine - 1);
+	bool enough = false;
+	auto print = [&writer, &lines, &summary, &enough, &start, statistics, ranged, firstLine, lastLine](const wchar_t* begin, const wchar_t* end)
 	{
-		//getline(in, line);
-		SafeGetLine(in, line);
+		++lines;
+		if (statistics)
+			return summary.Line(begin, end);
+		if (ranged)
+		{
+			const uint64_t number = start.line + lines;
+			enough = number >= lastLine;
+			if (number < firstLine || number > lastLine)
+				return;
+		}
+		const metrics::ScopedStage stage(metrics::Stage::Output);
+		writer.CodeUnits(begin, end);
+		writer.EndLine();
+	};
+
+	// a large mapped file is decoded on all cores; a converted or counted one
+	// starts behind its BOM, a range of lines at its checkpoint
+	const size_t skipped = ranged ? static_cast<size_t>(start.offset) : dumping ? 0 : detected.bomLength;
+	const Input in = { headBegin + skipped, headEnd, skipped, streamed, pipelined ? &reader : nullptr,
+		!streamed && !ranged && std::thread::hardware_concurrency() > 1 && ParallelDecoder<wchar_t>::IsWorthwhile(input.Size()),
+		ranged ? &enough : nullptr };
 
-		if (in.bad() || in.fail())
+	// WithDecoder switches over the encoding once, this loop is compiled
+	// for every encoding with its kernel inlined
+	auto decodeAll = [&](auto codec) -> uint64_t
+	{
+		const metrics::ScopedStage stage(metrics::Stage::Decode);
+		LineSplitter<wchar_t> splitter;
+		TextNormalizer<wchar_t> normalizer(form, fold);
+		auto split = [&](const wchar_t* begin, const wchar_t* end)
 		{
-			if (first)
+			if (statistics)
 			{
-				in.close();
-				in.open(argv[1], std::ios::binary);
-				in.seekg(0, std::ios::beg);
-				in.imbue(std::locale(in.getloc(), new std::codecvt<wchar_t, char, mbstate_t>));
-				continue;
+				const metrics::ScopedStage stage(metrics::Stage::Statistics);
+				summary.Count(begin, end);
 			}
-			break;
-		}
-		else
+			const metrics::ScopedStage stage(metrics::Stage::Split);
+			splitter.Push(begin, end, print);
+			units += end - begin;
+		};
+		auto push = [&normalizer, &split](const wchar_t* begin, const wchar_t* end)
 		{
-			for (auto c : line)
-				std::cout << "U+" << std::hex << std::setw(4) << std::setfill('0') << c << ' ';
+			if (!normalizer.Enabled())
+				return split(begin, end);
+			const metrics::ScopedStage stage(metrics::Stage::Normalize);
+			normalizer.Push(begin, end, split);
+		};
+		const uint64_t consumed = DecodeInput<wchar_t>(codec, in, policy, push);
+		normalizer.Finish(split);
+		summary.Finish();
+		splitter.Finish(print);
+		return consumed;
+	};
 
-			std::cout << std::endl;
-			if (in.eof())
-				break;
-		}
+	// the same for every pair of encodings, the output bytes as they come
+	auto convertAll = [&](auto converter) -> uint64_t
+	{
+		const metrics::ScopedStage stage(metrics::Stage::Decode);
+		auto push = [&writer, &units](const char* begin, const char* end)
+		{
+			const metrics::ScopedStage stage(metrics::Stage::Output);
+			writer.Bytes(begin, end);
+			units += end - begin;
+		};
+		return DecodeInput<char>(converter, in, policy, push);
+	};
+
+	TextEncoding encoding = indexFile ? index.Encoding() : detected.encoding;
+	uint64_t consumed;
+	for (bool retried = false;; retried = true)
+	{
+		units = 0;
+		enough = false;
+		summary.Reset();
+		consumed = converting ? WithConverter(encoding, target, convertAll) : WithDecoder(encoding, decodeAll);
+
+		// nothing decodable in front of the first line: restart from the
+		// first chunk with the plain single byte conversion, unless the index
+		// settled the encoding already
+		if ((converting ? units : lines) || retried || indexFile || consumed + skipped >= head.size() + input.Size())
+			break;
+		encoding = ansi;
+	}
+	if (reader.Failed())
+	{
+		std::cerr << "read error!\n";
+		return -1;
+	}
+	if (statistics)
+	{
+		std::string json = "{\"path\": ";
+		TextStatistics<wchar_t>::AppendJsonString(json, argv[1]);
+		json += ", \"encoding\": \"" + std::string(EncodingName(encoding)) + "\", \"bytes\": " + std::to_string(skipped + consumed) + ", ";
+		summary.AppendJson(json);
+		json += "}\n";
+		const metrics::ScopedStage stage(metrics::Stage::Output);
+		writer.Bytes(json.data(), json.data() + json.size());
 	}
+	metrics::Add(metrics::Counter::Files, 1);
+	metrics::Add(metrics::Counter::BytesIn, consumed);
+	metrics::Add(metrics::Counter::UnitsOut, units);
+	metrics::Add(metrics::Counter::Lines, lines);
 	return 0;
 }
@@ -0,0 +1,145 @@
+/**
+ * The batch workers stop allocating once warmed up: a second pass of
+ * BatchRunner::Process over the same files makes no heap allocation, and the
+ * arena of the line buffers is Reset between files instead of growing
+ *
+ * @file arena_alloc_test.cpp
+ * @section LICENSE
+
+    This code is under MIT License, http://opensource.org/licenses/MIT
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+#include "../Batch.h"
+
+// every operator new of the process goes through here
+namespace
+{
+
+std::atomic<size_t> allocations(0);
+
+}
+
+void* operator new(size_t size)
+{
+	++allocations;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace
+{
+
+int failures = 0;
+
+void Check(bool condition, const char* what, const std::string& path)
+{
+	if (condition)
+		return;
+	std::fprintf(stderr, "arena_alloc_test: %s: %s\n", path.c_str(), what);
+	++failures;
+}
+
+// inputs whose lines cross the decoder's block boundaries, so that they are
+// assembled in the arena, in the encodings that decode differently
+std::vector<std::string> WriteInputs(const std::string& directory)
+{
+	std::vector<std::string> paths;
+	auto write = [&](const char* name, const std::string& content)
+	{
+		paths.push_back(directory + "/" + name);
+		std::ofstream(paths.back(), std::ios::binary) << content;
+	};
+
+	std::string longLines;
+	for (int line = 0; line < 8; ++line)
+		longLines += std::string(40000 + line * 1000, 'a' + line) + (line % 2 ? "\r\n" : "\n");
+	write("long_lines.txt", longLines);
+
+	std::string utf8 = "\xEF\xBB\xBF";
+	for (int line = 0; line < 2000; ++line)
+		utf8 += "\xD0\xB6\xE4\xB8\xAD line " + std::to_string(line) + (line % 7 ? "" : std::string(30000, 'x')) + "\n";
+	write("utf8.txt", utf8);
+
+	std::string utf16 = "\xFF\xFE";
+	for (int line = 0; line < 3000; ++line)
+	{
+		const std::string text = "line " + std::to_string(line) + std::string(line % 5 ? 10 : 9000, '-') + "\r\n";
+		for (const char c : text)
+			utf16 += std::string(1, c) + '\0';
+	}
+	write("utf16le.txt", utf16);
+
+	write("short.txt", "one\ntwo\nthree");
+	return paths;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	const std::string directory = argc > 1 ? argv[1] : ".";
+	const std::vector<std::string> paths = WriteInputs(directory);
+
+	BatchOptions options;
+	options.inputs = paths;
+	const BatchRunner runner(options);
+	BatchRunner::Worker worker;
+	std::vector<BatchRunner::FileResult> first;
+	for (const std::string& path : paths)
+	{
+		first.push_back(runner.Process(path, worker));
+		Check(!first.back().error, "not decoded", path);
+	}
+	const size_t capacity = worker.arena.Capacity();
+	Check(capacity > 0, "no line assembled in the arena", directory);
+
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		const size_t before = allocations;
+		const BatchRunner::FileResult result = runner.Process(paths[i], worker);
+		const size_t count = allocations - before;
+		if (count)
+			std::fprintf(stderr, "arena_alloc_test: %zu allocations\n", count);
+		Check(!count, "heap allocation on the second pass", paths[i]);
+		Check(result.lines == first[i].lines && result.units == first[i].units, "another result on the second pass", paths[i]);
+		Check(worker.arena.Capacity() == capacity, "the arena grew", paths[i]);
+	}
+
+	for (const std::string& path : paths)
+		std::remove(path.c_str());
+	std::printf("arena_alloc_test: %zu files, arena of %zu bytes, %s\n", paths.size(), capacity, failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
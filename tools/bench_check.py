@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+# Fails when the throughput of bench/pipeline_bench.cpp drops below a stored
+# baseline, for CI:
+#
+#     python3 tools/bench_check.py build/pipeline_bench bench/baseline.json
+#
+# runs the benchmark (detection, decoding and conversion to UTF-8 of every
+# corpus by default, the median of some repetitions) and compares the bytes
+# per second of every benchmark in the baseline; one that is more than
+# --threshold percent slower, or missing, fails the check. --results takes a
+# --benchmark_format=json output instead of running the benchmark. --update
+# writes the baseline from this run; it is only good for the machine it was
+# made on, the check warns when the CPU is another one.
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+DEFAULT_FILTER = '^(detect|decode|to_utf8)/'
+
+
+def run_benchmark(binary, benchmark_filter, repetitions):
+    command = [binary, '--benchmark_filter=' + benchmark_filter, '--benchmark_format=json',
+               '--benchmark_repetitions=%d' % repetitions, '--benchmark_report_aggregates_only=true']
+    output = subprocess.run(command, check=True, stdout=subprocess.PIPE).stdout
+    return json.loads(output.decode('utf-8'))
+
+
+def medians(results):
+    """bytes per second by benchmark name, the median where there are aggregates"""
+    rates = {}
+    for benchmark in results['benchmarks']:
+        if 'bytes_per_second' not in benchmark:
+            continue
+        name = benchmark.get('run_name', benchmark['name'])
+        if benchmark.get('run_type') == 'aggregate':
+            if benchmark.get('aggregate_name') != 'median':
+                continue
+        elif name in rates:
+            continue
+        rates[name] = benchmark['bytes_per_second']
+    return rates
+
+
+def machine(results):
+    context = results.get('context', {})
+    return {key: context.get(key) for key in ('host_name', 'num_cpus', 'mhz_per_cpu')}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='throughput regression check of pipeline_bench')
+    parser.add_argument('binary', nargs='?', help='pipeline_bench to run')
+    parser.add_argument('baseline', help='baseline JSON, written by --update')
+    parser.add_argument('--results', help='pipeline_bench --benchmark_format=json output to check instead of running it')
+    parser.add_argument('--threshold', type=float, default=15.0, help='percent slower that fails, 15 by default')
+    parser.add_argument('--filter', default=None, help='benchmarks to run, %s by default' % DEFAULT_FILTER)
+    parser.add_argument('--repetitions', type=int, default=5)
+    parser.add_argument('--update', action='store_true', help='write the baseline from this run')
+    args = parser.parse_args()
+
+    baseline = None
+    if not args.update:
+        with open(args.baseline, encoding='utf-8') as f:
+            baseline = json.load(f)
+    benchmark_filter = args.filter or (baseline or {}).get('filter', DEFAULT_FILTER)
+
+    if args.results:
+        with open(args.results, encoding='utf-8') as f:
+            results = json.load(f)
+    elif args.binary:
+        results = run_benchmark(args.binary, benchmark_filter, args.repetitions)
+    else:
+        sys.exit('bench_check.py: give the pipeline_bench binary or --results')
+    rates = medians(results)
+
+    if args.update:
+        stored = {name: round(rate) for name, rate in rates.items()}
+        with open(args.baseline, 'w', encoding='utf-8') as f:
+            json.dump({'machine': machine(results), 'simd': os.environ.get('UNICODE_TEST_SIMD', 'best'),
+                       'filter': benchmark_filter, 'bytes_per_second': stored}, f, indent=1, sort_keys=True)
+            f.write('\n')
+        print('%s: %d benchmarks' % (args.baseline, len(rates)))
+        return 0
+
+    if machine(results) != baseline.get('machine'):
+        print('warning: the baseline was made on %s, this is %s' % (baseline.get('machine'), machine(results)))
+    if os.environ.get('UNICODE_TEST_SIMD', 'best') != baseline.get('simd', 'best'):
+        print('warning: the baseline was made with UNICODE_TEST_SIMD=%s' % baseline.get('simd'))
+
+    failed = []
+    for name, expected in sorted(baseline['bytes_per_second'].items()):
+        actual = rates.get(name)
+        if actual is None:
+            print('%-32s %12s  missing' % (name, ''))
+            failed.append(name)
+            continue
+        change = 100.0 * (actual - expected) / expected
+        slow = change < -args.threshold
+        print('%-32s %9.1f MB/s %+7.1f%%%s' % (name, actual / 1e6, change, '  REGRESSED' if slow else ''))
+        if slow:
+            failed.append(name)
+    for name in sorted(set(rates) - set(baseline['bytes_per_second'])):
+        print('%-32s %9.1f MB/s  not in the baseline' % (name, rates[name] / 1e6))
+
+    if failed:
+        print('%d of %d benchmarks more than %g%% below the baseline or missing' % (len(failed), len(baseline['bytes_per_second']), args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+# Writes UnicodeTables.h, the character data of Normalizer.h and
+# TextStatistics.h, from the Unicode Character Database built into Python's
+# unicodedata and the Blocks.txt of the same version, which unicodedata does
+# not have (Perl ships one in unicore/):
+#
+#     python3 tools/unicode_tables.py Blocks.txt > UnicodeTables.h
+#
+# The header names the Unicode version it was made from; run it again with a
+# newer Python to move to a newer version.
+
+import re
+import sys
+import unicodedata
+
+MAX_CODE_POINT = 0x110000
+BLOCK_BITS = 7
+BLOCK = 1 << BLOCK_BITS
+
+# Hangul syllables and jamo are handled by arithmetic, not the tables
+S_BASE, L_BASE, V_BASE, T_BASE = 0xAC00, 0x1100, 0x1161, 0x11A7
+L_COUNT, V_COUNT, T_COUNT = 19, 21, 28
+S_COUNT = L_COUNT * V_COUNT * T_COUNT
+
+NFD_NO = 0x100
+NFC_NO = 0x200
+NFC_MAYBE = 0x400
+FOLDS = 0x800
+
+# the blocks of the BMP and the SMP (emoji among them) are looked up by table
+COLUMN_LIMIT = 0x20000
+
+
+def is_hangul_syllable(cp):
+    return S_BASE <= cp < S_BASE + S_COUNT
+
+
+def canonical_mapping(cp):
+    """the one level canonical decomposition, None for none or compatibility"""
+    raw = unicodedata.decomposition(chr(cp))
+    if not raw or raw.startswith('<'):
+        return None
+    return [int(part, 16) for part in raw.split()]
+
+
+def full_decomposition(cp):
+    mapping = canonical_mapping(cp)
+    if mapping is None:
+        return [cp]
+    result = []
+    for part in mapping:
+        result.extend(full_decomposition(part))
+    return result
+
+
+def simple_fold(cp):
+    """the C and S mappings of CaseFolding.txt: casefold() where it gives one
+    character, else the single character lower case (U+1E9E, Greek with
+    prosgegrammeni); the Turkic T mappings are left out"""
+    c = chr(cp)
+    folded = c.casefold()
+    if len(folded) == 1:
+        return ord(folded)
+    lower = c.lower()
+    if len(lower) == 1:
+        return ord(lower)
+    return cp
+
+
+def read_blocks(path):
+    """(first, last, name) of Blocks.txt, which must be of unidata_version"""
+    with open(path, encoding='utf-8') as f:
+        text = f.read()
+    version = re.match(r'# Blocks-([0-9.]+)\.txt', text)
+    if not version or version.group(1) != unicodedata.unidata_version:
+        sys.exit('%s is not Blocks-%s.txt' % (path, unicodedata.unidata_version))
+    blocks = []
+    for line in text.splitlines():
+        match = re.match(r'([0-9A-F]+)\.\.([0-9A-F]+); (.+)$', line)
+        if match:
+            blocks.append((int(match.group(1), 16), int(match.group(2), 16), match.group(3)))
+    assert blocks == sorted(blocks) and all(first % 16 == 0 and last % 16 == 15 for first, last, _ in blocks)
+    return blocks
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('usage: unicode_tables.py Blocks.txt > UnicodeTables.h')
+    blocks_of_text = read_blocks(sys.argv[1])
+    out = sys.stdout
+    props = [0] * MAX_CODE_POINT
+    decompositions = []
+    compositions = []
+    folds = []
+
+    for cp in range(MAX_CODE_POINT):
+        if 0xD800 <= cp < 0xE000:
+            continue
+        c = chr(cp)
+        value = unicodedata.combining(c)
+        if is_hangul_syllable(cp):
+            value |= NFD_NO
+        elif canonical_mapping(cp) is not None:
+            value |= NFD_NO
+            decompositions.append((cp, full_decomposition(cp)))
+            mapping = canonical_mapping(cp)
+            # a primary composite: NFC gives it back
+            if unicodedata.normalize('NFC', c) == c and len(mapping) == 2:
+                compositions.append((mapping[0], mapping[1], cp))
+        if unicodedata.normalize('NFC', c) != c:
+            value |= NFC_NO
+        folded = simple_fold(cp)
+        if folded != cp:
+            value |= FOLDS
+            folds.append((cp, folded))
+        props[cp] = value
+
+    # the second character of a composite may combine with the one in front
+    for first, second, composite in compositions:
+        if not props[second] & NFC_NO:
+            props[second] |= NFC_MAYBE
+    for cp in list(range(V_BASE, V_BASE + V_COUNT)) + list(range(T_BASE + 1, T_BASE + T_COUNT)):
+        props[cp] |= NFC_MAYBE
+
+    blocks = []
+    block_index = {}
+    stage1 = []
+    for start in range(0, MAX_CODE_POINT, BLOCK):
+        block = tuple(props[start:start + BLOCK])
+        if block not in block_index:
+            block_index[block] = len(blocks)
+            blocks.append(block)
+        stage1.append(block_index[block])
+    assert len(blocks) <= 256
+
+    data = []
+    offsets = []
+    for cp, parts in decompositions:
+        offsets.append((cp, len(data), len(parts)))
+        data.extend(parts)
+    assert len(data) < 0x10000
+    compositions.sort()
+
+    def rows(values, per_line, width):
+        for i in range(0, len(values), per_line):
+            out.write('\t' + ', '.join('0x%0*X' % (width, v) for v in values[i:i + per_line]) + ',\n')
+
+    out.write('''#ifndef _E8E73EC0_5FC1_4DA3_9C73_F5F519A57EAF_
+#define  _E8E73EC0_5FC1_4DA3_9C73_F5F519A57EAF_
+
+#include <cstdint>
+
+// Generated by tools/unicode_tables.py from the Unicode %s character
+// database, do not edit. Character data of Normalizer.h and TextStatistics.h:
+//  - Properties: a two stage table by code point >> %d; the low 8 bits are
+//    the canonical combining class, then the flags of Normalizer.h
+//  - Decompositions: full canonical decompositions, Hangul syllables left
+//    out, sorted by code point, of DecompositionData[offset, offset + length)
+//  - Compositions: primary composites by their two characters, sorted
+//  - CaseFolds: simple case folding (CaseFolding.txt status C and S), sorted
+//  - Blocks: the ranges of Blocks.txt; ColumnBlocks the index into it of
+//    every 16 code points of planes 0 and 1, BlockCount for No_Block
+namespace unicode_tables
+{
+
+const unsigned PropertyBlockBits = %d;
+
+''' % (unicodedata.unidata_version, BLOCK_BITS, BLOCK_BITS))
+
+    out.write('const uint8_t PropertyIndex[%d] =\n{\n' % len(stage1))
+    rows(stage1, 16, 2)
+    out.write('};\n\n')
+    out.write('const uint16_t PropertyBlocks[%d] =\n{\n' % (len(blocks) * BLOCK))
+    for block in blocks:
+        rows(list(block), 16, 3)
+    out.write('};\n\n')
+
+    out.write('struct Decomposition\n{\n\tchar32_t codePoint;\n\tuint16_t offset;\n\tuint16_t length;\n};\n\n')
+    out.write('const Decomposition Decompositions[%d] =\n{\n' % len(offsets))
+    for i in range(0, len(offsets), 4):
+        out.write('\t' + ' '.join('{ 0x%04X, %d, %d },' % entry for entry in offsets[i:i + 4]) + '\n')
+    out.write('};\n\n')
+    out.write('const char32_t DecompositionData[%d] =\n{\n' % len(data))
+    rows(data, 12, 4)
+    out.write('};\n\n')
+
+    out.write('struct Composition\n{\n\tchar32_t first;\n\tchar32_t second;\n\tchar32_t composite;\n};\n\n')
+    out.write('const Composition Compositions[%d] =\n{\n' % len(compositions))
+    for i in range(0, len(compositions), 4):
+        out.write('\t' + ' '.join('{ 0x%04X, 0x%04X, 0x%04X },' % entry for entry in compositions[i:i + 4]) + '\n')
+    out.write('};\n\n')
+
+    out.write('struct CaseFold\n{\n\tchar32_t codePoint;\n\tchar32_t folded;\n};\n\n')
+    out.write('const CaseFold CaseFolds[%d] =\n{\n' % len(folds))
+    for i in range(0, len(folds), 6):
+        out.write('\t' + ' '.join('{ 0x%04X, 0x%04X },' % entry for entry in folds[i:i + 6]) + '\n')
+    out.write('};\n\n')
+
+    out.write('struct Block\n{\n\tchar32_t first;\n\tchar32_t last;\n\tconst char* name;\n};\n\n')
+    out.write('const unsigned BlockCount = %d;\n\n' % len(blocks_of_text))
+    out.write('const Block Blocks[BlockCount] =\n{\n')
+    for first, last, name in blocks_of_text:
+        out.write('\t{ 0x%04X, 0x%04X, "%s" },\n' % (first, last, name))
+    out.write('};\n\n')
+    columns = [len(blocks_of_text)] * (COLUMN_LIMIT // 16)
+    for index, (first, last, name) in enumerate(blocks_of_text):
+        if first < COLUMN_LIMIT:
+            for column in range(first // 16, last // 16 + 1):
+                columns[column] = index
+    out.write('const char32_t ColumnLimit = 0x%X;\n\n' % COLUMN_LIMIT)
+    out.write('const uint16_t ColumnBlocks[ColumnLimit >> 4] =\n{\n')
+    rows(columns, 16, 3)
+    out.write('};\n\n')
+
+    out.write('} // namespace unicode_tables\n\n#endif\n')
+
+
+if __name__ == '__main__':
+    main()